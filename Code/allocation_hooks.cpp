@@ -0,0 +1,123 @@
+// Replacements for the global operator new and delete, so the profiler can
+// attribute heap allocations to sections, see Profiler::startAllocationTracking.
+// They put a header in front of every block and call into the profiler on
+// every allocation, tracking or not, so they are only built in when
+// PROFILER_ALLOCATION_HOOKS is defined.
+#include "profiler.hpp"
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <new>
+
+#if defined(PROFILER_ALLOCATION_HOOKS)
+
+bool Profiler::HasAllocationHooks() {
+    return true;
+}
+
+namespace {
+    // Every block starts with one of these, so delete knows how many bytes it
+    // frees and whether they were counted. Its size keeps the block after it
+    // aligned like malloc's.
+    struct alignas(alignof(std::max_align_t)) AllocationHeader {
+        size_t size;
+        bool tracked;
+    };
+
+    void* allocate(size_t size) {
+        void* block = std::malloc(sizeof(AllocationHeader) + size);
+        if (block == nullptr) {
+            return nullptr;
+        }
+        AllocationHeader* header = static_cast<AllocationHeader*>(block);
+        header->size = size;
+        header->tracked = Profiler::OnAllocation(size);
+        return header + 1;
+    }
+
+    // Runs the new handler until the allocation succeeds, as the standard
+    // operator new does
+    void* allocateOrThrow(size_t size) {
+        // No block can hold that much and the header, and the size with the
+        // header added would wrap around
+        if (size > SIZE_MAX - sizeof(AllocationHeader)) {
+            throw std::bad_alloc();
+        }
+        void* pointer;
+        while ((pointer = allocate(size)) == nullptr) {
+            std::new_handler handler = std::get_new_handler();
+            if (handler == nullptr) {
+                throw std::bad_alloc();
+            }
+            handler();
+        }
+        return pointer;
+    }
+
+    void deallocate(void* pointer) {
+        if (pointer == nullptr) {
+            return;
+        }
+        AllocationHeader* header = static_cast<AllocationHeader*>(pointer) - 1;
+        if (header->tracked) {
+            Profiler::OnDeallocation(header->size);
+        }
+        std::free(header);
+    }
+}
+
+void* operator new(size_t size) {
+    return allocateOrThrow(size);
+}
+
+void* operator new[](size_t size) {
+    return allocateOrThrow(size);
+}
+
+void* operator new(size_t size, std::nothrow_t const&) noexcept {
+    try {
+        return allocateOrThrow(size);
+    } catch (...) {
+        return nullptr;
+    }
+}
+
+void* operator new[](size_t size, std::nothrow_t const&) noexcept {
+    try {
+        return allocateOrThrow(size);
+    } catch (...) {
+        return nullptr;
+    }
+}
+
+void operator delete(void* pointer) noexcept {
+    deallocate(pointer);
+}
+
+void operator delete[](void* pointer) noexcept {
+    deallocate(pointer);
+}
+
+void operator delete(void* pointer, size_t) noexcept {
+    deallocate(pointer);
+}
+
+void operator delete[](void* pointer, size_t) noexcept {
+    deallocate(pointer);
+}
+
+void operator delete(void* pointer, std::nothrow_t const&) noexcept {
+    deallocate(pointer);
+}
+
+void operator delete[](void* pointer, std::nothrow_t const&) noexcept {
+    deallocate(pointer);
+}
+
+#else
+
+bool Profiler::HasAllocationHooks() {
+    return false;
+}
+
+#endif
@@ -0,0 +1,175 @@
+#include "arena.hpp"
+#include <cstdlib>
+#include <new>
+
+#if defined(__linux__)
+#include <pthread.h>
+#include <sched.h>
+#define PROFILER_HAS_IDLE_PRIORITY 1
+#endif
+
+namespace {
+    // Room for the pointer to the previous slab, keeping the blocks after it aligned
+    constexpr size_t SLAB_HEADER_BYTES = alignof(std::max_align_t);
+
+    void*& NextBlock(void* block) {
+        return *static_cast<void**>(block);
+    }
+}
+
+// Rounded up so every block in a slab stays aligned
+ChunkArena::ChunkArena(size_t blockBytes): blockBytes((blockBytes + alignof(std::max_align_t) - 1) / alignof(std::max_align_t) * alignof(std::max_align_t)), stopping(false), slabs(nullptr), slabCount(0), freeBlocks(nullptr), freeCount(0), freshBlocks(nullptr), freshCount(0) {}
+
+ChunkArena::~ChunkArena() {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+    }
+    wake.notify_one();
+    if (stagingThread.joinable()) {
+        stagingThread.join();
+    }
+
+    while (slabs != nullptr) {
+        char* previous = *reinterpret_cast<char**>(slabs);
+        std::free(slabs);
+        slabs = previous;
+    }
+}
+
+void ChunkArena::allocate(void** blocks, size_t count) {
+    size_t taken = 0;
+    while (true) {
+        bool wantSlab;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            while (taken < count && freeBlocks != nullptr) {
+                blocks[taken++] = freeBlocks;
+                freeBlocks = NextBlock(freeBlocks);
+                freeCount--;
+            }
+            while (taken < count && freshCount > 0) {
+                blocks[taken++] = freshBlocks;
+                freshBlocks += blockBytes;
+                freshCount--;
+            }
+            if (!stagingThread.joinable()) {
+                stagingThread = std::thread(&ChunkArena::stageSlabs, this);
+            }
+            wantSlab = freeCount + freshCount < BLOCKS_PER_SLAB;
+        }
+        if (wantSlab) {
+            wake.notify_one();
+        }
+        if (taken == count) {
+            return;
+        }
+
+        // The background thread has fallen behind
+        char* slab = makeSlab(false);
+        if (slab == nullptr) {
+            throw std::bad_alloc();
+        }
+        std::lock_guard<std::mutex> lock(mutex);
+        *reinterpret_cast<char**>(slab) = slabs;
+        slabs = slab;
+        slabCount++;
+        // Only left over when another thread made a slab at the same time
+        chainFreshBlocks();
+        freshBlocks = slab + SLAB_HEADER_BYTES;
+        freshCount = BLOCKS_PER_SLAB;
+    }
+}
+
+void ChunkArena::release(void* const* blocks, size_t count) {
+    if (count == 0) {
+        return;
+    }
+    // Chained outside the lock, then spliced in
+    for (size_t i = 0; i + 1 < count; i++) {
+        NextBlock(blocks[i]) = blocks[i + 1];
+    }
+    std::lock_guard<std::mutex> lock(mutex);
+    NextBlock(blocks[count - 1]) = freeBlocks;
+    freeBlocks = blocks[0];
+    freeCount += count;
+}
+
+size_t ChunkArena::getBlockBytes() {
+    return blockBytes;
+}
+
+size_t ChunkArena::getReservedBytes() {
+    std::lock_guard<std::mutex> lock(mutex);
+    return slabCount * BLOCKS_PER_SLAB * blockBytes;
+}
+
+void ChunkArena::stageSlabs() {
+#if defined(PROFILER_HAS_IDLE_PRIORITY)
+    // Only runs on time no other thread wants. At normal priority, waking it
+    // on a busy core would preempt the very thread that asked for the slab.
+    sched_param priority = {};
+    pthread_setschedparam(pthread_self(), SCHED_IDLE, &priority);
+#endif
+    std::unique_lock<std::mutex> lock(mutex);
+    while (true) {
+        wake.wait(lock, [this]() { return stopping || freeCount + freshCount < BLOCKS_PER_SLAB; });
+        if (stopping) {
+            return;
+        }
+        lock.unlock();
+        char* slab = makeSlab(true);
+        lock.lock();
+        if (slab == nullptr) {
+            // Out of memory. allocate makes its own slabs from now on, and
+            // throws when it can't.
+            return;
+        }
+        addSlab(slab);
+    }
+}
+
+char* ChunkArena::makeSlab(bool touchPages) {
+    // malloc rather than new, so the profiler's own storage never shows up in
+    // the allocation tracking of the section that happened to need a chunk
+    size_t slabBytes = SLAB_HEADER_BYTES + blockBytes * BLOCKS_PER_SLAB;
+    char* slab = static_cast<char*>(std::malloc(slabBytes));
+    if (slab != nullptr && touchPages) {
+        // A few pages at a time, so on a core shared with the thread that
+        // needs the slab it only ever waits for one step
+        volatile char* bytes = slab;
+        for (size_t i = 0; i < slabBytes; i += PAGE_BYTES) {
+            bytes[i] = 0;
+            if (i % (PAGE_BYTES * PAGES_PER_STEP) == 0) {
+                std::this_thread::yield();
+            }
+        }
+    }
+    return slab;
+}
+
+void ChunkArena::addSlab(char* slab) {
+    *reinterpret_cast<char**>(slab) = slabs;
+    slabs = slab;
+    slabCount++;
+
+    // Handed out from the front of the slab first
+    char* first = slab + SLAB_HEADER_BYTES;
+    for (size_t i = 0; i + 1 < BLOCKS_PER_SLAB; i++) {
+        NextBlock(first + i * blockBytes) = first + (i + 1) * blockBytes;
+    }
+    NextBlock(first + (BLOCKS_PER_SLAB - 1) * blockBytes) = freeBlocks;
+    freeBlocks = first;
+    freeCount += BLOCKS_PER_SLAB;
+}
+
+void ChunkArena::chainFreshBlocks() {
+    while (freshCount > 0) {
+        freshCount--;
+        void* block = freshBlocks + freshCount * blockBytes;
+        NextBlock(block) = freeBlocks;
+        freeBlocks = block;
+        freeCount++;
+    }
+    freshBlocks = nullptr;
+}
@@ -0,0 +1,115 @@
+//arena.hpp
+#pragma once
+#include <condition_variable>
+#include <cstddef>
+#include <mutex>
+#include <thread>
+#include <utility>
+#include <vector>
+
+// Hands out fixed-size blocks carved from large slabs, and takes them back for
+// reuse. Used for the chunks of EventBuffer, which take and return them in
+// batches and keep the spares to themselves, so the shared lock is only taken
+// once per batch. Free blocks are linked through their own first bytes and
+// slabs through a header, so nothing is allocated under the lock. Chunks freed
+// by a reset are reused by the next run instead of going back to the system.
+// Slabs are kept until the arena is destroyed.
+//
+// Slabs are made ahead of need by a background thread, started by the first
+// allocation. Whenever fewer than a slab's worth of blocks are free it mallocs
+// another slab and touches every page of it, so neither the malloc nor the
+// page faults land on the thread that takes the blocks. On Linux it runs at
+// idle priority, so it never takes a core from a thread that wants it. The
+// thread taking blocks only makes a slab itself when the background one has
+// fallen behind, e.g. with every core busy. Those blocks are handed out in
+// order without being written to first, so their pages fault in a few at a
+// time as the records are written. The arena keeps up to two slabs more than
+// it has handed out.
+// Safe to call from any thread.
+class ChunkArena {
+public:
+    static constexpr size_t BLOCKS_PER_SLAB = 16;
+    // Writing one byte this far apart faults in every page of a new slab
+    static constexpr size_t PAGE_BYTES = 4096;
+    // Pages the background thread faults in before letting others run
+    static constexpr size_t PAGES_PER_STEP = 16;
+
+    // Blocks are aligned like malloc's, which suits any type without extended
+    // alignment
+    ChunkArena(size_t blockBytes);
+    ~ChunkArena();
+
+    ChunkArena(ChunkArena const&) = delete;
+    ChunkArena& operator=(ChunkArena const&) = delete;
+
+    // Fills blocks with count blocks, making a slab here only when the
+    // background thread hasn't kept enough free
+    void allocate(void** blocks, size_t count);
+    // The blocks must have come from this arena
+    void release(void* const* blocks, size_t count);
+
+    size_t getBlockBytes();
+    // Bytes held in slabs, whether handed out or free
+    size_t getReservedBytes();
+
+private:
+    // The background thread
+    void stageSlabs();
+    // Returns null when out of memory
+    char* makeSlab(bool touchPages);
+    // Puts a slab's blocks on the free list. Call with the lock held.
+    void addSlab(char* slab);
+    // Puts the fresh blocks left on the free list. Call with the lock held.
+    void chainFreshBlocks();
+
+    size_t blockBytes;
+    std::mutex mutex;
+    std::condition_variable wake;
+    std::thread stagingThread;
+    bool stopping;
+    // Newest first, each slab's header pointing at the one before
+    char* slabs;
+    size_t slabCount;
+    // Each free block starts with a pointer to the next one
+    void* freeBlocks;
+    size_t freeCount;
+    // Blocks of the last slab allocate made, not handed out or written yet
+    char* freshBlocks;
+    size_t freshCount;
+};
+
+// Keeps released objects for reuse instead of deleting them. T must have a
+// reset() taking the same arguments as its constructor, which leaves the
+// object as a freshly constructed one would be, though it may keep memory it
+// already allocated. Not thread safe.
+template <typename T>
+class ObjectPool {
+public:
+    ObjectPool() {}
+    ~ObjectPool() {
+        for (T* object : spares) {
+            delete object;
+        }
+    }
+
+    ObjectPool(ObjectPool const&) = delete;
+    ObjectPool& operator=(ObjectPool const&) = delete;
+
+    template <typename... Args>
+    T* acquire(Args&&... args) {
+        if (spares.empty()) {
+            return new T(std::forward<Args>(args)...);
+        }
+        T* object = spares.back();
+        spares.pop_back();
+        object->reset(std::forward<Args>(args)...);
+        return object;
+    }
+
+    void release(T* object) {
+        spares.push_back(object);
+    }
+
+private:
+    std::vector<T*> spares;
+};
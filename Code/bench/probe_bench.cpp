@@ -0,0 +1,100 @@
+// Times every enter/exit pair as the profiler's event log grows, to check the
+// worst case stays flat however many events are already stored. The same is
+// done for appending to one std::vector, the log's old storage, whose
+// occasional reallocation copies the whole history and grows with it.
+// Latencies are grouped by how many events the log held when they were taken,
+// one group per power of ten.
+//
+//   make probe_bench                 1e7 events
+//   ./probe_bench 50000000 probes    5e7 events without the std::vector,
+//                                    about 2.5 GB
+//
+// The log takes 48 bytes per event, so 1e8 events need about 5 GB for the
+// probes alone and twice that while the vector grows.
+#include "../histogram.hpp"
+#include "../profiler.hpp"
+#include "../time.hpp"
+#include <cstdio>
+#include <cstdlib>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace {
+    // One histogram per power of ten of the events stored so far
+    class DecadeLatencies {
+    public:
+        DecadeLatencies(): maxNanoseconds(20, 0) {
+            for (int i = 0; i < 20; i++) {
+                histograms.emplace_back(new LatencyHistogram());
+            }
+        }
+
+        void record(size_t stored, int64_t ticks) {
+            int decade = 0;
+            for (size_t bound = 10; stored >= bound; bound *= 10) {
+                decade++;
+            }
+            int64_t nanoseconds = (int64_t)TicksToNanoseconds(ticks);
+            histograms[decade]->record(nanoseconds);
+            if (nanoseconds > maxNanoseconds[decade]) {
+                maxNanoseconds[decade] = nanoseconds;
+            }
+        }
+
+        void print(char const* label) {
+            std::printf("%s\n%-22s %12s %10s %10s %10s %12s\n", label, "Events stored", "Calls", "P50", "P99.99", "P99.9999", "Max");
+            size_t low = 0;
+            size_t high = 10;
+            for (size_t i = 0; i < histograms.size(); i++, low = high, high *= 10) {
+                LatencyHistogram const& histogram = *histograms[i];
+                if (histogram.getCount() == 0) {
+                    continue;
+                }
+                char range[32];
+                std::snprintf(range, sizeof(range), "%.0e - %.0e", (double)low, (double)high);
+                std::printf("%-22s %12llu %8.0fns %8.0fns %8.0fns %10.1fus\n", range, (unsigned long long)histogram.getCount(), histogram.getPercentile(50), histogram.getPercentile(99.99), histogram.getPercentile(99.9999), maxNanoseconds[i] * 1e-3);
+            }
+            std::printf("\n");
+        }
+
+    private:
+        std::vector<std::unique_ptr<LatencyHistogram>> histograms;
+        std::vector<int64_t> maxNanoseconds;
+    };
+}
+
+int main(int argc, char** argv) {
+    size_t events = argc > 1 ? (size_t)std::atof(argv[1]) : 10000000;
+    bool baseline = argc <= 2 || std::string(argv[2]) != "probes";
+
+    Profiler* profiler = Profiler::GetInstance();
+    int sectionId = Profiler::RegisterSection("Probe Bench");
+
+    // The baseline goes first, since the arena keeps its chunks after a reset
+    // while the vector gives its memory back
+    DecadeLatencies appends;
+    if (baseline) {
+        std::vector<TimeRecordStop> log;
+        for (size_t i = 0; i < events; i++) {
+            int64_t start = GetCurrentTicks();
+            log.emplace_back(sectionId, start, 0, 0, __LINE__, __FILE__, __FUNCTION__);
+            appends.record(i, GetCurrentTicks() - start);
+        }
+    }
+
+    DecadeLatencies probes;
+    for (size_t i = 0; i < events; i++) {
+        int64_t start = GetCurrentTicks();
+        profiler->EnterSection(sectionId);
+        profiler->ExitSection(sectionId);
+        probes.record(i, GetCurrentTicks() - start);
+    }
+
+    if (baseline) {
+        appends.print("Append to a std::vector, the old event log");
+    }
+    probes.print("Enter and exit, events in chunks from the arena");
+    return 0;
+}
@@ -0,0 +1,99 @@
+// Measures how fast the reports are written. A profile with many sections and
+// millions of events is dumped in every format, and each one's throughput is
+// printed in MB/s, next to the same timelines streamed through std::ofstream
+// the way the reports used to be written.
+//
+//   make bench
+#include "../profiler.hpp"
+#include "../time.hpp"
+#include <chrono>
+#include <cstdio>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <string>
+#include <vector>
+
+namespace {
+    constexpr int SECTIONS = 1000;
+    constexpr int EVENTS = 2000000;
+
+    size_t fileSize(char const* filename) {
+        std::ifstream file(filename, std::ios::binary | std::ios::ate);
+        return (size_t)file.tellg();
+    }
+
+    // levelFilename is the timeline file saveStatsToJSON writes next to the
+    // report, counted and removed with it
+    void measure(char const* label, char const* filename, std::function<void()> const& save, char const* levelFilename = nullptr) {
+        auto start = std::chrono::steady_clock::now();
+        save();
+        std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+
+        double megabytes = fileSize(filename) / 1e6;
+        std::remove(filename);
+        if (levelFilename != nullptr && std::ifstream(levelFilename).is_open()) {
+            megabytes += fileSize(levelFilename) / 1e6;
+            std::remove(levelFilename);
+        }
+        std::cout << label << ": " << megabytes << " MB in " << elapsed.count() << " s, " << megabytes / elapsed.count() << " MB/s" << std::endl;
+    }
+}
+
+int main() {
+    Profiler* profiler = Profiler::GetInstance();
+
+    std::vector<int> sectionIds;
+    for (int i = 0; i < SECTIONS; i++) {
+        sectionIds.push_back(Profiler::RegisterSection("Bench Section " + std::to_string(i)));
+    }
+    for (int i = 0; i < EVENTS; i++) {
+        int sectionId = sectionIds[i % SECTIONS];
+        profiler->EnterSection(sectionId);
+        profiler->ExitSection(sectionId, __LINE__, __FILE__, __FUNCTION__);
+    }
+
+    // The stats pass is shared by every format, so it is done once up front
+    profiler->calculateStats();
+    std::cout << SECTIONS << " sections, " << EVENTS << " events" << std::endl;
+
+    measure("CSV", "report_bench.csv", [&]() {
+        profiler->saveStatsToCSV("report_bench.csv");
+    });
+    measure("JSON", "report_bench.json", [&]() {
+        profiler->saveStatsToJSON("report_bench.json");
+    }, "report_bench.timeline.json");
+    measure("Compact JSON", "report_bench_compact.json", [&]() {
+        profiler->saveStatsToJSON("report_bench_compact.json", true);
+    }, "report_bench_compact.timeline.json");
+    measure("Chrome trace", "report_bench_chrome.json", [&]() {
+        profiler->saveChromeTrace("report_bench_chrome.json");
+    });
+    measure("Compact Chrome trace", "report_bench_perfetto.json", [&]() {
+        profiler->saveCompactChromeTrace("report_bench_perfetto.json");
+    });
+
+    // Baseline: every timeline value through ofstream's default formatting
+    std::vector<double> timeline;
+    double total = 0;
+    for (TimeRecordStop const& event : profiler->getRecentEvents()) {
+        total += TicksToSeconds(event.elapsedTicks);
+        timeline.push_back(total);
+    }
+    measure("Timelines through std::ofstream", "report_bench_ofstream.txt", [&]() {
+        std::ofstream file("report_bench_ofstream.txt");
+        for (double value : timeline) {
+            file << value << ", ";
+        }
+    });
+    measure("Timelines through ReportWriter", "report_bench_writer.txt", [&]() {
+        ReportWriter file;
+        file.open("report_bench_writer.txt");
+        for (double value : timeline) {
+            file << value << ", ";
+        }
+    });
+
+    delete profiler;
+    return 0;
+}
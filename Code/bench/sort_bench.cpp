@@ -0,0 +1,89 @@
+// Compares the sorts in sort.hpp with std::sort on 32-bit keys through the
+// Benchmark harness, for array sizes from a thousand keys up and for random,
+// already sorted and heavily duplicated keys. Every case sorts a fresh copy
+// of the same input, and std::sort is the baseline of each comparison.
+// std::sort(std::execution::par) joins in when built as C++17 or later.
+//
+//   make sort_bench              sizes 1e3 to 1e7
+//   ./sort_bench 100000000       up to 1e8, needs about 1.2 GB
+#include "../benchmark.hpp"
+#include "../sort.hpp"
+#include <algorithm>
+#include <cstdlib>
+#include <iostream>
+#include <random>
+#include <string>
+#include <vector>
+#if __cplusplus >= 201703L
+#include <execution>
+#endif
+
+namespace {
+    enum class Distribution { Random, Sorted, ManyDuplicates };
+
+    char const* getDistributionName(Distribution distribution) {
+        switch (distribution) {
+            case Distribution::Random:
+                return "Random";
+            case Distribution::Sorted:
+                return "Sorted";
+            default:
+                return "Many Duplicates";
+        }
+    }
+
+    std::vector<int> generate(size_t count, Distribution distribution) {
+        std::mt19937 random(12345);
+        std::vector<int> keys(count);
+        for (size_t i = 0; i < count; i++) {
+            if (distribution == Distribution::Random) {
+                keys[i] = (int)random();
+            } else if (distribution == Distribution::Sorted) {
+                keys[i] = (int)i;
+            } else {
+                // 16 distinct keys
+                keys[i] = (int)(random() % 16);
+            }
+        }
+        return keys;
+    }
+}
+
+int main(int argc, char** argv) {
+    size_t maxSize = argc > 1 ? (size_t)std::strtoull(argv[1], nullptr, 10) : 10000000;
+
+    BenchmarkOptions options;
+    options.warmupRuns = 1;
+    options.minRuns = 5;
+    options.maxSecondsPerCase = 1.0;
+
+    for (size_t size = 1000; size <= maxSize; size *= 10) {
+        for (Distribution distribution : { Distribution::Random, Distribution::Sorted, Distribution::ManyDuplicates }) {
+            std::vector<int> input = generate(size, distribution);
+            std::vector<int> keys(size);
+            auto copyInput = [&](uint64_t) {
+                std::copy(input.begin(), input.end(), keys.begin());
+            };
+
+            std::string name = std::to_string(size) + " " + getDistributionName(distribution);
+            Benchmark benchmark(name, options);
+            benchmark.addCase("std::sort", copyInput, [&]() { std::sort(keys.begin(), keys.end()); });
+#if defined(__cpp_lib_parallel_algorithm)
+            benchmark.addCase("std::sort par", copyInput, [&]() { std::sort(std::execution::par, keys.begin(), keys.end()); });
+#endif
+            benchmark.addCase("IntroSort", copyInput, [&]() { IntroSort(keys.data(), keys.size()); });
+            benchmark.addCase("RadixSort", copyInput, [&]() { RadixSort(keys.data(), keys.size()); });
+            benchmark.addCase("ParallelSort", copyInput, [&]() { ParallelSort(keys.data(), keys.size()); });
+            benchmark.run();
+
+            std::vector<BenchmarkResult> const& results = benchmark.getResults();
+            std::vector<BenchmarkComparison> const& comparisons = benchmark.getComparisons();
+            std::cout << name << ": std::sort " << results[0].medianTime * 1e3 << " ms";
+            for (BenchmarkComparison const& comparison : comparisons) {
+                std::cout << ", " << comparison.candidate << " " << comparison.speedup << "x (" << GetVerdictName(comparison.verdict) << ")";
+            }
+            std::cout << std::endl;
+        }
+    }
+    return 0;
+}
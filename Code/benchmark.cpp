@@ -0,0 +1,437 @@
+#include "benchmark.hpp"
+#include "profiler.hpp"
+#include "report_writer.hpp"
+#include "time.hpp"
+#include <algorithm>
+#include <cmath>
+#include <iostream>
+#include <stdexcept>
+
+namespace {
+    double mean(std::vector<double>& values) {
+        double sum = 0;
+        for (double value : values) {
+            sum += value;
+        }
+        return values.empty() ? 0 : sum / values.size();
+    }
+
+    // Reorders the values
+    double median(std::vector<double>& values) {
+        if (values.empty()) {
+            return 0;
+        }
+        size_t middle = values.size() / 2;
+        std::nth_element(values.begin(), values.begin() + middle, values.end());
+        double upper = values[middle];
+        if (values.size() % 2 == 1) {
+            return upper;
+        }
+        double lower = *std::max_element(values.begin(), values.begin() + middle);
+        return (lower + upper) / 2;
+    }
+
+    double standardDeviation(std::vector<double> const& values, double average) {
+        if (values.size() < 2) {
+            return 0;
+        }
+        double sum = 0;
+        for (double value : values) {
+            sum += (value - average) * (value - average);
+        }
+        return std::sqrt(sum / (values.size() - 1));
+    }
+
+    // Linear interpolation between the closest ranks of sorted values
+    double percentile(std::vector<double> const& sorted, double fraction) {
+        if (sorted.empty()) {
+            return 0;
+        }
+        double rank = fraction * (sorted.size() - 1);
+        size_t below = (size_t)rank;
+        size_t above = std::min(below + 1, sorted.size() - 1);
+        return sorted[below] + (sorted[above] - sorted[below]) * (rank - below);
+    }
+
+    // z such that a standard normal variable falls within +-z with the given probability
+    double normalQuantile(double confidenceLevel) {
+        double low = 0;
+        double high = 10;
+        for (int i = 0; i < 100; i++) {
+            double middle = (low + high) / 2;
+            if (std::erf(middle / std::sqrt(2.0)) < confidenceLevel) {
+                low = middle;
+            } else {
+                high = middle;
+            }
+        }
+        return (low + high) / 2;
+    }
+}
+
+BenchmarkOptions::BenchmarkOptions(): warmupRuns(3), minRuns(10), maxRuns(1000), maxSecondsPerCase(2.0), targetRelativeError(0.01), outlierFence(1.5), bootstrapResamples(2000), confidenceLevel(0.95), seed(42) {}
+
+BenchmarkResult::BenchmarkResult(std::string const& name): name(name), runs(0), outliers(0), meanTime(0), medianTime(0), stdDevTime(0), minTime(0), maxTime(0), meanLow(0), meanHigh(0), medianLow(0), medianHigh(0) {}
+BenchmarkResult::~BenchmarkResult() {}
+
+char const* GetVerdictName(BenchmarkVerdict verdict) {
+    switch (verdict) {
+        case BenchmarkVerdict::Faster:
+            return "Faster";
+        case BenchmarkVerdict::Slower:
+            return "Slower";
+        default:
+            return "No Significant Difference";
+    }
+}
+
+BenchmarkComparison::BenchmarkComparison(std::string const& baseline, std::string const& candidate): baseline(baseline), candidate(candidate), speedup(1), speedupLow(1), speedupHigh(1), verdict(BenchmarkVerdict::NoSignificantDifference) {}
+BenchmarkComparison::~BenchmarkComparison() {}
+
+Benchmark::BenchmarkCase::BenchmarkCase(std::string const& name, std::function<void(uint64_t)> setup, std::function<void()> body): name(name), setup(setup), body(body) {}
+
+Benchmark::Benchmark(std::string const& name, BenchmarkOptions const& options): name(name), options(options), random(options.seed) {}
+Benchmark::~Benchmark() {}
+
+void Benchmark::addCase(std::string const& name, std::function<void(uint64_t)> setup, std::function<void()> body) {
+    cases.emplace_back(name, setup, body);
+}
+
+void Benchmark::run() {
+    results.clear();
+    comparisons.clear();
+    random.seed(options.seed);
+
+    for (BenchmarkCase const& benchmarkCase : cases) {
+        results.push_back(measure(benchmarkCase));
+    }
+    for (size_t i = 1; i < results.size(); i++) {
+        comparisons.push_back(compare(results[0].name, results[i].name));
+    }
+}
+
+BenchmarkResult Benchmark::measure(BenchmarkCase const& benchmarkCase) {
+    Profiler* profiler = Profiler::GetInstance();
+    int sectionId = Profiler::RegisterSection(benchmarkCase.name);
+
+    // Not recorded, so the sections the body opens only count the measured runs
+    profiler->suspendRecording();
+    for (int i = 0; i < options.warmupRuns; i++) {
+        if (benchmarkCase.setup) {
+            benchmarkCase.setup(options.seed + i);
+        }
+        benchmarkCase.body();
+    }
+    profiler->resumeRecording();
+
+    // Keep going until the mean is known well enough, checking every few runs
+    double z = normalQuantile(options.confidenceLevel);
+    std::vector<double> times;
+    int64_t ticksAtCaseStart = GetCurrentTicks();
+    for (int run = 0; run < std::max(options.maxRuns, 1); run++) {
+        if (run >= options.minRuns) {
+            if (TicksToSeconds(GetCurrentTicks() - ticksAtCaseStart) >= options.maxSecondsPerCase) {
+                break;
+            }
+            if (run % 5 == 0) {
+                double average = mean(times);
+                double halfWidth = z * standardDeviation(times, average) / std::sqrt((double)times.size());
+                if (average > 0 && halfWidth / average <= options.targetRelativeError) {
+                    break;
+                }
+            }
+        }
+
+        if (benchmarkCase.setup) {
+            benchmarkCase.setup(options.seed + run);
+        }
+        profiler->EnterSection(sectionId);
+        int64_t ticksAtStart = GetCurrentTicks();
+        benchmarkCase.body();
+        int64_t elapsedTicks = GetCurrentTicks() - ticksAtStart;
+        profiler->ExitSection(sectionId, __LINE__, __FILE__, __FUNCTION__);
+
+        times.push_back(TicksToSeconds(elapsedTicks));
+    }
+
+    BenchmarkResult result(benchmarkCase.name);
+
+    // Drop the runs outside the fences. A zero spread means a clock too coarse
+    // to tell the runs apart, so nothing is dropped then.
+    std::vector<double> sorted = times;
+    std::sort(sorted.begin(), sorted.end());
+    double lowerQuartile = percentile(sorted, 0.25);
+    double upperQuartile = percentile(sorted, 0.75);
+    double spread = upperQuartile - lowerQuartile;
+    for (double time : times) {
+        if (spread == 0 || (time >= lowerQuartile - options.outlierFence * spread && time <= upperQuartile + options.outlierFence * spread)) {
+            result.times.push_back(time);
+        }
+    }
+    result.runs = (int)result.times.size();
+    result.outliers = (int)(times.size() - result.times.size());
+
+    std::vector<double> kept = result.times;
+    result.meanTime = mean(kept);
+    result.medianTime = median(kept);
+    result.stdDevTime = standardDeviation(kept, result.meanTime);
+    result.minTime = *std::min_element(kept.begin(), kept.end());
+    result.maxTime = *std::max_element(kept.begin(), kept.end());
+    bootstrap(result.times, mean, result.meanLow, result.meanHigh);
+    bootstrap(result.times, median, result.medianLow, result.medianHigh);
+    return result;
+}
+
+void Benchmark::bootstrap(std::vector<double> const& times, double (*statistic)(std::vector<double>&), double& low, double& high) {
+    std::uniform_int_distribution<size_t> pick(0, times.size() - 1);
+    std::vector<double> estimates;
+    estimates.reserve(options.bootstrapResamples);
+    std::vector<double> resample(times.size());
+    for (int i = 0; i < options.bootstrapResamples; i++) {
+        for (double& value : resample) {
+            value = times[pick(random)];
+        }
+        estimates.push_back(statistic(resample));
+    }
+
+    std::sort(estimates.begin(), estimates.end());
+    low = percentile(estimates, (1 - options.confidenceLevel) / 2);
+    high = percentile(estimates, (1 + options.confidenceLevel) / 2);
+}
+
+std::vector<BenchmarkResult> const& Benchmark::getResults() {
+    return results;
+}
+
+std::vector<BenchmarkComparison> const& Benchmark::getComparisons() {
+    return comparisons;
+}
+
+BenchmarkResult const& Benchmark::findResult(std::string const& name) {
+    for (BenchmarkResult const& result : results) {
+        if (result.name == name) {
+            return result;
+        }
+    }
+    throw std::out_of_range("No benchmark case named " + name);
+}
+
+BenchmarkComparison Benchmark::compare(std::string const& baseline, std::string const& candidate) {
+    BenchmarkResult const& baselineResult = findResult(baseline);
+    BenchmarkResult const& candidateResult = findResult(candidate);
+    BenchmarkComparison comparison(baseline, candidate);
+    comparison.speedup = candidateResult.medianTime > 0 ? baselineResult.medianTime / candidateResult.medianTime : 0;
+
+    // Resample both cases independently and take the ratio of their medians
+    std::uniform_int_distribution<size_t> pickBaseline(0, baselineResult.times.size() - 1);
+    std::uniform_int_distribution<size_t> pickCandidate(0, candidateResult.times.size() - 1);
+    std::vector<double> baselineResample(baselineResult.times.size());
+    std::vector<double> candidateResample(candidateResult.times.size());
+    std::vector<double> speedups;
+    speedups.reserve(options.bootstrapResamples);
+    for (int i = 0; i < options.bootstrapResamples; i++) {
+        for (double& value : baselineResample) {
+            value = baselineResult.times[pickBaseline(random)];
+        }
+        for (double& value : candidateResample) {
+            value = candidateResult.times[pickCandidate(random)];
+        }
+        double candidateMedian = median(candidateResample);
+        speedups.push_back(candidateMedian > 0 ? median(baselineResample) / candidateMedian : 0);
+    }
+    std::sort(speedups.begin(), speedups.end());
+    comparison.speedupLow = percentile(speedups, (1 - options.confidenceLevel) / 2);
+    comparison.speedupHigh = percentile(speedups, (1 + options.confidenceLevel) / 2);
+
+    if (comparison.speedupLow > 1) {
+        comparison.verdict = BenchmarkVerdict::Faster;
+    } else if (comparison.speedupHigh < 1) {
+        comparison.verdict = BenchmarkVerdict::Slower;
+    }
+    return comparison;
+}
+
+void Benchmark::printResults() {
+    int confidence = (int)std::lround(options.confidenceLevel * 100);
+    std::cout << "Benchmark: " << name << "\n\n";
+    for (BenchmarkResult const& result : results) {
+        std::cout << "Case: " << result.name << "\n";
+        std::cout << "Runs: " << result.runs << " (" << result.outliers << " outliers dropped)\n";
+        std::cout << "Mean Time: " << result.meanTime << " [" << result.meanLow << ", " << result.meanHigh << "] at " << confidence << "%\n";
+        std::cout << "Median Time: " << result.medianTime << " [" << result.medianLow << ", " << result.medianHigh << "] at " << confidence << "%\n";
+        std::cout << "Std Dev Time: " << result.stdDevTime << "\n";
+        std::cout << "Min Time: " << result.minTime << "\n";
+        std::cout << "Max Time: " << result.maxTime << "\n";
+        std::cout << "\n";
+    }
+
+    for (BenchmarkComparison const& comparison : comparisons) {
+        std::cout << comparison.candidate << " vs " << comparison.baseline << ": ";
+        std::cout << comparison.speedup << "x speedup [" << comparison.speedupLow << ", " << comparison.speedupHigh << "] - " << GetVerdictName(comparison.verdict) << "\n";
+    }
+    std::cout << "\n";
+}
+
+void Benchmark::saveResultsToCSV(const char* filename) {
+    ReportWriter file;
+    file.open(filename);
+
+    // Header. Every case after the first is compared against the first.
+    file << "Benchmark,";
+    file << "Case,";
+    file << "Runs,";
+    file << "Outliers,";
+    file << "Mean Time,";
+    file << "Mean Low,";
+    file << "Mean High,";
+    file << "Median Time,";
+    file << "Median Low,";
+    file << "Median High,";
+    file << "Std Dev Time,";
+    file << "Min Time,";
+    file << "Max Time,";
+    file << "Baseline,";
+    file << "Speedup,";
+    file << "Speedup Low,";
+    file << "Speedup High,";
+    file << "Verdict,";
+    file << "\n";
+
+    for (size_t i = 0; i < results.size(); i++) {
+        BenchmarkResult const& result = results[i];
+        file.writeCSVField(name.c_str());
+        file << ",";
+        file.writeCSVField(result.name.c_str());
+        file << ",";
+        file << result.runs << ",";
+        file << result.outliers << ",";
+        file << result.meanTime << ",";
+        file << result.meanLow << ",";
+        file << result.meanHigh << ",";
+        file << result.medianTime << ",";
+        file << result.medianLow << ",";
+        file << result.medianHigh << ",";
+        file << result.stdDevTime << ",";
+        file << result.minTime << ",";
+        file << result.maxTime << ",";
+        if (i == 0) {
+            file << ",,,,,";
+        } else {
+            BenchmarkComparison const& comparison = comparisons[i - 1];
+            file.writeCSVField(comparison.baseline.c_str());
+            file << ",";
+            file << comparison.speedup << ",";
+            file << comparison.speedupLow << ",";
+            file << comparison.speedupHigh << ",";
+            file << GetVerdictName(comparison.verdict) << ",";
+        }
+        file << "\n";
+    }
+
+    file.close();
+}
+
+void Benchmark::saveResultsToJSON(const char* filename, bool compact) {
+    ReportWriter file;
+    file.open(filename, ReportFormat::JSON);
+
+    // Same layout rules as Profiler::saveStatsToJSON
+    char const* colon = compact ? "\":" : "\": ";
+    auto newline = [&](int depth) {
+        if (!compact) {
+            file << '\n';
+            file.writeSpaces(depth * 2);
+        }
+    };
+    auto key = [&](int depth, char const* name) {
+        newline(depth);
+        file << '"' << name << colon;
+    };
+    auto stringField = [&](int depth, char const* name, std::string const& value) {
+        key(depth, name);
+        file.writeJSONString(value.c_str());
+    };
+
+    file << '{';
+    stringField(1, "Benchmark", name);
+    file << ',';
+    key(1, "Confidence Level");
+    file << options.confidenceLevel << ',';
+    key(1, "Cases");
+    file << '[';
+    for (size_t i = 0; i < results.size(); i++) {
+        BenchmarkResult const& result = results[i];
+        if (i > 0) {
+            file << ',';
+        }
+        newline(2);
+        file << '{';
+        stringField(3, "Case", result.name);
+        file << ',';
+        key(3, "Runs");
+        file << result.runs << ',';
+        key(3, "Outliers");
+        file << result.outliers << ',';
+        key(3, "Mean Time");
+        file << result.meanTime << ',';
+        key(3, "Mean Low");
+        file << result.meanLow << ',';
+        key(3, "Mean High");
+        file << result.meanHigh << ',';
+        key(3, "Median Time");
+        file << result.medianTime << ',';
+        key(3, "Median Low");
+        file << result.medianLow << ',';
+        key(3, "Median High");
+        file << result.medianHigh << ',';
+        key(3, "Std Dev Time");
+        file << result.stdDevTime << ',';
+        key(3, "Min Time");
+        file << result.minTime << ',';
+        key(3, "Max Time");
+        file << result.maxTime << ',';
+        key(3, "Times");
+        file << '[';
+        for (size_t run = 0; run < result.times.size(); run++) {
+            if (run > 0) {
+                file << ',';
+            }
+            file << result.times[run];
+        }
+        file << ']';
+        newline(2);
+        file << '}';
+    }
+    newline(1);
+    file << "],";
+
+    key(1, "Comparisons");
+    file << '[';
+    for (size_t i = 0; i < comparisons.size(); i++) {
+        BenchmarkComparison const& comparison = comparisons[i];
+        if (i > 0) {
+            file << ',';
+        }
+        newline(2);
+        file << '{';
+        stringField(3, "Baseline", comparison.baseline);
+        file << ',';
+        stringField(3, "Candidate", comparison.candidate);
+        file << ',';
+        key(3, "Speedup");
+        file << comparison.speedup << ',';
+        key(3, "Speedup Low");
+        file << comparison.speedupLow << ',';
+        key(3, "Speedup High");
+        file << comparison.speedupHigh << ',';
+        stringField(3, "Verdict", GetVerdictName(comparison.verdict));
+        newline(2);
+        file << '}';
+    }
+    newline(1);
+    file << ']';
+    newline(0);
+    file << "}\n";
+
+    file.close();
+}
@@ -0,0 +1,132 @@
+//benchmark.hpp
+#pragma once
+#include <cstdint>
+#include <functional>
+#include <random>
+#include <string>
+#include <vector>
+
+// How a Benchmark measures its cases
+class BenchmarkOptions {
+public:
+    BenchmarkOptions();
+
+    // Untimed runs of each case before it is measured, to warm up caches and
+    // branch predictors
+    int warmupRuns;
+    // Each case runs at least minRuns times, then keeps going until its mean is
+    // known to within targetRelativeError at the confidence level, or it hits
+    // maxRuns or has spent maxSecondsPerCase, setup included
+    int minRuns;
+    int maxRuns;
+    double maxSecondsPerCase;
+    double targetRelativeError;
+    // Runs more than this many interquartile ranges outside the quartiles are
+    // dropped as outliers, e.g. ones hit by an interrupt or a migration
+    double outlierFence;
+    // Resamples drawn for every bootstrap confidence interval
+    int bootstrapResamples;
+    // 0.95 for 95% confidence intervals
+    double confidenceLevel;
+    // Run i of every case gets its input from seed + i, so all cases are
+    // measured on the same inputs
+    uint64_t seed;
+};
+
+// Measured times of one case, in seconds per run
+class BenchmarkResult {
+public:
+    BenchmarkResult(std::string const& name);
+    ~BenchmarkResult();
+
+    std::string name;
+    // Runs kept, and runs dropped as outliers
+    int runs;
+    int outliers;
+    double meanTime;
+    double medianTime;
+    double stdDevTime;
+    double minTime;
+    double maxTime;
+    // Bootstrap confidence intervals of the mean and the median
+    double meanLow;
+    double meanHigh;
+    double medianLow;
+    double medianHigh;
+    // Times of the runs kept, in the order they ran
+    std::vector<double> times;
+};
+
+enum class BenchmarkVerdict { Faster, Slower, NoSignificantDifference };
+
+// Report name of a verdict, e.g. "No Significant Difference"
+char const* GetVerdictName(BenchmarkVerdict verdict);
+
+// How a candidate case did against a baseline case
+class BenchmarkComparison {
+public:
+    BenchmarkComparison(std::string const& baseline, std::string const& candidate);
+    ~BenchmarkComparison();
+
+    std::string baseline;
+    std::string candidate;
+    // Baseline median over candidate median, so above 1 means the candidate is
+    // faster, with its bootstrap confidence interval
+    double speedup;
+    double speedupLow;
+    double speedupHigh;
+    // Faster or Slower only when the whole interval is on one side of 1
+    BenchmarkVerdict verdict;
+};
+
+// Compares named variants of the same code. Each run first calls the case's
+// setup with the run's seed, outside the timed region, then times one call of
+// its body inside a profiler section named after the case, so the profiler's
+// own reports show the cases and everything nested in them. The first case
+// added is the baseline the others are compared against.
+class Benchmark {
+public:
+    Benchmark(std::string const& name, BenchmarkOptions const& options = BenchmarkOptions());
+    ~Benchmark();
+
+    // setup builds the input of one run from a seed and may be null; body is the
+    // code being measured
+    void addCase(std::string const& name, std::function<void(uint64_t)> setup, std::function<void()> body);
+    // Measures every case in the order they were added, then compares them
+    void run();
+
+    // Valid after run()
+    std::vector<BenchmarkResult> const& getResults();
+    // Every case after the first against the first
+    std::vector<BenchmarkComparison> const& getComparisons();
+    // Compares any two measured cases. Throws std::out_of_range for an unknown name.
+    BenchmarkComparison compare(std::string const& baseline, std::string const& candidate);
+
+    void printResults();
+    void saveResultsToCSV(const char* filename);
+    // Compact output leaves out all the indentation and line breaks
+    void saveResultsToJSON(const char* filename, bool compact = false);
+
+private:
+    class BenchmarkCase {
+    public:
+        BenchmarkCase(std::string const& name, std::function<void(uint64_t)> setup, std::function<void()> body);
+
+        std::string name;
+        std::function<void(uint64_t)> setup;
+        std::function<void()> body;
+    };
+
+    BenchmarkResult measure(BenchmarkCase const& benchmarkCase);
+    BenchmarkResult const& findResult(std::string const& name);
+    // Confidence interval of a statistic over bootstrap resamples of the times
+    void bootstrap(std::vector<double> const& times, double (*statistic)(std::vector<double>&), double& low, double& high);
+
+    std::string name;
+    BenchmarkOptions options;
+    std::vector<BenchmarkCase> cases;
+    std::vector<BenchmarkResult> results;
+    std::vector<BenchmarkComparison> comparisons;
+    // Draws the bootstrap resamples, seeded from the options so reports repeat
+    std::mt19937_64 random;
+};
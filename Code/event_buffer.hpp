@@ -0,0 +1,296 @@
+#pragma once
+#include "arena.hpp"
+#include <atomic>
+#include <cstddef>
+#include <new>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+// Append-only record storage owned by a single writer thread.
+// Records live in fixed-size chunks that are linked together, so a record never
+// moves once it is written. The writer publishes the new size with a release
+// store after each record, which lets a reporting thread read every published
+// record without taking a lock. Chunks come from an arena shared by every
+// buffer of the same type, CHUNK_BATCH at a time, and the spares stay with the
+// buffer. Filling a chunk therefore costs the same however long the buffer
+// already is, and only one chunk in CHUNK_BATCH takes the arena's lock.
+// clear() hands the chunks back for the next run.
+template <typename T, size_t ChunkSize = 4096>
+class EventBuffer {
+public:
+    static constexpr size_t CHUNK_BATCH = 4;
+
+    EventBuffer(): head(nullptr), tail(nullptr), tailUsed(0), count(0), spareCount(0) {}
+    ~EventBuffer() {
+        clear();
+        if (spareCount > 0) {
+            GetArena().release(spareChunks, spareCount);
+        }
+    }
+
+    EventBuffer(EventBuffer const&) = delete;
+    EventBuffer& operator=(EventBuffer const&) = delete;
+
+    // Writer thread only. The returned record stays at the same address until clear().
+    template <typename... Args>
+    T& emplace_back(Args&&... args) {
+        if (tail == nullptr || tailUsed == ChunkSize) {
+            addChunk();
+        }
+        T* record = new (&tail->slots[tailUsed]) T(std::forward<Args>(args)...);
+        tailUsed++;
+        count.store(count.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+        return *record;
+    }
+
+    // Number of published records. Safe to call from any thread.
+    size_t size() const {
+        return count.load(std::memory_order_acquire);
+    }
+
+    // Visit the records in [from, size()) in insertion order. Safe to call from
+    // any thread while the writer keeps appending.
+    template <typename Fn>
+    void forEach(size_t from, Fn&& fn) const {
+        size_t end = size();
+        size_t index = 0;
+        for (Chunk* chunk = head.load(std::memory_order_acquire); chunk != nullptr && index < end; chunk = chunk->next.load(std::memory_order_acquire)) {
+            if (index + ChunkSize <= from) {
+                index += ChunkSize;
+                continue;
+            }
+            for (size_t i = 0; i < ChunkSize && index < end; i++, index++) {
+                if (index >= from) {
+                    fn(*reinterpret_cast<T const*>(&chunk->slots[i]));
+                }
+            }
+        }
+    }
+
+    template <typename Fn>
+    void forEach(Fn&& fn) const {
+        forEach(0, std::forward<Fn>(fn));
+    }
+
+    // Frees every chunk. Only call when the writer is not recording.
+    void clear() {
+        Chunk* chunk = head.load(std::memory_order_relaxed);
+        size_t remaining = count.load(std::memory_order_relaxed);
+        while (chunk != nullptr) {
+            Chunk* next = chunk->next.load(std::memory_order_relaxed);
+            for (size_t i = 0; i < ChunkSize && remaining > 0; i++, remaining--) {
+                reinterpret_cast<T*>(&chunk->slots[i])->~T();
+            }
+            chunk->~Chunk();
+            void* block = chunk;
+            GetArena().release(&block, 1);
+            chunk = next;
+        }
+        head.store(nullptr, std::memory_order_relaxed);
+        tail = nullptr;
+        tailUsed = 0;
+        count.store(0, std::memory_order_release);
+    }
+
+private:
+    struct Chunk {
+        Chunk(): next(nullptr) {}
+        typename std::aligned_storage<sizeof(T), alignof(T)>::type slots[ChunkSize];
+        std::atomic<Chunk*> next;
+    };
+
+    static_assert(alignof(T) <= alignof(std::max_align_t), "ChunkArena blocks are only aligned like malloc's");
+
+    // Never destroyed, so buffers that outlive static destruction can still
+    // hand their chunks back
+    static ChunkArena& GetArena() {
+        static ChunkArena* arena = new ChunkArena(sizeof(Chunk));
+        return *arena;
+    }
+
+    void addChunk() {
+        if (spareCount == 0) {
+            GetArena().allocate(spareChunks, CHUNK_BATCH);
+            spareCount = CHUNK_BATCH;
+        }
+        Chunk* chunk = new (spareChunks[--spareCount]) Chunk();
+        if (tail == nullptr) {
+            head.store(chunk, std::memory_order_release);
+        } else {
+            tail->next.store(chunk, std::memory_order_release);
+        }
+        tail = chunk;
+        tailUsed = 0;
+    }
+
+    std::atomic<Chunk*> head;
+    Chunk* tail;
+    size_t tailUsed;
+    std::atomic<size_t> count;
+    // Chunks taken from the arena and not used yet. Writer thread only.
+    void* spareChunks[CHUNK_BATCH];
+    size_t spareCount;
+};
+
+// Fixed-capacity ring of the most recent records, owned by a single writer
+// thread. Once full, each new record overwrites the oldest one, so memory stays
+// constant however many records are pushed. Readers copy the ring and then drop
+// any slot the writer may have overwritten while they were copying.
+template <typename T>
+class EventRing {
+public:
+    EventRing(): slots(nullptr), capacity(0), mask(0), written(0) {}
+    ~EventRing() { delete[] slots; }
+
+    EventRing(EventRing const&) = delete;
+    EventRing& operator=(EventRing const&) = delete;
+
+    // Rounds the capacity up to a power of two. Only call when the writer is not
+    // recording; it discards the current contents.
+    void setCapacity(size_t requested) {
+        delete[] slots;
+        slots = nullptr;
+        capacity = 0;
+        if (requested > 0) {
+            capacity = 1;
+            while (capacity < requested) {
+                capacity <<= 1;
+            }
+            slots = new T[capacity];
+        }
+        mask = capacity - 1;
+        written.store(0, std::memory_order_release);
+    }
+
+    size_t getCapacity() const {
+        return capacity;
+    }
+
+    // Writer thread only
+    void push(T const& record) {
+        size_t index = written.load(std::memory_order_relaxed);
+        slots[index & mask] = record;
+        written.store(index + 1, std::memory_order_release);
+    }
+
+    // Total records ever pushed. Safe to call from any thread.
+    size_t size() const {
+        return written.load(std::memory_order_acquire);
+    }
+
+    // Visit the records still in the ring, oldest first. Safe to call from any
+    // thread while the writer keeps pushing.
+    template <typename Fn>
+    void forEach(Fn&& fn) const {
+        if (capacity == 0) {
+            return;
+        }
+
+        size_t end = size();
+        size_t begin = end > capacity ? end - capacity : 0;
+        std::vector<T> copy;
+        copy.reserve(end - begin);
+        for (size_t i = begin; i < end; i++) {
+            copy.push_back(slots[i & mask]);
+        }
+
+        // Anything the writer reached while we copied may be torn
+        std::atomic_thread_fence(std::memory_order_acquire);
+        size_t after = written.load(std::memory_order_relaxed);
+        size_t firstValid = after > capacity ? after - capacity : 0;
+        for (size_t i = begin; i < end; i++) {
+            if (i >= firstValid) {
+                fn(copy[i - begin]);
+            }
+        }
+    }
+
+    // Only call when the writer is not recording
+    void clear() {
+        written.store(0, std::memory_order_release);
+    }
+
+private:
+    T* slots;
+    size_t capacity;
+    size_t mask;
+    std::atomic<size_t> written;
+};
+
+// Fixed-capacity queue with one producer and one consumer thread. The producer
+// never blocks: when the consumer has fallen a full queue behind, the record is
+// dropped and counted instead.
+template <typename T>
+class EventQueue {
+public:
+    EventQueue(): slots(nullptr), capacity(0), mask(0), written(0), consumed(0), dropped(0) {}
+    ~EventQueue() { delete[] slots; }
+
+    EventQueue(EventQueue const&) = delete;
+    EventQueue& operator=(EventQueue const&) = delete;
+
+    // Rounds the capacity up to a power of two. Only call while neither side is
+    // using the queue; it discards the current contents.
+    void setCapacity(size_t requested) {
+        delete[] slots;
+        slots = nullptr;
+        capacity = 0;
+        if (requested > 0) {
+            capacity = 1;
+            while (capacity < requested) {
+                capacity <<= 1;
+            }
+            slots = new T[capacity];
+        }
+        mask = capacity - 1;
+        written.store(0, std::memory_order_relaxed);
+        consumed.store(0, std::memory_order_relaxed);
+        dropped.store(0, std::memory_order_release);
+    }
+
+    size_t getCapacity() const {
+        return capacity;
+    }
+
+    // Producer thread only. Returns false if the queue was full.
+    bool push(T const& record) {
+        size_t index = written.load(std::memory_order_relaxed);
+        if (index - consumed.load(std::memory_order_acquire) == capacity) {
+            dropped.store(dropped.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+            return false;
+        }
+        slots[index & mask] = record;
+        written.store(index + 1, std::memory_order_release);
+        return true;
+    }
+
+    // Consumer thread only. Visits every queued record, oldest first, and frees
+    // their slots. Returns the number visited.
+    template <typename Fn>
+    size_t drain(Fn&& fn) {
+        size_t begin = consumed.load(std::memory_order_relaxed);
+        size_t end = written.load(std::memory_order_acquire);
+        for (size_t i = begin; i < end; i++) {
+            fn(slots[i & mask]);
+        }
+        consumed.store(end, std::memory_order_release);
+        return end - begin;
+    }
+
+    // Records the producer had to throw away. Safe to call from any thread.
+    size_t getDropped() const {
+        return dropped.load(std::memory_order_relaxed);
+    }
+
+private:
+    T* slots;
+    size_t capacity;
+    size_t mask;
+    // Each index is only written by its own side, so keep them on separate
+    // cache lines
+    std::atomic<size_t> written;
+    char padding[64];
+    std::atomic<size_t> consumed;
+    std::atomic<size_t> dropped;
+};
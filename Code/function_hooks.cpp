@@ -0,0 +1,22 @@
+// The hooks GCC and Clang call on entry to and exit from every function
+// compiled with -finstrument-functions, so the profiler can time them without
+// hand-written sections, see Profiler::startFunctionTracing. Define
+// PROFILER_NO_FUNCTION_HOOKS to leave them out, e.g. when another tool
+// provides them.
+#include "profiler.hpp"
+
+#if !defined(PROFILER_NO_FUNCTION_HOOKS)
+
+extern "C" {
+    __attribute__((no_instrument_function)) void __cyg_profile_func_enter(void* function, void* callSite) {
+        (void)callSite;
+        Profiler::OnFunctionEnter(function);
+    }
+
+    __attribute__((no_instrument_function)) void __cyg_profile_func_exit(void* function, void* callSite) {
+        (void)callSite;
+        Profiler::OnFunctionExit(function);
+    }
+}
+
+#endif
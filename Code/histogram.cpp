@@ -0,0 +1,106 @@
+#include "histogram.hpp"
+
+LatencyHistogram::LatencyHistogram(): totalCount(0) {
+    for (int i = 0; i < BUCKET_COUNT; i++) {
+        counts[i].store(0, std::memory_order_relaxed);
+    }
+}
+
+LatencyHistogram::~LatencyHistogram() {}
+
+int LatencyHistogram::getBucketIndex(int64_t nanoseconds) {
+    if (nanoseconds < SUB_BUCKET_COUNT) {
+        return nanoseconds < 0 ? 0 : (int)nanoseconds;
+    }
+
+    // Position of the highest set bit picks the power-of-two range, the next
+    // bits below it pick the linear bucket inside that range
+    int magnitude = 63 - __builtin_clzll((unsigned long long)nanoseconds);
+    if (magnitude > MAX_MAGNITUDE) {
+        return BUCKET_COUNT - 1;
+    }
+    int shift = magnitude - (SUB_BUCKET_BITS - 1);
+    int subBucket = (int)(nanoseconds >> shift) - SUB_BUCKET_HALF;
+    return SUB_BUCKET_COUNT + (magnitude - SUB_BUCKET_BITS) * SUB_BUCKET_HALF + subBucket;
+}
+
+int64_t LatencyHistogram::getBucketLowerBound(int bucketIndex) {
+    if (bucketIndex < SUB_BUCKET_COUNT) {
+        return bucketIndex;
+    }
+    int offset = bucketIndex - SUB_BUCKET_COUNT;
+    int magnitude = SUB_BUCKET_BITS + offset / SUB_BUCKET_HALF;
+    int64_t subBucket = SUB_BUCKET_HALF + offset % SUB_BUCKET_HALF;
+    return subBucket << (magnitude - (SUB_BUCKET_BITS - 1));
+}
+
+int64_t LatencyHistogram::getBucketWidth(int bucketIndex) {
+    if (bucketIndex < SUB_BUCKET_COUNT) {
+        return 1;
+    }
+    int magnitude = SUB_BUCKET_BITS + (bucketIndex - SUB_BUCKET_COUNT) / SUB_BUCKET_HALF;
+    return int64_t(1) << (magnitude - (SUB_BUCKET_BITS - 1));
+}
+
+void LatencyHistogram::record(int64_t nanoseconds) {
+    recordCount(getBucketIndex(nanoseconds), 1);
+}
+
+void LatencyHistogram::recordCount(int bucketIndex, uint64_t count) {
+    // Single writer, so a plain load and store is enough
+    std::atomic<uint64_t>& bucket = counts[bucketIndex];
+    bucket.store(bucket.load(std::memory_order_relaxed) + count, std::memory_order_relaxed);
+    totalCount.store(totalCount.load(std::memory_order_relaxed) + count, std::memory_order_release);
+}
+
+void LatencyHistogram::merge(LatencyHistogram const& other) {
+    for (int i = 0; i < BUCKET_COUNT; i++) {
+        uint64_t count = other.counts[i].load(std::memory_order_relaxed);
+        if (count > 0) {
+            recordCount(i, count);
+        }
+    }
+}
+
+void LatencyHistogram::clear() {
+    for (int i = 0; i < BUCKET_COUNT; i++) {
+        counts[i].store(0, std::memory_order_relaxed);
+    }
+    totalCount.store(0, std::memory_order_release);
+}
+
+uint64_t LatencyHistogram::getCount() const {
+    return totalCount.load(std::memory_order_acquire);
+}
+
+uint64_t LatencyHistogram::getBucketCount(int bucketIndex) const {
+    return counts[bucketIndex].load(std::memory_order_relaxed);
+}
+
+double LatencyHistogram::getPercentile(double percentile) const {
+    // Sum the buckets rather than trusting totalCount, which a concurrent
+    // writer may have moved past the buckets we read
+    uint64_t total = 0;
+    for (int i = 0; i < BUCKET_COUNT; i++) {
+        total += counts[i].load(std::memory_order_relaxed);
+    }
+    if (total == 0) {
+        return 0;
+    }
+
+    // Rank of the wanted value, counting from 1
+    double fraction = percentile < 0 ? 0 : (percentile > 100 ? 1 : percentile / 100.0);
+    uint64_t rank = (uint64_t)(fraction * total + 0.5);
+    if (rank < 1) {
+        rank = 1;
+    }
+
+    uint64_t seen = 0;
+    for (int i = 0; i < BUCKET_COUNT; i++) {
+        seen += counts[i].load(std::memory_order_relaxed);
+        if (seen >= rank) {
+            return getBucketLowerBound(i) + (getBucketWidth(i) - 1) / 2.0;
+        }
+    }
+    return (double)getBucketLowerBound(BUCKET_COUNT - 1);
+}
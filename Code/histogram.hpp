@@ -0,0 +1,52 @@
+//histogram.hpp
+#pragma once
+#include <atomic>
+#include <cstdint>
+
+// Log-linear latency histogram in the style of HdrHistogram. Values below 128 ns
+// get one bucket each; every power-of-two range above that is split into 64
+// equal buckets, so any recorded value is known to within 1/64 (about 1.6%) of
+// itself and percentiles are reported at the bucket midpoint (within 0.8%).
+// Memory is constant: values above MAX_MAGNITUDE are counted in the last bucket.
+//
+// One thread records; any thread may read or merge while it does. Histograms
+// with the same layout add bucket by bucket, so per-thread and per-run
+// histograms combine exactly.
+class LatencyHistogram {
+public:
+    static constexpr int SUB_BUCKET_BITS = 7;
+    static constexpr int SUB_BUCKET_COUNT = 1 << SUB_BUCKET_BITS;
+    static constexpr int SUB_BUCKET_HALF = SUB_BUCKET_COUNT / 2;
+    // Largest power of two tracked precisely, 2^47 ns is about 39 hours
+    static constexpr int MAX_MAGNITUDE = 47;
+    static constexpr int BUCKET_COUNT = SUB_BUCKET_COUNT + (MAX_MAGNITUDE - SUB_BUCKET_BITS + 1) * SUB_BUCKET_HALF;
+
+    LatencyHistogram();
+    ~LatencyHistogram();
+
+    // Writer thread only
+    void record(int64_t nanoseconds);
+    void recordCount(int bucketIndex, uint64_t count);
+
+    // Adds every bucket of the other histogram into this one
+    void merge(LatencyHistogram const& other);
+    // Only call while no thread records into it
+    void clear();
+
+    uint64_t getCount() const;
+    uint64_t getBucketCount(int bucketIndex) const;
+    // Value in nanoseconds below which the given percentage (0-100) of the
+    // recorded values fall
+    double getPercentile(double percentile) const;
+
+    static int getBucketIndex(int64_t nanoseconds);
+    static int64_t getBucketLowerBound(int bucketIndex);
+    static int64_t getBucketWidth(int bucketIndex);
+
+private:
+    LatencyHistogram(LatencyHistogram const&) = delete;
+    LatencyHistogram& operator=(LatencyHistogram const&) = delete;
+
+    std::atomic<uint64_t> counts[BUCKET_COUNT];
+    std::atomic<uint64_t> totalCount;
+};
@@ -0,0 +1,238 @@
+#include "live_stats.hpp"
+#include "time.hpp"
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstring>
+#include <new>
+#include <stdexcept>
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <fcntl.h>
+#include <signal.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#define PROFILER_HAS_SHARED_MEMORY 1
+#endif
+
+constexpr char const* LiveStatsWriter::MAGIC;
+constexpr uint32_t LiveStatsWriter::VERSION;
+constexpr uint32_t LiveStatsWriter::MAX_SECTIONS;
+
+namespace {
+    // A reader gives up after this many tries at a consistent copy
+    constexpr int MAX_READ_ATTEMPTS = 1000;
+}
+
+LiveStatsSnapshot::LiveStatsSnapshot(): droppedSections(0), threadCount(0), processId(0), publishCount(0), publishTime(0), intervalSeconds(0) {}
+
+LiveStatsWriter::LiveStatsWriter(): intervalMs(0), header(nullptr), sections(nullptr), mappingSize(0), stopping(false) {}
+
+LiveStatsWriter::~LiveStatsWriter() {
+    close();
+}
+
+std::string LiveStatsWriter::GetSegmentName(int64_t processId) {
+    return "/profiler-" + std::to_string(processId);
+}
+
+void LiveStatsWriter::open(int intervalMs, std::function<void(std::vector<LiveSectionStats>&, uint32_t&)> collect) {
+#if defined(PROFILER_HAS_SHARED_MEMORY)
+    close();
+
+    int64_t processId = (int64_t)getpid();
+    segmentName = GetSegmentName(processId);
+    mappingSize = sizeof(LiveStatsHeader) + MAX_SECTIONS * sizeof(LiveSectionStats);
+
+    // Only the same user may watch
+    int descriptor = shm_open(segmentName.c_str(), O_CREAT | O_RDWR | O_TRUNC, 0600);
+    if (descriptor < 0) {
+        throw std::runtime_error("Could not create shared memory segment " + segmentName);
+    }
+    if (ftruncate(descriptor, (off_t)mappingSize) != 0) {
+        ::close(descriptor);
+        shm_unlink(segmentName.c_str());
+        throw std::runtime_error("Could not size shared memory segment " + segmentName);
+    }
+    void* mapping = mmap(nullptr, mappingSize, PROT_READ | PROT_WRITE, MAP_SHARED, descriptor, 0);
+    ::close(descriptor);
+    if (mapping == MAP_FAILED) {
+        shm_unlink(segmentName.c_str());
+        throw std::runtime_error("Could not map shared memory segment " + segmentName);
+    }
+
+    // A fresh segment is all zeros, so the sequence starts out even
+    header = new (mapping) LiveStatsHeader();
+    std::strncpy(header->magic, MAGIC, sizeof(header->magic));
+    header->version = VERSION;
+    header->maxSections = MAX_SECTIONS;
+    header->sequence.store(0, std::memory_order_relaxed);
+    header->processId = processId;
+    header->intervalSeconds = intervalMs * 1e-3;
+    sections = reinterpret_cast<LiveSectionStats*>(header + 1);
+
+    this->collect = collect;
+    this->intervalMs = intervalMs;
+    stopping = false;
+    publish();
+    publishThread = std::thread(&LiveStatsWriter::run, this);
+#else
+    throw std::runtime_error("Live stats need POSIX shared memory, which this platform doesn't have");
+#endif
+}
+
+void LiveStatsWriter::close() {
+#if defined(PROFILER_HAS_SHARED_MEMORY)
+    if (!publishThread.joinable()) {
+        return;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+    }
+    wake.notify_one();
+    publishThread.join();
+
+    // Readers that are still attached keep their mapping; new ones find nothing
+    munmap(header, mappingSize);
+    shm_unlink(segmentName.c_str());
+    header = nullptr;
+    sections = nullptr;
+    collect = nullptr;
+#endif
+}
+
+bool LiveStatsWriter::isOpen() {
+    return publishThread.joinable();
+}
+
+void LiveStatsWriter::run() {
+    std::unique_lock<std::mutex> lock(mutex);
+    while (!stopping) {
+        wake.wait_for(lock, std::chrono::milliseconds(intervalMs));
+        if (stopping) {
+            break;
+        }
+        lock.unlock();
+        publish();
+        lock.lock();
+    }
+}
+
+void LiveStatsWriter::publish() {
+    // Gather first, so the segment is only inconsistent for the copy itself
+    collected.clear();
+    uint32_t threadCount = 0;
+    collect(collected, threadCount);
+    size_t count = std::min(collected.size(), (size_t)MAX_SECTIONS);
+
+    uint32_t seq = header->sequence.load(std::memory_order_relaxed);
+    header->sequence.store(seq + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+
+    std::memcpy(sections, collected.data(), count * sizeof(LiveSectionStats));
+    header->sectionCount = (uint32_t)count;
+    header->droppedSections = (uint32_t)(collected.size() - count);
+    header->threadCount = threadCount;
+    header->publishCount++;
+    header->publishTime = GetCurrentTimeSeconds();
+
+    header->sequence.store(seq + 2, std::memory_order_release);
+}
+
+LiveStatsReader::LiveStatsReader(): processId(0), header(nullptr), sections(nullptr), mappingSize(0) {}
+
+LiveStatsReader::~LiveStatsReader() {
+    close();
+}
+
+void LiveStatsReader::open(int64_t processId) {
+#if defined(PROFILER_HAS_SHARED_MEMORY)
+    close();
+
+    std::string segmentName = LiveStatsWriter::GetSegmentName(processId);
+    int descriptor = shm_open(segmentName.c_str(), O_RDONLY, 0);
+    if (descriptor < 0) {
+        throw std::runtime_error("Process " + std::to_string(processId) + " isn't publishing live stats");
+    }
+    struct stat status;
+    if (fstat(descriptor, &status) != 0 || (size_t)status.st_size < sizeof(LiveStatsHeader)) {
+        ::close(descriptor);
+        throw std::runtime_error(segmentName + " is not a live stats segment");
+    }
+    size_t size = (size_t)status.st_size;
+    void* mapping = mmap(nullptr, size, PROT_READ, MAP_SHARED, descriptor, 0);
+    ::close(descriptor);
+    if (mapping == MAP_FAILED) {
+        throw std::runtime_error("Could not map shared memory segment " + segmentName);
+    }
+
+    LiveStatsHeader const* found = static_cast<LiveStatsHeader const*>(mapping);
+    if (std::strncmp(found->magic, LiveStatsWriter::MAGIC, sizeof(found->magic)) != 0 || found->version != LiveStatsWriter::VERSION || size < sizeof(LiveStatsHeader) + found->maxSections * sizeof(LiveSectionStats)) {
+        munmap(mapping, size);
+        throw std::runtime_error(segmentName + " is not a live stats segment of version " + std::to_string(LiveStatsWriter::VERSION));
+    }
+
+    this->processId = processId;
+    header = found;
+    sections = reinterpret_cast<LiveSectionStats const*>(header + 1);
+    mappingSize = size;
+#else
+    throw std::runtime_error("Live stats need POSIX shared memory, which this platform doesn't have");
+#endif
+}
+
+void LiveStatsReader::close() {
+#if defined(PROFILER_HAS_SHARED_MEMORY)
+    if (header != nullptr) {
+        munmap(const_cast<LiveStatsHeader*>(header), mappingSize);
+    }
+#endif
+    header = nullptr;
+    sections = nullptr;
+}
+
+bool LiveStatsReader::read(LiveStatsSnapshot& snapshot) {
+    if (header == nullptr) {
+        return false;
+    }
+
+    for (int attempt = 0; attempt < MAX_READ_ATTEMPTS; attempt++) {
+        uint32_t before = header->sequence.load(std::memory_order_acquire);
+        if (before & 1) {
+            // Mid-publish. A copy takes microseconds, so don't spin hard.
+            std::this_thread::sleep_for(std::chrono::microseconds(100));
+            continue;
+        }
+
+        size_t count = std::min(header->sectionCount, header->maxSections);
+        snapshot.sections.resize(count);
+        std::memcpy(snapshot.sections.data(), sections, count * sizeof(LiveSectionStats));
+        snapshot.droppedSections = header->droppedSections;
+        snapshot.threadCount = header->threadCount;
+        snapshot.processId = header->processId;
+        snapshot.publishCount = header->publishCount;
+        snapshot.publishTime = header->publishTime;
+        snapshot.intervalSeconds = header->intervalSeconds;
+
+        std::atomic_thread_fence(std::memory_order_acquire);
+        if (header->sequence.load(std::memory_order_relaxed) == before) {
+            // Names are cut off without a terminator when they fill the field
+            for (LiveSectionStats& section : snapshot.sections) {
+                section.name[LIVE_SECTION_NAME_LENGTH - 1] = '\0';
+            }
+            return true;
+        }
+    }
+    return false;
+}
+
+bool LiveStatsReader::isProcessAlive() {
+#if defined(PROFILER_HAS_SHARED_MEMORY)
+    return kill((pid_t)processId, 0) == 0 || errno == EPERM;
+#else
+    return false;
+#endif
+}
@@ -0,0 +1,133 @@
+//live_stats.hpp
+#pragma once
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Running stats of a live process, published into a POSIX shared-memory
+// segment named /profiler-<pid> so another process can watch them without
+// stopping it. The segment is a LiveStatsHeader followed by maxSections
+// LiveSectionStats, of which the first sectionCount are in use. The publisher
+// rewrites it in place under a sequence lock: the sequence is odd while a
+// publish is in progress, and a reader keeps a copy only if it saw the same
+// even sequence before and after taking it. Readers never make the publisher
+// wait, and the publisher never makes the profiled threads wait.
+
+// Longest section name kept, the rest is cut off
+constexpr int LIVE_SECTION_NAME_LENGTH = 64;
+
+struct LiveStatsHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t maxSections;
+    std::atomic<uint32_t> sequence;
+    uint32_t sectionCount;
+    // Sections left out because the segment was full
+    uint32_t droppedSections;
+    uint32_t threadCount;
+    int64_t processId;
+    uint64_t publishCount;
+    // Seconds since the program started, at the last publish
+    double publishTime;
+    double intervalSeconds;
+};
+
+// Totals of one section over all threads since the start or the last reset.
+// Times are in seconds.
+struct LiveSectionStats {
+    char name[LIVE_SECTION_NAME_LENGTH];
+    int64_t count;
+    double totalTime;
+    double avgTime;
+    double maxTime;
+    double p50Time;
+    double p90Time;
+    double p99Time;
+    double p999Time;
+};
+
+// A consistent copy of a segment
+class LiveStatsSnapshot {
+public:
+    LiveStatsSnapshot();
+
+    uint32_t droppedSections;
+    uint32_t threadCount;
+    int64_t processId;
+    uint64_t publishCount;
+    double publishTime;
+    double intervalSeconds;
+    std::vector<LiveSectionStats> sections;
+};
+
+// Owns the segment and the background thread that refreshes it. Every interval
+// the thread asks the profiler for the current totals and copies them in.
+class LiveStatsWriter {
+public:
+    static constexpr char const* MAGIC = "PROFLIV";
+    static constexpr uint32_t VERSION = 1;
+    static constexpr uint32_t MAX_SECTIONS = 1024;
+
+    LiveStatsWriter();
+    ~LiveStatsWriter();
+
+    // Creates the segment and starts publishing. collect fills in the totals
+    // and the thread count; it runs on the publishing thread. Throws
+    // std::runtime_error if the segment can't be created or the platform has
+    // no POSIX shared memory.
+    void open(int intervalMs, std::function<void(std::vector<LiveSectionStats>&, uint32_t&)> collect);
+    // Publishes one last time and removes the segment
+    void close();
+    bool isOpen();
+
+    // /profiler-<pid>
+    static std::string GetSegmentName(int64_t processId);
+
+private:
+    void run();
+    void publish();
+
+    std::function<void(std::vector<LiveSectionStats>&, uint32_t&)> collect;
+    int intervalMs;
+    std::string segmentName;
+    LiveStatsHeader* header;
+    LiveSectionStats* sections;
+    size_t mappingSize;
+    // Refilled by collect on every publish. Publishing thread only.
+    std::vector<LiveSectionStats> collected;
+
+    std::thread publishThread;
+    // Guards the stop flag
+    std::mutex mutex;
+    std::condition_variable wake;
+    bool stopping;
+};
+
+// Attaches to the segment of a running process
+class LiveStatsReader {
+public:
+    LiveStatsReader();
+    ~LiveStatsReader();
+
+    // Throws std::runtime_error if the process publishes no segment, or the
+    // segment isn't one this version understands
+    void open(int64_t processId);
+    void close();
+    // Takes a consistent copy. Returns false if none could be taken because the
+    // publisher kept rewriting the segment, which only happens if it died
+    // halfway through a publish.
+    bool read(LiveStatsSnapshot& snapshot);
+    // Whether the process is still running
+    bool isProcessAlive();
+
+private:
+    int64_t processId;
+    LiveStatsHeader const* header;
+    LiveSectionStats const* sections;
+    size_t mappingSize;
+};
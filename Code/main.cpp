@@ -1,11 +1,17 @@
 #include <algorithm>
+#include <chrono>
 #include <iostream>
 #include <cstdlib>
 #include <cstdio>
 #include <math.h>
+#include <random>
 #include <vector>
-#include <execution>
+#include <string>
+#include <thread>
+#include "benchmark.hpp"
 #include "profiler.hpp"
+#include "sort.hpp"
+#include "trig.hpp"
 
 constexpr float DEGREES_TO_RADIANS = (3.1415926535f / 180.0f);
 
@@ -99,6 +105,36 @@ void Test3() {
     PROFILER_EXIT("Test 3 - interleave B"); // Exit section B
 }
 
+void Test5() {
+    // Several worker threads record the same sections at once
+    constexpr int TEST5_NUM_THREADS = 4;
+    constexpr int TEST5_NUM_ITERATIONS = 10000;
+
+    PROFILER_ENTER("Test 5 - Worker Threads");
+    std::vector<std::thread> workers;
+    for (int t = 0; t < TEST5_NUM_THREADS; t++) {
+        // Names built at runtime are registered once and entered by id
+        int workerSection = Profiler::RegisterSection("Test 5 - Worker " + std::to_string(t));
+        workers.emplace_back([workerSection]() {
+            PROFILER_ENTER_ID(workerSection);
+            PROFILER_ENTER("Test 5 - Worker");
+            float total = 0;
+            for (int i = 0; i < TEST5_NUM_ITERATIONS; i++) {
+                PROFILER_ENTER("Test 5 - Worker Iteration");
+                total += sinf(float(i));
+                PROFILER_EXIT("Test 5 - Worker Iteration");
+            }
+            PROFILER_EXIT("Test 5 - Worker");
+            PROFILER_EXIT_ID(workerSection);
+            (void)total;
+        });
+    }
+    for (std::thread& worker : workers) {
+        worker.join();
+    }
+    PROFILER_EXIT("Test 5 - Worker Threads");
+}
+
 
 
 
@@ -134,51 +170,20 @@ void QuickSort(std::vector<int>& arr, int low, int high) {
     }
 }
 
-void Test4_Original() {
-    PROFILER_ENTER("QuickSort Test - Original");
-
-    std::vector<int> data(SORT_TEST_NUM_ENTRIES);
-    PROFILER_ENTER("Data Generation - Original");
-    for (int& num : data) {
-        num = rand() % SORT_TEST_NUM_ENTRIES;
-    }
-    PROFILER_EXIT("Data Generation - Original");
-
+void Test4_Original(std::vector<int>& data) {
     PROFILER_ENTER("QuickSort Execution - Original");
     QuickSort(data, 0, SORT_TEST_NUM_ENTRIES - 1);
     PROFILER_EXIT("QuickSort Execution - Original");
-
-    PROFILER_EXIT("QuickSort Test - Original");
 }
 
-void Test4_Optimization1() {
-    PROFILER_ENTER("QuickSort Test - Optimization 1");
-
-    std::vector<int> data(SORT_TEST_NUM_ENTRIES);
-    PROFILER_ENTER("Data Generation - Optimization 1");
-    for (int& num : data) {
-        num = rand() % SORT_TEST_NUM_ENTRIES;
-    }
-    PROFILER_EXIT("Data Generation - Optimization 1");
-
+void Test4_Optimization1(std::vector<int>& data) {
     // Optimization 1: Use std::sort instead of custom QuickSort   
     PROFILER_ENTER("std::sort Execution - Optimization 1");
     std::sort(data.begin(), data.end());
     PROFILER_EXIT("std::sort Execution - Optimization 1");
-
-    PROFILER_EXIT("QuickSort Test - Optimization 1");
 }
 
-void Test4_Optimization2() {
-    PROFILER_ENTER("QuickSort Test - Optimization 2");
-
-    std::vector<int> data(SORT_TEST_NUM_ENTRIES);
-    PROFILER_ENTER("Data Generation - Optimization 2");
-    for (int& num : data) {
-        num = rand() % SORT_TEST_NUM_ENTRIES;
-    }
-    PROFILER_EXIT("Data Generation - Optimization 2");
-
+void Test4_Optimization2(std::vector<int>& data) {
     // Optimization 2: Use a more efficient pivot selection strategy for QuickSort
     PROFILER_ENTER("QuickSort with Median Pivot Execution");
     auto medianPivotQuickSort = [](std::vector<int>& arr, int low, int high) {
@@ -202,20 +207,9 @@ void Test4_Optimization2() {
     };
     medianPivotQuickSort(data, 0, SORT_TEST_NUM_ENTRIES - 1);
     PROFILER_EXIT("QuickSort with Median Pivot Execution");
-
-    PROFILER_EXIT("QuickSort Test - Optimization 2");
 }
 
-void Test4_Optimization3() {
-    PROFILER_ENTER("QuickSort Test - Optimization 3");
-
-    std::vector<int> data(SORT_TEST_NUM_ENTRIES);
-    PROFILER_ENTER("Data Generation - Optimization 3");
-    for (int& num : data) {
-        num = rand() % SORT_TEST_NUM_ENTRIES;
-    }
-    PROFILER_EXIT("Data Generation - Optimization 3");
-
+void Test4_Optimization3(std::vector<int>& data) {
     // Optimization 3: Use a hybrid sorting algorithm (QuickSort followed by std::sort for small arrays)
     PROFILER_ENTER("Hybrid Sort Execution");
     auto hybridQuickSort = [](std::vector<int>& arr, int low, int high) {
@@ -240,34 +234,250 @@ void Test4_Optimization3() {
     };
     hybridQuickSort(data, 0, SORT_TEST_NUM_ENTRIES - 1);
     PROFILER_EXIT("Hybrid Sort Execution");
+}
 
-    PROFILER_EXIT("QuickSort Test - Optimization 3");
+void Test4_IntroSort(std::vector<int>& data) {
+    PROFILER_ENTER("IntroSort Execution");
+    IntroSort(data.data(), data.size());
+    PROFILER_EXIT("IntroSort Execution");
+}
+
+void Test4_RadixSort(std::vector<int>& data) {
+    PROFILER_ENTER("Radix Sort Execution");
+    RadixSort(data.data(), data.size());
+    PROFILER_EXIT("Radix Sort Execution");
+}
+
+void Test4_ParallelSort(std::vector<int>& data) {
+    PROFILER_ENTER("Parallel Sort Execution");
+    ParallelSort(data.data(), data.size());
+    PROFILER_EXIT("Parallel Sort Execution");
 }
 
 void Test4() {
-    PROFILER_ENTER("Test 4 - Original");
-    for (int i = 0; i < 100; ++i) {
-        Test4_Original();
+    // Every variant sorts the same seeded inputs, generated outside the timed region
+    std::vector<int> data(SORT_TEST_NUM_ENTRIES);
+    auto generateData = [&](uint64_t seed) {
+        std::mt19937 random((uint32_t)seed);
+        std::uniform_int_distribution<int> values(0, SORT_TEST_NUM_ENTRIES - 1);
+        for (int& num : data) {
+            num = values(random);
+        }
+    };
+
+    Benchmark benchmark("Test 4");
+    benchmark.addCase("Test 4 - Original", generateData, [&]() { Test4_Original(data); });
+    benchmark.addCase("Test 4 - Optimization 1", generateData, [&]() { Test4_Optimization1(data); });
+    benchmark.addCase("Test 4 - Optimization 2", generateData, [&]() { Test4_Optimization2(data); });
+    benchmark.addCase("Test 4 - Optimization 3", generateData, [&]() { Test4_Optimization3(data); });
+    benchmark.addCase("Test 4 - IntroSort", generateData, [&]() { Test4_IntroSort(data); });
+    benchmark.addCase("Test 4 - Radix Sort", generateData, [&]() { Test4_RadixSort(data); });
+    benchmark.addCase("Test 4 - Parallel Sort", generateData, [&]() { Test4_ParallelSort(data); });
+    benchmark.run();
+
+    benchmark.printResults();
+    benchmark.saveResultsToCSV("benchmark_test4.csv");
+    benchmark.saveResultsToJSON("benchmark_test4.json");
+}
+
+constexpr int TRIG_BATCH_NUM_ENTRIES = 100000;
+
+// Distance from a double reference in units of the float ULP of 1.0 (2^-23).
+// Sines and cosines are at most 1, so this bounds the error the same way
+// everywhere; the ULP of the reference itself shrinks towards zero crossings,
+// where a tiny absolute error would read as thousands of ULP.
+double UlpOfOneError(float value, double reference) {
+    return std::fabs(value - reference) / std::ldexp(1.0, -23);
+}
+
+// Sine and cosine of an angle in degrees in double precision, reduced in degrees
+// so multiples of 90 stay exact
+void ReferenceSinCosDegrees(float degrees, double& sine, double& cosine) {
+    double remainder = std::remainder((double)degrees, 90.0);
+    long quadrant = std::lround(((double)degrees - remainder) / 90.0);
+    double radians = remainder * (3.14159265358979323846 / 180.0);
+    sine = std::sin(radians);
+    cosine = std::cos(radians);
+    if (quadrant & 1) {
+        double swap = sine;
+        sine = cosine;
+        cosine = -swap;
+    }
+    if (quadrant & 2) {
+        sine = -sine;
+        cosine = -cosine;
+    }
+}
+
+void Test6() {
+    // The Test 1 and Test 2 trig loop against the batched kernels, on the same angles
+    std::vector<float> degrees(TRIG_BATCH_NUM_ENTRIES);
+    auto generateAngles = [&](uint64_t seed) {
+        std::mt19937 random((uint32_t)seed);
+        std::uniform_real_distribution<float> angles(0.0f, 360.0f);
+        for (float& angle : degrees) {
+            angle = angles(random);
+        }
+    };
+
+    SimdLevel bestLevel = GetSimdLevel();
+    std::vector<SimdLevel> levels;
+    for (SimdLevel level : { SimdLevel::Scalar, SimdLevel::Sse2, SimdLevel::Avx2 }) {
+        if (HasSimdLevel(level)) {
+            levels.push_back(level);
+        }
     }
-    PROFILER_EXIT("Test 4 - Original");
 
-    PROFILER_ENTER("Test 4 - Optimization 1");
-    for (int i = 0; i < 100; ++i) {
-        Test4_Optimization1();
+    // What each case computes and with which kernel, in the order the cases
+    // are added, which is the order of the results
+    enum class TrigKind { Libm, Fused, SinCos };
+    struct TrigCase {
+        TrigKind kind;
+        SimdLevel level;
+    };
+    std::vector<TrigCase> cases;
+
+    float biggestSoFar = 0;
+    BenchmarkOptions options;
+    options.maxSecondsPerCase = 0.5;
+    Benchmark benchmark("Test 6", options);
+    cases.push_back({ TrigKind::Libm, SimdLevel::Scalar });
+    benchmark.addCase("Test 6 - cosf and sinf", generateAngles, [&]() {
+        biggestSoFar = 0;
+        for (float yawDegrees : degrees) {
+            float cosDegrees = cosf(yawDegrees * DEGREES_TO_RADIANS);
+            float sinDegrees = sinf(yawDegrees * DEGREES_TO_RADIANS);
+            if (cosDegrees + sinDegrees > biggestSoFar) {
+                biggestSoFar = cosDegrees + sinDegrees;
+            }
+        }
+    });
+    for (SimdLevel level : levels) {
+        auto setup = [&, level](uint64_t seed) {
+            generateAngles(seed);
+            SetSimdLevel(level);
+        };
+        cases.push_back({ TrigKind::Fused, level });
+        benchmark.addCase(std::string("Test 6 - Fused ") + GetSimdLevelName(level), setup, [&]() {
+            biggestSoFar = MaxCosPlusSinDegrees(degrees.data(), degrees.size());
+        });
     }
-    PROFILER_EXIT("Test 4 - Optimization 1");
-    
-    PROFILER_ENTER("Test 4 - Optimization 2");
-    for (int i = 0; i < 100; ++i) {
-        Test4_Optimization2();
+    // Storing every result as well, with the best kernel only
+    std::vector<float> sines(TRIG_BATCH_NUM_ENTRIES);
+    std::vector<float> cosines(TRIG_BATCH_NUM_ENTRIES);
+    cases.push_back({ TrigKind::SinCos, bestLevel });
+    benchmark.addCase(std::string("Test 6 - SinCos ") + GetSimdLevelName(bestLevel), [&](uint64_t seed) {
+        generateAngles(seed);
+        SetSimdLevel(bestLevel);
+    }, [&]() {
+        SinCosDegrees(degrees.data(), sines.data(), cosines.data(), degrees.size());
+    });
+    benchmark.run();
+    benchmark.printResults();
+
+    // Throughput and accuracy side by side, on the angles of the first run. The
+    // fused kernels only return the largest cos + sin, so only that is
+    // checked for them, against its double reference.
+    generateAngles(options.seed);
+    std::vector<double> referenceSines(TRIG_BATCH_NUM_ENTRIES);
+    std::vector<double> referenceCosines(TRIG_BATCH_NUM_ENTRIES);
+    double referenceBiggest = -INFINITY;
+    for (int i = 0; i < TRIG_BATCH_NUM_ENTRIES; i++) {
+        ReferenceSinCosDegrees(degrees[i], referenceSines[i], referenceCosines[i]);
+        referenceBiggest = std::max(referenceBiggest, referenceCosines[i] + referenceSines[i]);
+    }
+    // Negative errors stand for a column the case doesn't produce
+    auto formatError = [](double error) {
+        char text[16];
+        if (error < 0) {
+            std::snprintf(text, sizeof(text), "-");
+        } else {
+            std::snprintf(text, sizeof(text), "%.2f", error);
+        }
+        return std::string(text);
+    };
+    std::vector<BenchmarkResult> const& results = benchmark.getResults();
+    printf("Errors in ULPs of 1.0 (2^-23) against double references\n");
+    printf("%-28s %14s %12s %12s %16s\n", "Case", "Elements / ns", "Max Sin Err", "Max Cos Err", "Biggest Cos+Sin");
+    for (size_t c = 0; c < results.size(); c++) {
+        bool fused = cases[c].kind == TrigKind::Fused;
+        float biggest = 0;
+        if (cases[c].kind == TrigKind::Libm) {
+            for (int i = 0; i < TRIG_BATCH_NUM_ENTRIES; i++) {
+                sines[i] = sinf(degrees[i] * DEGREES_TO_RADIANS);
+                cosines[i] = cosf(degrees[i] * DEGREES_TO_RADIANS);
+                biggest = std::max(biggest, cosines[i] + sines[i]);
+            }
+        } else if (fused) {
+            SetSimdLevel(cases[c].level);
+            biggest = MaxCosPlusSinDegrees(degrees.data(), degrees.size());
+        } else {
+            SetSimdLevel(cases[c].level);
+            SinCosDegrees(degrees.data(), sines.data(), cosines.data(), degrees.size());
+            biggest = -INFINITY;
+            for (int i = 0; i < TRIG_BATCH_NUM_ENTRIES; i++) {
+                biggest = std::max(biggest, cosines[i] + sines[i]);
+            }
+        }
+        double sineError = fused ? -1 : 0;
+        double cosineError = fused ? -1 : 0;
+        for (int i = 0; i < TRIG_BATCH_NUM_ENTRIES && !fused; i++) {
+            sineError = std::max(sineError, UlpOfOneError(sines[i], referenceSines[i]));
+            cosineError = std::max(cosineError, UlpOfOneError(cosines[i], referenceCosines[i]));
+        }
+        double biggestError = UlpOfOneError(biggest, referenceBiggest);
+        double elementsPerNanosecond = TRIG_BATCH_NUM_ENTRIES / (results[c].medianTime * 1e9);
+        printf("%-28s %14.3f %12s %12s %16s\n", results[c].name.c_str(), elementsPerNanosecond, formatError(sineError).c_str(), formatError(cosineError).c_str(), formatError(biggestError).c_str());
+    }
+    std::cout << "Biggest cos+sin = " << biggestSoFar << ", reference " << referenceBiggest << "\n" << std::endl;
+    SetSimdLevel(bestLevel);
+}
+
+// Functions timed through -finstrument-functions rather than sections. Only
+// `make function_tracing` instruments this file; other builds skip the check.
+void FunctionTraceInner() {
+    std::this_thread::sleep_for(std::chrono::milliseconds(20));
+}
+
+void FunctionTraceHelper() {
+    std::this_thread::sleep_for(std::chrono::milliseconds(10));
+}
+
+void FunctionTraceOuter() {
+    for (int i = 0; i < 3; i++) {
+        FunctionTraceInner();
     }
-    PROFILER_EXIT("Test 4 - Optimization 2");
 
-    PROFILER_ENTER("Test 4 - Optimization 3");
-    for (int i = 0; i < 100; ++i) {
-        Test4_Optimization3();
+    // Called while tracing is off, so its exit must not end the outer function
+    profiler->stopFunctionTracing();
+    FunctionTraceHelper();
+    profiler->startFunctionTracing();
+    std::this_thread::sleep_for(std::chrono::milliseconds(50));
+}
+
+// Returns false if the inclusive times don't add up
+bool Test7() {
+    profiler->setMemoryLimits(0, 0);
+    profiler->setFunctionFilters({ "FunctionTrace*" }, {});
+    profiler->startFunctionTracing();
+    FunctionTraceOuter();
+    profiler->stopFunctionTracing();
+    profiler->setFunctionFilters({}, {});
+
+    ProfilerStats outer("");
+    ProfilerStats inner("");
+    try {
+        outer = profiler->calculateStats("FunctionTraceOuter()");
+        inner = profiler->calculateStats("FunctionTraceInner()");
+    } catch (std::out_of_range const&) {
+        std::cout << "Function tracing: main.cpp isn't instrumented, run `make function_tracing`\n" << std::endl;
+        return true;
     }
-    PROFILER_EXIT("Test 4 - Optimization 3");
+
+    // The outer function runs 3 x 20 ms inside, then 10 ms untraced and 50 ms more
+    bool passed = outer.count == 1 && inner.count == 3 && inner.totalTime >= 0.06 && outer.totalTime - inner.totalTime >= 0.06;
+    printf("Function tracing: FunctionTraceOuter() %d call, %.1f ms; FunctionTraceInner() %lld calls, %.1f ms: %s\n\n", (int)outer.count, outer.totalTime * 1e3, (long long)inner.count, inner.totalTime * 1e3, passed ? "OK" : "FAILED");
+    return passed;
 }
 
 
@@ -298,13 +508,44 @@ void RunTest() {
     // Test1();
     Test2();
     Test3();
+    Test5();
 }
 
 int main(int argc, char** argv) {
     profiler = Profiler::GetInstance();
 
+    // `make function_tracing` runs only the function tracing check
+    if (argc > 1 && std::string(argv[1]) == "functions") {
+        bool passed = Test7();
+        delete profiler;
+        return passed ? 0 : 1;
+    }
+
+    // Keep memory flat: exact stats, the last 4096 events per thread and at
+    // most 1000 timeline points per section
+    profiler->setMemoryLimits(4096, 1000);
+
+    // Stream every event to disk as well. Convert it with `make tools` and
+    // `./trace_convert profiler.trace`.
+    profiler->startTrace("profiler.trace");
+
+    // Sample the open sections 1000 times per CPU second on top of the probes
+    profiler->startSampling(1000);
+
+    // Publish the running totals 10 times per second. Watch them from another
+    // terminal with `make tools` and `./profiler_top <pid>`.
+    profiler->startLiveStats(100);
+
+    // Roll the calls up into 100 ms windows as well, kept for the last minute
+    profiler->startWindows(0.1, 600);
+
     RunTest();
 
+    profiler->stopWindows();
+    profiler->stopLiveStats();
+    profiler->stopSampling();
+    profiler->stopTrace();
+
     // Calculate the statistics
     profiler->calculateStats();
 
@@ -320,8 +561,29 @@ int main(int argc, char** argv) {
     // Save to JSON
     profiler->saveStatsToJSON("profiler.json");
 
-    // Reset the statistics
-    profiler->reset();
+    // Save the totals for merging with other processes' in profile_merge
+    profiler->saveSnapshot("profiler.snapshot");
+
+    // Save the call tree for flame graph tools
+    profiler->saveCallTreeToCollapsed("profiler.collapsed");
+
+    // Save the recent events for chrome://tracing or ui.perfetto.dev
+    profiler->saveChromeTrace("profiler_chrome.json");
+    profiler->saveCompactChromeTrace("profiler_perfetto.json");
+
+    // Reset the statistics and keep every event for test 4
+    profiler->setMemoryLimits(0, 0);
+
+    // Count cycles, instructions and cache misses for the sort variants where
+    // the machine allows it
+    if (!profiler->enableHardwareCounters()) {
+        std::cout << "Hardware counters unavailable, timing test 4 only\n\n";
+    }
+
+    // Show what each variant allocates
+    if (!profiler->startAllocationTracking()) {
+        std::cout << "Allocation hooks not built in, define PROFILER_ALLOCATION_HOOKS to count allocations in test 4\n\n";
+    }
 
     // Run test 4
     Test4();
@@ -334,7 +596,16 @@ int main(int argc, char** argv) {
     profiler->saveStatsToCSV("profiler_test4.csv");
     profiler->saveStatsToJSON("profiler_test4.json");
 
+    // Run test 6 on its own statistics
+    profiler->disableHardwareCounters();
+    profiler->stopAllocationTracking();
+    profiler->setMemoryLimits(0, 0);
+    Test6();
+
+    // Time instrumented functions, when this file was built for it
+    bool passed = Test7();
+
     delete profiler;
     profiler = nullptr;
-    return 0;
+    return passed ? 0 : 1;
 }
\ No newline at end of file
@@ -0,0 +1,167 @@
+#include "perf_counters.hpp"
+
+#if defined(__linux__)
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <cstring>
+#define PROFILER_HAS_PERF_EVENTS 1
+#endif
+
+#if defined(PROFILER_HAS_PERF_EVENTS) && (defined(__x86_64__) || defined(__i386__))
+#include <x86intrin.h>
+#define PROFILER_HAS_RDPMC 1
+#endif
+
+namespace {
+    char const* const COUNTER_NAMES[PERF_COUNTER_COUNT] = { "Cycles", "Instructions", "Branch Misses", "L1D Misses", "LLC Misses" };
+
+#if defined(PROFILER_HAS_PERF_EVENTS)
+    // perf_event_attr type and config of each counter
+    struct CounterEvent {
+        uint32_t type;
+        uint64_t config;
+    };
+    CounterEvent const COUNTER_EVENTS[PERF_COUNTER_COUNT] = {
+        { PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES },
+        { PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS },
+        { PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES },
+        { PERF_TYPE_HW_CACHE, PERF_COUNT_HW_CACHE_L1D | (PERF_COUNT_HW_CACHE_OP_READ << 8) | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16) },
+        { PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES },
+    };
+
+    int openEvent(CounterEvent const& event, int groupFd) {
+        perf_event_attr attr;
+        std::memset(&attr, 0, sizeof(attr));
+        attr.size = sizeof(attr);
+        attr.type = event.type;
+        attr.config = event.config;
+        // The group starts once every member is open
+        attr.disabled = groupFd == -1 ? 1 : 0;
+        attr.exclude_kernel = 1;
+        attr.exclude_hv = 1;
+        return (int)syscall(__NR_perf_event_open, &attr, 0, -1, groupFd, 0);
+    }
+
+#if defined(PROFILER_HAS_RDPMC)
+    // Reads a counter from user space, following the protocol documented in
+    // linux/perf_event.h. Returns false if the counter isn't on the CPU right now.
+    bool readWithRdpmc(perf_event_mmap_page volatile* page, int64_t& value) {
+        uint32_t sequence;
+        bool onCpu;
+        do {
+            sequence = page->lock;
+            __asm__ __volatile__("" ::: "memory");
+            uint32_t index = page->index;
+            value = page->offset;
+            onCpu = page->cap_user_rdpmc && index != 0;
+            if (onCpu) {
+                // Sign-extend the counter from its hardware width
+                int width = page->pmc_width;
+                int64_t counter = (int64_t)__rdpmc(index - 1);
+                counter = (int64_t)((uint64_t)counter << (64 - width)) >> (64 - width);
+                value += counter;
+            }
+            __asm__ __volatile__("" ::: "memory");
+        } while (page->lock != sequence);
+        return onCpu;
+    }
+#endif
+#endif
+}
+
+char const* GetPerfCounterName(int counter) {
+    return COUNTER_NAMES[counter];
+}
+
+PerfCounters::PerfCounters() {
+    for (int i = 0; i < PERF_COUNTER_COUNT; i++) {
+        fds[i] = -1;
+        pages[i] = nullptr;
+    }
+}
+
+PerfCounters::~PerfCounters() {
+    close();
+}
+
+bool PerfCounters::open() {
+    close();
+
+#if defined(PROFILER_HAS_PERF_EVENTS)
+    int groupFd = -1;
+    long pageSize = sysconf(_SC_PAGESIZE);
+    for (int i = 0; i < PERF_COUNTER_COUNT; i++) {
+        fds[i] = openEvent(COUNTER_EVENTS[i], groupFd);
+        if (fds[i] < 0) {
+            continue;
+        }
+        if (groupFd == -1) {
+            groupFd = fds[i];
+        }
+
+        void* page = mmap(nullptr, pageSize, PROT_READ, MAP_SHARED, fds[i], 0);
+        pages[i] = page == MAP_FAILED ? nullptr : page;
+    }
+    if (groupFd == -1) {
+        return false;
+    }
+
+    ioctl(groupFd, PERF_EVENT_IOC_RESET, PERF_IOC_FLAG_GROUP);
+    ioctl(groupFd, PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+    return true;
+#else
+    return false;
+#endif
+}
+
+void PerfCounters::close() {
+#if defined(PROFILER_HAS_PERF_EVENTS)
+    long pageSize = sysconf(_SC_PAGESIZE);
+    for (int i = 0; i < PERF_COUNTER_COUNT; i++) {
+        if (pages[i] != nullptr) {
+            munmap(pages[i], pageSize);
+            pages[i] = nullptr;
+        }
+        if (fds[i] >= 0) {
+            ::close(fds[i]);
+            fds[i] = -1;
+        }
+    }
+#endif
+}
+
+bool PerfCounters::isOpen() {
+    for (int i = 0; i < PERF_COUNTER_COUNT; i++) {
+        if (fds[i] >= 0) {
+            return true;
+        }
+    }
+    return false;
+}
+
+bool PerfCounters::isAvailable(int counter) {
+    return fds[counter] >= 0;
+}
+
+void PerfCounters::read(int64_t values[PERF_COUNTER_COUNT]) {
+    for (int i = 0; i < PERF_COUNTER_COUNT; i++) {
+        values[i] = 0;
+#if defined(PROFILER_HAS_PERF_EVENTS)
+        if (fds[i] < 0) {
+            continue;
+        }
+#if defined(PROFILER_HAS_RDPMC)
+        if (pages[i] != nullptr && readWithRdpmc(static_cast<perf_event_mmap_page volatile*>(pages[i]), values[i])) {
+            continue;
+        }
+#endif
+        uint64_t value = 0;
+        if (::read(fds[i], &value, sizeof(value)) == (ssize_t)sizeof(value)) {
+            values[i] = (int64_t)value;
+        }
+#endif
+    }
+}
@@ -0,0 +1,42 @@
+//perf_counters.hpp
+#pragma once
+#include <cstdint>
+
+// Hardware events counted for every section when hardware counters are on
+enum class PerfCounter { Cycles, Instructions, BranchMisses, L1DMisses, LLCMisses };
+constexpr int PERF_COUNTER_COUNT = 5;
+
+// Report name of a counter, e.g. "Branch Misses"
+char const* GetPerfCounterName(int counter);
+
+// One thread's hardware counters, opened with perf_event_open as a single
+// group so they are scheduled onto the CPU together. Only user-space events
+// are counted. Values are read with rdpmc straight from user space where the
+// kernel allows it, which costs a few dozen cycles, and with a read() system
+// call otherwise. Linux only: elsewhere, or when the kernel denies access, open()
+// fails and every counter reads 0.
+class PerfCounters {
+public:
+    PerfCounters();
+    ~PerfCounters();
+
+    PerfCounters(PerfCounters const&) = delete;
+    PerfCounters& operator=(PerfCounters const&) = delete;
+
+    // Starts counting the calling thread. Returns false if no counter could be
+    // opened. Counters the CPU doesn't have are left out.
+    bool open();
+    void close();
+    bool isOpen();
+    // Whether a counter is counting
+    bool isAvailable(int counter);
+
+    // Current value of every counter. Only call it on the thread that opened them.
+    void read(int64_t values[PERF_COUNTER_COUNT]);
+
+private:
+    int fds[PERF_COUNTER_COUNT];
+    // The kernel's perf_event_mmap_page for each counter, or null when rdpmc
+    // can't be used
+    void* pages[PERF_COUNTER_COUNT];
+};
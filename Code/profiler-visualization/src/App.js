@@ -5,6 +5,7 @@ import './styles.css';
 
 const App = () => {
     const [data, setData] = useState([]);
+    const [timelineFile, setTimelineFile] = useState(null);
     const [filteredData, setFilteredData] = useState([]);
     const [sectionNames, setSectionNames] = useState([]);
     const [selectedSections, setSelectedSections] = useState([]);
@@ -15,11 +16,16 @@ const App = () => {
     const [showCheckboxes, setShowCheckboxes] = useState(true);  // Manage toggle state for checkboxes
 
     const handleFileUpload = (event) => {
-        const file = event.target.files[0];
+        const files = [...event.target.files];
+        // The finer timeline levels of long runs come in a second file, picked
+        // together with the report
+        const file = files.find(f => !f.name.endsWith('.timeline.json'));
         if (file) {
             const reader = new FileReader();
             reader.onload = (e) => {
-                const jsonData = JSON.parse(e.target.result).profiler;
+                const report = JSON.parse(e.target.result);
+                const jsonData = report.profiler;
+                setTimelineFile(files.find(f => f.name === report['Timeline File']) || null);
                 setData(jsonData);
                 setFilteredData(jsonData);
                 const sections = [...new Set(jsonData.map(d => d['Section Name']))];
@@ -79,7 +85,7 @@ const App = () => {
 
             {/* File Upload */}
             <div>
-                <input type="file" accept=".json" onChange={handleFileUpload} />
+                <input type="file" accept=".json" multiple onChange={handleFileUpload} />
             </div>
 
             {/* Log Transform Checkbox */}
@@ -150,7 +156,7 @@ const App = () => {
                 {filteredData.length > 0 && <BarChart data={filteredData} metric="Max Time" metricLabel="Max Time" logTransform={logTransform} />}
                 {filteredData.length > 0 && <BarChart data={filteredData} metric="Min Time" metricLabel="Min Time" logTransform={logTransform} />}
                 {filteredData.length > 0 && <BarChart data={filteredData} metric="Total Time" metricLabel="Total Time" logTransform={logTransform} />}
-                {filteredData.length > 0 && <TimelineChart data={filteredData} />}
+                {filteredData.length > 0 && <TimelineChart data={filteredData} timelineFile={timelineFile} />}
             </div>
         </div>
     );
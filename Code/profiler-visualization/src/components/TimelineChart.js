@@ -1,8 +1,34 @@
-import React, { useRef, useEffect } from 'react';
+import React, { useRef, useEffect, useState } from 'react';
 import * as d3 from 'd3';
 
-const TimelineChart = ({ data }) => {
+// Points a timeline is drawn with before a finer level is worth loading, the
+// same as the level the profiler writes inline
+const TARGET_POINTS = 1024;
+
+// Points of a timeline from call number low to high, plus one either side so
+// the line runs to the edges
+const visiblePoints = (timeline, low, high) => {
+    const bisect = d3.bisector(t => t.call);
+    const start = Math.max(0, bisect.left(timeline, low) - 1);
+    const end = Math.min(timeline.length, bisect.right(timeline, high) + 1);
+    return timeline.slice(start, end);
+};
+
+const TimelineChart = ({ data, timelineFile }) => {
     const svgRef = useRef();
+    // Visible call numbers, or null when zoomed out all the way
+    const [domain, setDomain] = useState(null);
+    // Finer levels read so far, keyed by section name and point count
+    const [levels, setLevels] = useState({});
+    const loading = useRef(new Set());
+
+    // A new report starts zoomed out, with no levels read
+    useEffect(() => {
+        setDomain(null);
+        setLevels({});
+        loading.current = new Set();
+        d3.select(svgRef.current).property('__zoom', d3.zoomIdentity);
+    }, [data, timelineFile]);
 
     useEffect(() => {
         const svg = d3.select(svgRef.current);
@@ -14,15 +40,49 @@ const TimelineChart = ({ data }) => {
 
         const timelines = data.map(d => ({
             name: d['Section Name'],  // Using Section Name instead of Function Name
+            // Sampled timelines carry the call number of each point
             timeline: d['Timeline'].map((time, index) => ({
-                call: index + 1,
+                call: d['Timeline Calls'] ? +d['Timeline Calls'][index] : index + 1,
                 time: +time
             }))
         }));
 
-        const x = d3.scaleLinear()
+        const fullX = d3.scaleLinear()
             .domain([1, d3.max(timelines, d => d3.max(d.timeline, t => t.call)) || 2]) // Ensure domain covers at least two points
             .range([0, width]);
+        const x = fullX.copy().domain(domain || fullX.domain());
+        const [low, high] = x.domain();
+        const fraction = (high - low) / (fullX.domain()[1] - fullX.domain()[0]);
+
+        // Long timelines carry only their coarsest level. Once zooming in leaves
+        // too few of its points in view, read the coarsest finer level that has
+        // enough from the timeline file and draw with it when it arrives.
+        timelines.forEach((timelineData, index) => {
+            const available = data[index]['Timeline Levels'];
+            if (!available || !timelineFile || timelineData.timeline.length * fraction >= TARGET_POINTS / 2) {
+                return;
+            }
+            const level = available.find(l => l.Points * fraction >= TARGET_POINTS) || available[available.length - 1];
+            const key = `${timelineData.name}:${level.Points}`;
+            if (levels[key]) {
+                timelineData.timeline = levels[key];
+            } else if (!loading.current.has(key)) {
+                const pending = loading.current;
+                pending.add(key);
+                timelineFile.slice(level.Offset, level.Offset + level.Length).text().then(text => {
+                    // Dropped if another report was loaded meanwhile
+                    if (loading.current !== pending) {
+                        return;
+                    }
+                    const parsed = JSON.parse(text);
+                    const points = parsed.Calls.map((call, i) => ({ call: +call, time: +parsed.Times[i] }));
+                    setLevels(previous => ({ ...previous, [key]: points }));
+                });
+            }
+        });
+        timelines.forEach(timelineData => {
+            timelineData.timeline = visiblePoints(timelineData.timeline, low, high);
+        });
 
         const y = d3.scaleLinear()
             .domain([0, d3.max(timelines, d => d3.max(d.timeline, t => t.time)) || 1]) // Ensure domain handles single values
@@ -34,6 +94,13 @@ const TimelineChart = ({ data }) => {
         const chart = svg.append("g")
             .attr("transform", `translate(${margin.left},${margin.top})`);
 
+        // Keep zoomed-in lines inside the plot
+        chart.append("clipPath")
+            .attr("id", "timeline-clip")
+            .append("rect")
+            .attr("width", width)
+            .attr("height", height);
+
         // Add X axis
         chart.append("g")
             .attr("transform", `translate(0,${height})`)
@@ -71,12 +138,13 @@ const TimelineChart = ({ data }) => {
                 // Draw a line if there are multiple points
                 chart.append("path")
                     .datum(timelineData.timeline)
+                    .attr("clip-path", "url(#timeline-clip)")
                     .attr("class", "line")
                     .attr("fill", "none")
                     .attr("stroke", color(timelineData.name))
                     .attr("stroke-width", 2)
                     .attr("d", line);
-            } else {
+            } else if (timelineData.timeline.length === 1) {
                 // Draw a single point if there's only one data point
                 chart.append("circle")
                     .attr("cx", x(timelineData.timeline[0].call))
@@ -107,7 +175,18 @@ const TimelineChart = ({ data }) => {
             .attr("fill", "#f5f5f5")
             .text(d => d.name);
 
-    }, [data]);
+        // Scroll or drag to zoom along the calls; the time axis follows what is visible
+        const zoom = d3.zoom()
+            .scaleExtent([1, Math.max(1, (fullX.domain()[1] - fullX.domain()[0]) / 10)])
+            .extent([[0, 0], [width, height]])
+            .translateExtent([[0, 0], [width, height]])
+            .on("zoom", (event) => {
+                const zoomed = event.transform.rescaleX(fullX).domain();
+                setDomain(event.transform.k === 1 ? null : zoomed);
+            });
+        svg.call(zoom);
+
+    }, [data, timelineFile, domain, levels]);
 
     return (
         <svg ref={svgRef} width="500" height="500"></svg>
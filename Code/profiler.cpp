@@ -1,174 +1,1868 @@
 #include "profiler.hpp"
+#include "symbols.hpp"
 #include "time.hpp"
+#include "timeline_levels.hpp"
 #include <iostream>
 #include <fstream>
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <stdexcept>
+#include <tuple>
 
+#if defined(__unix__) || defined(__APPLE__)
+#include <signal.h>
+#include <sys/time.h>
+#define PROFILER_HAS_SAMPLING 1
+#endif
 
 
 
 
 
 
-Profiler* Profiler::gProfiler = nullptr;
 
-TimeRecordStart::TimeRecordStart(char const* sectionName, double secondsAtStart): sectionName(sectionName), secondsAtStart(secondsAtStart) {}
+std::atomic<Profiler*> Profiler::gProfiler(nullptr);
+
+namespace {
+    // Guards creation of the singleton
+    std::mutex gProfilerMutex;
+    // Every profiler instance gets a new id so stale thread-local caches are never reused
+    std::atomic<uint64_t> gNextInstanceId(1);
+
+    // Per-thread cache of the thread's data in the current profiler
+    struct ThreadDataCache {
+        uint64_t instanceId;
+        ProfilerThreadData* data;
+    };
+    thread_local ThreadDataCache tThreadData = { 0, nullptr };
+
+#if defined(PROFILER_HAS_SAMPLING)
+    // SIGPROF handler that was installed before sampling started
+    struct sigaction gPreviousSampleAction;
+#endif
+}
+
+TimeRecordStart::TimeRecordStart(int sectionId, int64_t ticksAtStart, int64_t probesAtStart, int callTreeNode, int64_t liveBytesAtStart): sectionId(sectionId), ticksAtStart(ticksAtStart), probesAtStart(probesAtStart), callTreeNode(callTreeNode), childTicks(0), allocations(0), allocatedBytes(0), liveBytesAtStart(liveBytesAtStart), peakLiveBytes(liveBytesAtStart) {}
 TimeRecordStart::~TimeRecordStart() {}
 
-TimeRecordStop::TimeRecordStop(char const* sectionName, double elapsedTime): sectionName(sectionName), elapsedTime(elapsedTime), lineNumber(0), fileName("null"), functionName("null") {}
-TimeRecordStop::TimeRecordStop(char const* sectionName, double elapsedTime, int lineNumber, const char* fileName, const char* functionName): sectionName(sectionName), elapsedTime(elapsedTime), lineNumber(lineNumber), fileName(fileName), functionName(functionName) {}
-TimeRecordStop::~TimeRecordStop() {}
+CallTreeNode::CallTreeNode(int sectionId, int parentIndex): sectionId(sectionId), parentIndex(parentIndex), count(0), inclusiveTicks(0), childTicks(0), overlapCount(0) {}
+CallTreeNode::~CallTreeNode() {}
+
+CallTreeStats::CallTreeStats(int sectionId, char const* sectionName): sectionId(sectionId), sectionName(sectionName), count(0), inclusiveTime(0), exclusiveTime(0), overlapCount(0) {}
+CallTreeStats::~CallTreeStats() {
+    for (auto& child : children) {
+        delete child.second;
+    }
+}
+
+TimeRecordStop::TimeRecordStop(): sectionId(-1), ticksAtStart(0), elapsedTicks(0), threadIndex(-1), lineNumber(0), fileName("null"), functionName("null") {}
+TimeRecordStop::TimeRecordStop(int sectionId, int64_t elapsedTicks): sectionId(sectionId), ticksAtStart(0), elapsedTicks(elapsedTicks), threadIndex(-1), lineNumber(0), fileName("null"), functionName("null") {}
+TimeRecordStop::TimeRecordStop(int sectionId, int64_t ticksAtStart, int64_t elapsedTicks, int threadIndex, int lineNumber, const char* fileName, const char* functionName): sectionId(sectionId), ticksAtStart(ticksAtStart), elapsedTicks(elapsedTicks), threadIndex(threadIndex), lineNumber(lineNumber), fileName(fileName), functionName(functionName) {}
+TimeRecordStop::~TimeRecordStop() {}
+
+ProfilerStats::ProfilerStats(char const* sectionName): sectionName(sectionName), count(0), totalTime(0), minTime(DBL_MAX), maxTime(0), avgTime(0), stdDevTime(0), m2(0), p50Time(0), p90Time(0), p99Time(0), p999Time(0), correctedTotalTime(0), correctedMinTime(DBL_MAX), correctedMaxTime(0), correctedAvgTime(0), samples(0), selfSamples(0), sampleShare(0), instructionsPerCycle(0), allocations(0), allocatedBytes(0), peakLiveBytes(0), filename("null"), functionName("null"), lineNumber(0), timeline(std::vector<double>()) {
+    std::fill(counters, counters + PERF_COUNTER_COUNT, 0);
+}
+ProfilerStats::~ProfilerStats() {}
+
+void ProfilerStats::reset(char const* sectionName) {
+    std::vector<double> keptTimeline;
+    std::vector<int64_t> keptCalls;
+    keptTimeline.swap(timeline);
+    keptCalls.swap(timelineCalls);
+    *this = ProfilerStats(sectionName);
+    keptTimeline.clear();
+    keptCalls.clear();
+    timeline.swap(keptTimeline);
+    timelineCalls.swap(keptCalls);
+}
+
+SectionAccumulator::SectionAccumulator(int sectionId, char const* sectionName): sequence(0), sectionId(sectionId), sectionName(sectionName), count(0), totalTicks(0), minTicks(INT64_MAX), maxTicks(0), mean(0), m2(0), correctedTotalTicks(0), correctedMinTicks(INT64_MAX), correctedMaxTicks(0), allocations(0), allocatedBytes(0), peakLiveBytes(0), lineNumber(0), fileName("null"), functionName("null"), histogram(nullptr), timeline(nullptr), next(nullptr) {
+    std::fill(counterTotals, counterTotals + PERF_COUNTER_COUNT, 0);
+}
+SectionAccumulator::~SectionAccumulator() {
+    delete histogram;
+    delete timeline;
+}
+
+void SectionAccumulator::add(int64_t elapsedTicks, int64_t correctedTicks, int64_t const* counterDeltas, SectionAllocations const* allocations, int lineNumber, const char* fileName, const char* functionName) {
+    // An odd sequence tells readers an update is in progress
+    uint32_t seq = sequence.load(std::memory_order_relaxed);
+    sequence.store(seq + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+
+    count++;
+    totalTicks += elapsedTicks;
+    minTicks = std::min(minTicks, elapsedTicks);
+    maxTicks = std::max(maxTicks, elapsedTicks);
+
+    // Welford's online mean and variance
+    double delta = double(elapsedTicks) - mean;
+    mean += delta / count;
+    m2 += delta * (double(elapsedTicks) - mean);
+
+    correctedTotalTicks += correctedTicks;
+    correctedMinTicks = std::min(correctedMinTicks, correctedTicks);
+    correctedMaxTicks = std::max(correctedMaxTicks, correctedTicks);
+
+    if (counterDeltas != nullptr) {
+        for (int i = 0; i < PERF_COUNTER_COUNT; i++) {
+            counterTotals[i] += counterDeltas[i];
+        }
+    }
+    if (allocations != nullptr) {
+        this->allocations += allocations->allocations;
+        allocatedBytes += allocations->allocatedBytes;
+        peakLiveBytes = std::max(peakLiveBytes, allocations->peakLiveBytes);
+    }
+
+    this->lineNumber = lineNumber;
+    this->fileName = fileName;
+    this->functionName = functionName;
+
+    sequence.store(seq + 2, std::memory_order_release);
+}
+
+void SectionAccumulator::snapshot(SectionAccumulator& out) const {
+    while (true) {
+        uint32_t before = sequence.load(std::memory_order_acquire);
+        if (before & 1) {
+            continue;
+        }
+
+        out.sectionId = sectionId;
+        out.sectionName = sectionName;
+        out.count = count;
+        out.totalTicks = totalTicks;
+        out.minTicks = minTicks;
+        out.maxTicks = maxTicks;
+        out.mean = mean;
+        out.m2 = m2;
+        out.correctedTotalTicks = correctedTotalTicks;
+        out.correctedMinTicks = correctedMinTicks;
+        out.correctedMaxTicks = correctedMaxTicks;
+        std::copy(counterTotals, counterTotals + PERF_COUNTER_COUNT, out.counterTotals);
+        out.allocations = allocations;
+        out.allocatedBytes = allocatedBytes;
+        out.peakLiveBytes = peakLiveBytes;
+        out.lineNumber = lineNumber;
+        out.fileName = fileName;
+        out.functionName = functionName;
+
+        std::atomic_thread_fence(std::memory_order_acquire);
+        if (sequence.load(std::memory_order_relaxed) == before) {
+            return;
+        }
+    }
+}
+
+void SectionAccumulator::merge(SectionAccumulator const& other) {
+    if (other.count == 0) {
+        return;
+    }
+
+    // Chan et al.'s pairwise combination of mean and variance
+    int64_t combinedCount = count + other.count;
+    double delta = other.mean - mean;
+    mean += delta * other.count / combinedCount;
+    m2 += other.m2 + delta * delta * (double(count) * other.count / combinedCount);
+
+    count = combinedCount;
+    totalTicks += other.totalTicks;
+    minTicks = std::min(minTicks, other.minTicks);
+    maxTicks = std::max(maxTicks, other.maxTicks);
+    correctedTotalTicks += other.correctedTotalTicks;
+    correctedMinTicks = std::min(correctedMinTicks, other.correctedMinTicks);
+    correctedMaxTicks = std::max(correctedMaxTicks, other.correctedMaxTicks);
+    for (int i = 0; i < PERF_COUNTER_COUNT; i++) {
+        counterTotals[i] += other.counterTotals[i];
+    }
+    allocations += other.allocations;
+    allocatedBytes += other.allocatedBytes;
+    peakLiveBytes = std::max(peakLiveBytes, other.peakLiveBytes);
+    lineNumber = other.lineNumber;
+    fileName = other.fileName;
+    functionName = other.functionName;
+}
+
+SampledTimeline::SampledTimeline(size_t capacity): capacity(capacity < 2 ? 2 : capacity), stride(1), nextSample(1) {
+    calls.reserve(this->capacity);
+    ticks.reserve(this->capacity);
+}
+SampledTimeline::~SampledTimeline() {}
+
+void SampledTimeline::record(int64_t callNumber, int64_t cumulativeTicks) {
+    // Most calls fall between samples and return here without locking
+    if (callNumber < nextSample) {
+        return;
+    }
+
+    std::lock_guard<std::mutex> lock(mutex);
+    calls.push_back(callNumber);
+    ticks.push_back(cumulativeTicks);
+
+    if (calls.size() >= capacity) {
+        // Full. Keep only the points on multiples of the doubled stride.
+        stride *= 2;
+        size_t kept = 0;
+        for (size_t i = 0; i < calls.size(); i++) {
+            if (calls[i] % stride == 0) {
+                calls[kept] = calls[i];
+                ticks[kept] = ticks[i];
+                kept++;
+            }
+        }
+        calls.resize(kept);
+        ticks.resize(kept);
+    }
+    nextSample = (callNumber / stride + 1) * stride;
+}
+
+void SampledTimeline::copyTo(std::vector<int64_t>& calls, std::vector<double>& times) {
+    std::lock_guard<std::mutex> lock(mutex);
+    calls = this->calls;
+    times.resize(ticks.size());
+    for (size_t i = 0; i < ticks.size(); i++) {
+        times[i] = TicksToSeconds(ticks[i]);
+    }
+}
+
+SectionSamples::SectionSamples(): total(0), outside(0) {
+    for (int i = 0; i < MAX_SECTIONS; i++) {
+        open[i].store(0, std::memory_order_relaxed);
+        self[i].store(0, std::memory_order_relaxed);
+    }
+}
+
+ThreadSectionSlot::ThreadSectionSlot(): sectionName(nullptr), accumulator(nullptr) {}
+
+ProfilerThreadData::ProfilerThreadData(int threadIndex): threadIndex(threadIndex), functionGeneration(0), exitCount(0), probeCount(0), sampledDepth(0), samples(nullptr), perfCounters(nullptr), insideProbe(false), recordingSuspended(false), liveBytes(0), accumulators(nullptr), reportedEvents(0) {}
+ProfilerThreadData::~ProfilerThreadData() {
+    for (ThreadSectionSlot& slot : sections) {
+        delete slot.accumulator;
+    }
+    delete samples.load(std::memory_order_relaxed);
+    delete perfCounters;
+}
+
+SectionRegistry& SectionRegistry::Instance() {
+    // Never destroyed, so ids stay valid while other statics shut down
+    static SectionRegistry* registry = new SectionRegistry();
+    return *registry;
+}
+
+int SectionRegistry::Register(char const* sectionName) {
+    return Register(std::string(sectionName));
+}
+
+int SectionRegistry::Register(std::string const& sectionName) {
+    SectionRegistry& registry = Instance();
+    std::lock_guard<std::mutex> lock(registry.mutex);
+
+    auto found = registry.ids.find(sectionName);
+    if (found != registry.ids.end()) {
+        return found->second;
+    }
+
+    int sectionId = (int)registry.current.size();
+    registry.names.push_back(sectionName);
+    registry.current.push_back(registry.names.back().c_str());
+    registry.ids[sectionName] = sectionId;
+    return sectionId;
+}
+
+int SectionRegistry::Find(char const* sectionName) {
+    SectionRegistry& registry = Instance();
+    std::lock_guard<std::mutex> lock(registry.mutex);
+    auto found = registry.ids.find(sectionName);
+    return found != registry.ids.end() ? found->second : -1;
+}
+
+int SectionRegistry::RegisterDeferred(std::string const& placeholder, std::function<std::string()> resolve) {
+    int sectionId = Register(placeholder);
+    SectionRegistry& registry = Instance();
+    std::lock_guard<std::mutex> lock(registry.mutex);
+    registry.resolvers[sectionId] = std::move(resolve);
+    return sectionId;
+}
+
+char const* SectionRegistry::GetName(int sectionId) {
+    SectionRegistry& registry = Instance();
+    std::function<std::string()> resolve;
+    {
+        std::lock_guard<std::mutex> lock(registry.mutex);
+        auto found = registry.resolvers.find(sectionId);
+        if (found == registry.resolvers.end()) {
+            return registry.current.at(sectionId);
+        }
+        resolve = found->second;
+    }
+
+    // Resolving may be slow, so it runs without the lock; if two threads race,
+    // the first to finish wins
+    std::string name = resolve();
+    std::lock_guard<std::mutex> lock(registry.mutex);
+    if (registry.resolvers.erase(sectionId) > 0) {
+        std::string placeholder = registry.current[sectionId];
+        if (name != placeholder) {
+            if (registry.ids.count(name) > 0) {
+                name += " (" + placeholder + ")";
+            }
+            registry.names.push_back(name);
+            registry.current[sectionId] = registry.names.back().c_str();
+            registry.ids.emplace(name, sectionId);
+        }
+    }
+    return registry.current[sectionId];
+}
+
+char const* SectionRegistry::PeekName(int sectionId) {
+    SectionRegistry& registry = Instance();
+    std::lock_guard<std::mutex> lock(registry.mutex);
+    return registry.current.at(sectionId);
+}
+
+int SectionRegistry::GetCount() {
+    SectionRegistry& registry = Instance();
+    std::lock_guard<std::mutex> lock(registry.mutex);
+    return (int)registry.current.size();
+}
+
+SectionToken::SectionToken(): sectionId(-1), ticksAtStart(0), depth(-1), thread(nullptr) {}
+SectionToken::SectionToken(int sectionId, int64_t ticksAtStart, int depth, ProfilerThreadData* thread): sectionId(sectionId), ticksAtStart(ticksAtStart), depth(depth), thread(thread) {}
+
+ProfilerScopeObject::ProfilerScopeObject(char const* sectionName, int lineNumber, const char* fileName, const char* functionName): token(Profiler::GetInstance()->EnterSection(sectionName)), lineNumber(lineNumber), fileName(fileName), functionName(functionName) {}
+ProfilerScopeObject::ProfilerScopeObject(int sectionId, int lineNumber, const char* fileName, const char* functionName): token(Profiler::GetInstance()->EnterSection(sectionId)), lineNumber(lineNumber), fileName(fileName), functionName(functionName) {}
+
+ProfilerScopeObject::~ProfilerScopeObject() {
+    // Empty when made while recording was suspended
+    if (token.sectionId >= 0) {
+        Profiler::GetInstance()->ExitSection(token, lineNumber, fileName, functionName);
+    }
+}
+
+
+
+
+
+
+Profiler::Profiler(): callTree(-1, "") {
+    instanceId = gNextInstanceId.fetch_add(1);
+    statsEventCount = 0;
+    statsSampleCount = 0;
+    statsThreadCount = 0;
+    recentEventsPerThread = 0;
+    timelinePointsPerSection = 0;
+    traceEventsPerThread = 0;
+    samplesPerSecond = 0;
+    unregisteredSamples.store(0, std::memory_order_relaxed);
+    statsSampleCount = 0;
+    hardwareCounters = false;
+    trackingAllocations.store(false, std::memory_order_relaxed);
+    tracingFunctions.store(false, std::memory_order_relaxed);
+    functionGeneration.store(0, std::memory_order_relaxed);
+    measurementBiasTicks = 0;
+    probeOverheadTicks = 0;
+    loadedMeasurementBiasTicks = -1;
+    loadedProbeOverheadTicks = -1;
+    calibrateOverhead();
+
+}
+
+Profiler* Profiler::GetInstance() {
+    Profiler* profiler = gProfiler.load(std::memory_order_acquire);
+    if (profiler == nullptr) {
+        std::lock_guard<std::mutex> lock(gProfilerMutex);
+        profiler = gProfiler.load(std::memory_order_relaxed);
+        if (profiler == nullptr) {
+            // Only published once fully built, calibration included, so the
+            // fast path above and the hooks never see a half-built profiler
+            profiler = new Profiler();
+            gProfiler.store(profiler, std::memory_order_release);
+        }
+    }
+    return profiler;
+}
+
+Profiler::~Profiler() {
+    stopLiveStats();
+    stopWindows();
+    stopSampling();
+    traceWriter.close();
+    clearStats();
+    for (ProfilerThreadData* thread : threads) {
+        delete thread;
+    }
+
+    // Let GetInstance create a fresh profiler instead of returning a dangling one
+    Profiler* self = this;
+    gProfiler.compare_exchange_strong(self, nullptr);
+}
+
+ProfilerThreadData* Profiler::GetThreadData() {
+    if (tThreadData.instanceId == instanceId) {
+        return tThreadData.data;
+    }
+
+    // First section on this thread. Register it.
+    std::lock_guard<std::mutex> lock(threadsMutex);
+    ProfilerThreadData* data = new ProfilerThreadData((int)threads.size());
+    data->recentEvents.setCapacity(recentEventsPerThread);
+    if (traceEventsPerThread > 0) {
+        data->traceEvents.setCapacity(traceEventsPerThread);
+        traceWriter.addQueue(data->threadIndex, &data->traceEvents);
+    }
+    if (samplesPerSecond > 0) {
+        data->samples.store(new SectionSamples(), std::memory_order_release);
+    }
+    threads.push_back(data);
+
+    // The sample handler may run between these two. It trusts the data once the
+    // id matches, so the id goes last.
+    tThreadData.data = data;
+    std::atomic_signal_fence(std::memory_order_release);
+    tThreadData.instanceId = instanceId;
+    return data;
+}
+
+int Profiler::getThreadCount() {
+    std::lock_guard<std::mutex> lock(threadsMutex);
+    return (int)threads.size();
+}
+
+void Profiler::setMemoryLimits(size_t recentEventsPerThread, size_t timelinePointsPerSection) {
+    reset();
+
+    {
+        std::lock_guard<std::mutex> lock(threadsMutex);
+        this->recentEventsPerThread = recentEventsPerThread;
+        this->timelinePointsPerSection = timelinePointsPerSection;
+        for (ProfilerThreadData* thread : threads) {
+            thread->recentEvents.setCapacity(recentEventsPerThread);
+        }
+    }
+
+    // The exit path changed, so its cost did too
+    calibrateOverhead();
+}
+
+void Profiler::startTrace(const char* filename, size_t eventsPerThread) {
+    stopTrace();
+
+    // Calibrate with the trace queue in the exit path, so the file gets the costs
+    // its events were recorded with
+    traceEventsPerThread = eventsPerThread;
+    calibrateOverhead();
+    try {
+        traceWriter.open(filename, measurementBiasTicks, probeOverheadTicks);
+    } catch (...) {
+        traceEventsPerThread = 0;
+        calibrateOverhead();
+        throw;
+    }
+
+    std::lock_guard<std::mutex> lock(threadsMutex);
+    for (ProfilerThreadData* thread : threads) {
+        thread->traceEvents.setCapacity(traceEventsPerThread);
+        traceWriter.addQueue(thread->threadIndex, &thread->traceEvents);
+    }
+}
+
+void Profiler::stopTrace() {
+    if (!traceWriter.isOpen()) {
+        return;
+    }
+    traceWriter.close();
+
+    {
+        std::lock_guard<std::mutex> lock(threadsMutex);
+        traceEventsPerThread = 0;
+        for (ProfilerThreadData* thread : threads) {
+            thread->traceEvents.setCapacity(0);
+        }
+    }
+    calibrateOverhead();
+}
+
+bool Profiler::isTracing() {
+    return traceWriter.isOpen();
+}
+
+void Profiler::startSampling(int samplesPerSecond) {
+#if defined(PROFILER_HAS_SAMPLING)
+    if (samplesPerSecond <= 0) {
+        throw std::invalid_argument("startSampling needs a positive rate");
+    }
+    stopSampling();
+
+    {
+        std::lock_guard<std::mutex> lock(threadsMutex);
+        this->samplesPerSecond = samplesPerSecond;
+        for (ProfilerThreadData* thread : threads) {
+            if (thread->samples.load(std::memory_order_relaxed) == nullptr) {
+                thread->samples.store(new SectionSamples(), std::memory_order_release);
+            }
+        }
+    }
+
+    struct sigaction action;
+    std::memset(&action, 0, sizeof(action));
+    action.sa_handler = &Profiler::OnSampleSignal;
+    sigemptyset(&action.sa_mask);
+    action.sa_flags = SA_RESTART;
+    sigaction(SIGPROF, &action, &gPreviousSampleAction);
+
+    // ITIMER_PROF counts the process's CPU time and signals whichever thread
+    // is running when it expires
+    long intervalMicroseconds = std::max(1L, 1000000L / samplesPerSecond);
+    struct itimerval timer;
+    timer.it_interval.tv_sec = intervalMicroseconds / 1000000;
+    timer.it_interval.tv_usec = intervalMicroseconds % 1000000;
+    timer.it_value = timer.it_interval;
+    setitimer(ITIMER_PROF, &timer, nullptr);
+#else
+    throw std::runtime_error("Sampling needs SIGPROF, which this platform doesn't have");
+#endif
+}
+
+void Profiler::stopSampling() {
+#if defined(PROFILER_HAS_SAMPLING)
+    if (samplesPerSecond == 0) {
+        return;
+    }
+
+    struct itimerval timer;
+    std::memset(&timer, 0, sizeof(timer));
+    setitimer(ITIMER_PROF, &timer, nullptr);
+
+    // A signal already on its way would end the program under the default
+    // action, so in that case it is ignored instead
+    if (gPreviousSampleAction.sa_handler == SIG_DFL) {
+        gPreviousSampleAction.sa_handler = SIG_IGN;
+    }
+    sigaction(SIGPROF, &gPreviousSampleAction, nullptr);
+    samplesPerSecond = 0;
+#endif
+}
+
+bool Profiler::isSampling() {
+    return samplesPerSecond > 0;
+}
+
+int64_t Profiler::getSampleCount() {
+    int64_t count = unregisteredSamples.load(std::memory_order_relaxed);
+    std::lock_guard<std::mutex> lock(threadsMutex);
+    for (ProfilerThreadData* thread : threads) {
+        SectionSamples* samples = thread->samples.load(std::memory_order_acquire);
+        if (samples != nullptr) {
+            count += samples->total.load(std::memory_order_relaxed);
+        }
+    }
+    return count;
+}
+
+void Profiler::startLiveStats(int intervalMs) {
+    if (intervalMs <= 0) {
+        throw std::invalid_argument("startLiveStats needs a positive interval");
+    }
+    liveStatsWriter.open(intervalMs, [this](std::vector<LiveSectionStats>& sections, uint32_t& threadCount) {
+        collectLiveStats(sections, threadCount);
+    });
+}
+
+void Profiler::stopLiveStats() {
+    liveStatsWriter.close();
+}
+
+bool Profiler::isPublishingLiveStats() {
+    return liveStatsWriter.isOpen();
+}
+
+void Profiler::collectLiveStats(std::vector<LiveSectionStats>& sections, uint32_t& threadCount) {
+    // Totals and histograms combined over all threads, as in calculateStats
+    std::map<int, SectionAccumulator> combined;
+    std::map<int, std::unique_ptr<LatencyHistogram>> combinedHistograms;
+    {
+        std::lock_guard<std::mutex> lock(threadsMutex);
+        threadCount = (uint32_t)threads.size();
+        for (ProfilerThreadData* thread : threads) {
+            for (SectionAccumulator* accumulator = thread->accumulators.load(std::memory_order_acquire); accumulator != nullptr; accumulator = accumulator->next.load(std::memory_order_relaxed)) {
+                SectionAccumulator totals(accumulator->sectionId, accumulator->sectionName);
+                accumulator->snapshot(totals);
+
+                auto found = combined.find(totals.sectionId);
+                if (found == combined.end()) {
+                    found = combined.emplace(std::piecewise_construct, std::forward_as_tuple(totals.sectionId), std::forward_as_tuple(totals.sectionId, totals.sectionName)).first;
+                }
+                found->second.merge(totals);
+
+                std::unique_ptr<LatencyHistogram>& histogram = combinedHistograms[totals.sectionId];
+                if (!histogram) {
+                    histogram.reset(new LatencyHistogram());
+                }
+                histogram->merge(*accumulator->histogram);
+            }
+        }
+    }
+
+    for (auto& total : combined) {
+        SectionAccumulator const& totals = total.second;
+        LatencyHistogram const& histogram = *combinedHistograms[total.first];
+        LiveSectionStats section;
+        std::memset(&section, 0, sizeof(section));
+        std::strncpy(section.name, SectionRegistry::GetName(total.first), LIVE_SECTION_NAME_LENGTH - 1);
+        section.count = totals.count;
+        section.totalTime = TicksToSeconds(totals.totalTicks);
+        section.avgTime = totals.mean * TicksToSeconds(1);
+        section.maxTime = TicksToSeconds(totals.maxTicks);
+        section.p50Time = histogram.getPercentile(50) * 1e-9;
+        section.p90Time = histogram.getPercentile(90) * 1e-9;
+        section.p99Time = histogram.getPercentile(99) * 1e-9;
+        section.p999Time = histogram.getPercentile(99.9) * 1e-9;
+        sections.push_back(section);
+    }
+}
+
+void Profiler::startWindows(double windowSeconds, size_t windowCount) {
+    if (windowSeconds <= 0 || windowCount == 0) {
+        throw std::invalid_argument("startWindows needs a positive window length and count");
+    }
+    windowRoller.open(windowSeconds, windowCount, [this](std::vector<WindowTotals>& totals) {
+        collectWindowTotals(totals);
+    });
+}
+
+void Profiler::stopWindows() {
+    windowRoller.close();
+}
+
+bool Profiler::isRecordingWindows() {
+    return windowRoller.isOpen();
+}
+
+std::vector<StatsWindow> Profiler::getWindows() {
+    return windowRoller.getWindows();
+}
+
+void Profiler::collectWindowTotals(std::vector<WindowTotals>& totals) {
+    // Added up over the threads first, so the roller keeps and diffs one set
+    // of totals per section, with only the buckets that have calls
+    std::map<int, WindowTotals> sections;
+    std::map<int, std::map<int, uint64_t>> sectionBuckets;
+    {
+        std::lock_guard<std::mutex> lock(threadsMutex);
+        for (ProfilerThreadData* thread : threads) {
+            for (SectionAccumulator* accumulator = thread->accumulators.load(std::memory_order_acquire); accumulator != nullptr; accumulator = accumulator->next.load(std::memory_order_relaxed)) {
+                SectionAccumulator snapshot(accumulator->sectionId, accumulator->sectionName);
+                accumulator->snapshot(snapshot);
+
+                WindowTotals& total = sections[snapshot.sectionId];
+                total.sectionId = snapshot.sectionId;
+                total.count += snapshot.count;
+                total.totalTicks += snapshot.totalTicks;
+                total.maxTicks = std::max(total.maxTicks, snapshot.maxTicks);
+                std::map<int, uint64_t>& buckets = sectionBuckets[snapshot.sectionId];
+                for (int i = 0; i < LatencyHistogram::BUCKET_COUNT; i++) {
+                    uint64_t count = accumulator->histogram->getBucketCount(i);
+                    if (count > 0) {
+                        buckets[i] += count;
+                    }
+                }
+            }
+        }
+    }
+
+    for (auto& section : sections) {
+        std::map<int, uint64_t> const& buckets = sectionBuckets[section.first];
+        section.second.buckets.assign(buckets.begin(), buckets.end());
+        totals.push_back(std::move(section.second));
+    }
+}
+
+bool Profiler::enableHardwareCounters() {
+    // Try on this thread first, so a denied kernel leaves everything as it was
+    PerfCounters probe;
+    if (!probe.open()) {
+        return false;
+    }
+    probe.close();
+
+    hardwareCounters = true;
+    // Reading the counters is part of every probe now
+    calibrateOverhead();
+    return true;
+}
+
+void Profiler::disableHardwareCounters() {
+    if (!hardwareCounters) {
+        return;
+    }
+    hardwareCounters = false;
+
+    {
+        std::lock_guard<std::mutex> lock(threadsMutex);
+        for (ProfilerThreadData* thread : threads) {
+            delete thread->perfCounters;
+            thread->perfCounters = nullptr;
+        }
+    }
+    calibrateOverhead();
+}
+
+bool Profiler::isUsingHardwareCounters() {
+    return hardwareCounters;
+}
+
+bool Profiler::startAllocationTracking() {
+    if (!HasAllocationHooks()) {
+        return false;
+    }
+    {
+        std::lock_guard<std::mutex> lock(threadsMutex);
+        for (ProfilerThreadData* thread : threads) {
+            thread->liveBytes = 0;
+        }
+    }
+    trackingAllocations.store(true, std::memory_order_relaxed);
+    calibrateOverhead();
+    return true;
+}
+
+void Profiler::stopAllocationTracking() {
+    if (!trackingAllocations.load(std::memory_order_relaxed)) {
+        return;
+    }
+    trackingAllocations.store(false, std::memory_order_relaxed);
+    calibrateOverhead();
+}
+
+bool Profiler::isTrackingAllocations() {
+    return trackingAllocations.load(std::memory_order_relaxed);
+}
+
+ProfilerThreadData* Profiler::FindThreadData() {
+    Profiler* profiler = gProfiler.load(std::memory_order_acquire);
+    if (profiler == nullptr || tThreadData.instanceId != profiler->instanceId) {
+        return nullptr;
+    }
+    return tThreadData.data;
+}
+
+bool Profiler::OnAllocation(size_t size) {
+    Profiler* profiler = gProfiler.load(std::memory_order_acquire);
+    if (profiler == nullptr || !profiler->trackingAllocations.load(std::memory_order_relaxed)) {
+        return false;
+    }
+    ProfilerThreadData* thread = FindThreadData();
+    if (thread == nullptr || thread->insideProbe || thread->activeSections.empty()) {
+        return false;
+    }
+
+    TimeRecordStart& innermost = thread->activeSections.back();
+    innermost.allocations++;
+    innermost.allocatedBytes += (int64_t)size;
+    thread->liveBytes += (int64_t)size;
+    innermost.peakLiveBytes = std::max(innermost.peakLiveBytes, thread->liveBytes);
+    return true;
+}
+
+void Profiler::OnDeallocation(size_t size) {
+    ProfilerThreadData* thread = FindThreadData();
+    if (thread != nullptr) {
+        thread->liveBytes -= (int64_t)size;
+    }
+}
+
+void Profiler::startFunctionTracing() {
+    tracingFunctions.store(true, std::memory_order_relaxed);
+}
+
+void Profiler::stopFunctionTracing() {
+    tracingFunctions.store(false, std::memory_order_relaxed);
+}
+
+bool Profiler::isTracingFunctions() {
+    return tracingFunctions.load(std::memory_order_relaxed);
+}
+
+void Profiler::setFunctionFilters(std::vector<std::string> const& include, std::vector<std::string> const& exclude) {
+    std::lock_guard<std::mutex> lock(functionMutex);
+    functionIncludes = include;
+    functionExcludes = exclude;
+    // Decide every function again. Sections already registered stay.
+    functionSectionIds.clear();
+    functionGeneration.fetch_add(1, std::memory_order_release);
+}
+
+int Profiler::getFunctionSectionId(void const* function) {
+    std::lock_guard<std::mutex> lock(functionMutex);
+    auto found = functionSectionIds.find(function);
+    if (found != functionSectionIds.end()) {
+        return found->second;
+    }
+
+    char placeholder[32];
+    std::snprintf(placeholder, sizeof(placeholder), "%p", function);
+    int sectionId;
+    if (functionIncludes.empty() && functionExcludes.empty()) {
+        // Named when a report asks, so the probes never read a symbol table
+        sectionId = SectionRegistry::RegisterDeferred(placeholder, [function]() {
+            return SymbolizeAddress(function);
+        });
+    } else {
+        std::string name = SymbolizeAddress(function);
+        if (name.empty()) {
+            name = placeholder;
+        }
+        bool included = functionIncludes.empty();
+        for (std::string const& pattern : functionIncludes) {
+            included = included || MatchesPattern(name.c_str(), pattern.c_str());
+        }
+        for (std::string const& pattern : functionExcludes) {
+            included = included && !MatchesPattern(name.c_str(), pattern.c_str());
+        }
+        sectionId = included ? SectionRegistry::Register(name) : -1;
+    }
+    functionSectionIds[function] = sectionId;
+    return sectionId;
+}
+
+void Profiler::OnFunctionEnter(void* function) {
+    Profiler* profiler = gProfiler.load(std::memory_order_acquire);
+    if (profiler == nullptr) {
+        return;
+    }
+    if (!profiler->tracingFunctions.load(std::memory_order_relaxed)) {
+        // Functions traced earlier may still be open. Calls made under them
+        // are kept as untimed entries, so their exits pair up with them and
+        // not with a traced function.
+        ProfilerThreadData* thread = FindThreadData();
+        if (thread != nullptr && !thread->insideProbe && !thread->openFunctions.empty()) {
+            thread->insideProbe = true;
+            thread->openFunctions.push_back(std::make_pair(function, -1));
+            thread->insideProbe = false;
+        }
+        return;
+    }
+    ProfilerThreadData* thread = profiler->GetThreadData();
+    // Functions the profiler calls itself, if they were instrumented too
+    if (thread->insideProbe) {
+        return;
+    }
+
+    // The lookups may allocate, which the allocation hooks mustn't count
+    thread->insideProbe = true;
+    uint64_t generation = profiler->functionGeneration.load(std::memory_order_acquire);
+    if (thread->functionGeneration != generation) {
+        thread->functionIds.clear();
+        thread->functionGeneration = generation;
+    }
+    int sectionId;
+    auto found = thread->functionIds.find(function);
+    if (thread->recordingSuspended) {
+        // Kept untimed, so its exit still pairs up with it
+        sectionId = -1;
+    } else if (found != thread->functionIds.end()) {
+        sectionId = found->second;
+    } else {
+        sectionId = profiler->getFunctionSectionId(function);
+        thread->functionIds[function] = sectionId;
+    }
+    thread->openFunctions.push_back(std::make_pair(function, sectionId));
+    thread->insideProbe = false;
+
+    if (sectionId >= 0) {
+        profiler->enterSection(thread, sectionId);
+    }
+}
+
+void Profiler::OnFunctionExit(void* function) {
+    int64_t ticksAtStop = GetCurrentTicks();
+    Profiler* profiler = gProfiler.load(std::memory_order_acquire);
+    ProfilerThreadData* thread = FindThreadData();
+    // Carries on after tracing stops, so every function entered gets its exit.
+    // Functions entered before tracing started, e.g. startFunctionTracing
+    // itself, don't match the innermost open function and are skipped.
+    if (profiler == nullptr || thread == nullptr || thread->insideProbe || thread->openFunctions.empty() || thread->openFunctions.back().first != function) {
+        return;
+    }
+    int sectionId = thread->openFunctions.back().second;
+    thread->openFunctions.pop_back();
+    if (sectionId >= 0) {
+        // The hooks only get the function's address, so neither the enter nor
+        // the exit has a source location. It stays at the "null" an unknown
+        // location gets everywhere else; the section name says which function.
+        profiler->exitSection(thread, sectionId, ticksAtStop, 0, "null", "null");
+    }
+}
+
+void Profiler::OnSampleSignal(int signal) {
+    (void)signal;
+    Profiler* profiler = gProfiler.load(std::memory_order_acquire);
+    if (profiler == nullptr) {
+        return;
+    }
+    if (tThreadData.instanceId != profiler->instanceId) {
+        profiler->unregisteredSamples.fetch_add(1, std::memory_order_relaxed);
+        return;
+    }
+    std::atomic_signal_fence(std::memory_order_acquire);
+    ProfilerThreadData* thread = tThreadData.data;
+    SectionSamples* samples = thread->samples.load(std::memory_order_acquire);
+    if (samples == nullptr) {
+        return;
+    }
+
+    samples->total.fetch_add(1, std::memory_order_relaxed);
+    int depth = thread->sampledDepth.load(std::memory_order_relaxed);
+    std::atomic_signal_fence(std::memory_order_acquire);
+    if (depth == 0) {
+        samples->outside.fetch_add(1, std::memory_order_relaxed);
+        return;
+    }
+
+    int sampledDepth = std::min(depth, (int)ProfilerThreadData::MAX_SAMPLED_DEPTH);
+    for (int i = 0; i < sampledDepth; i++) {
+        int sectionId = thread->sampledStack[i];
+        if (sectionId >= SectionSamples::MAX_SECTIONS) {
+            continue;
+        }
+        // A section open more than once, like a recursive call, counts once
+        bool counted = false;
+        for (int below = 0; below < i && !counted; below++) {
+            counted = thread->sampledStack[below] == sectionId;
+        }
+        if (!counted) {
+            samples->open[sectionId].fetch_add(1, std::memory_order_relaxed);
+        }
+    }
+
+    // The innermost section is only known if the stack fit
+    int innermost = thread->sampledStack[sampledDepth - 1];
+    if (depth <= ProfilerThreadData::MAX_SAMPLED_DEPTH && innermost < SectionSamples::MAX_SECTIONS) {
+        samples->self[innermost].fetch_add(1, std::memory_order_relaxed);
+    }
+}
+
+void Profiler::syncSampledStack(ProfilerThreadData* thread, size_t from) {
+    std::vector<TimeRecordStart> const& active = thread->activeSections;
+
+    // Hide the entries being rewritten from the handler until they are done
+    thread->sampledDepth.store((int)from, std::memory_order_relaxed);
+    std::atomic_signal_fence(std::memory_order_seq_cst);
+    for (size_t i = from; i < active.size() && i < ProfilerThreadData::MAX_SAMPLED_DEPTH; i++) {
+        thread->sampledStack[i] = active[i].sectionId;
+    }
+    std::atomic_signal_fence(std::memory_order_seq_cst);
+    thread->sampledDepth.store((int)active.size(), std::memory_order_relaxed);
+}
+
+void Profiler::loadTrace(const char* filename) {
+    TraceReader reader;
+    reader.open(filename);
+
+    // Ticks from another clock are rescaled to this one
+    double scale = GetTicksPerSecond() / reader.header.ticksPerSecond;
+    loadedMeasurementBiasTicks = std::max<int64_t>(loadedMeasurementBiasTicks, std::llround(reader.header.measurementBiasTicks * scale));
+    loadedProbeOverheadTicks = std::max<int64_t>(loadedProbeOverheadTicks, std::llround(reader.header.probeOverheadTicks * scale));
+
+    // Trace ids to this process's ids and names, filled in as they show up
+    std::vector<int> sectionIds;
+    std::vector<std::pair<const char*, const char*>> locations;
+    std::vector<ProfilerThreadData*> traceThreads;
+
+    std::lock_guard<std::mutex> lock(threadsMutex);
+    TraceRecord record;
+    while (reader.next(record)) {
+        if (record.sectionId >= sectionIds.size()) {
+            sectionIds.resize(record.sectionId + 1, -1);
+        }
+        if (sectionIds[record.sectionId] < 0) {
+            sectionIds[record.sectionId] = RegisterSection(reader.getSectionName(record.sectionId));
+        }
+
+        if (record.locationId >= locations.size()) {
+            locations.resize(record.locationId + 1, std::make_pair(nullptr, nullptr));
+        }
+        if (locations[record.locationId].first == nullptr) {
+            loadedNames.push_back(reader.getFileName(record.locationId));
+            char const* fileName = loadedNames.back().c_str();
+            loadedNames.push_back(reader.getFunctionName(record.locationId));
+            char const* functionName = loadedNames.back().c_str();
+            locations[record.locationId] = std::make_pair(fileName, functionName);
+        }
+
+        if (record.threadIndex >= traceThreads.size()) {
+            traceThreads.resize(record.threadIndex + 1, nullptr);
+        }
+        ProfilerThreadData*& thread = traceThreads[record.threadIndex];
+        if (thread == nullptr) {
+            thread = new ProfilerThreadData((int)threads.size());
+            thread->recentEvents.setCapacity(recentEventsPerThread);
+            threads.push_back(thread);
+        }
+
+        int sectionId = sectionIds[record.sectionId];
+        // Start times keep their offset from the traced program's start
+        int64_t ticksAtStart = GetStartTicks() + std::llround((record.ticksAtStart - reader.header.startTicks) * scale);
+        recordExit(thread, sectionId, GetSlot(thread, sectionId), ticksAtStart, std::llround(record.elapsedTicks * scale), std::llround(record.correctedTicks * scale), nullptr, nullptr, reader.getLineNumber(record.locationId), locations[record.locationId].first, locations[record.locationId].second);
+    }
+
+    if (!reader.complete) {
+        std::cerr << "Warning: " << filename << " was cut short, loaded the events up to its last complete entry" << std::endl;
+    } else if (reader.droppedEvents > 0) {
+        std::cerr << "Warning: " << filename << " is missing " << reader.droppedEvents << " events the trace writer fell too far behind to keep" << std::endl;
+    }
+}
+
+StatsSnapshot Profiler::getSnapshot() {
+    calculateStats();
+
+    StatsSnapshot snapshot;
+    snapshot.processCount = 1;
+    snapshot.sampleCount = statsSampleCount;
+    snapshot.measurementBiasNanoseconds = getReportedMeasurementBias() * 1e9;
+    snapshot.probeOverheadNanoseconds = getReportedProbeOverhead() * 1e9;
+    for (auto& stat : stats) {
+        ProfilerStats* stat_ = stat.second;
+        if (stat_->count == 0) {
+            continue;
+        }
+        SnapshotSection& section = snapshot.sections[stat_->sectionName];
+        section.fileName = stat_->filename;
+        section.functionName = stat_->functionName;
+        section.lineNumber = stat_->lineNumber;
+        section.count = stat_->count;
+        section.totalNanoseconds = std::llround(stat_->totalTime * 1e9);
+        section.minNanoseconds = std::llround(stat_->minTime * 1e9);
+        section.maxNanoseconds = std::llround(stat_->maxTime * 1e9);
+        section.mean = stat_->avgTime * 1e9;
+        section.m2 = stat_->m2 * 1e18;
+        section.correctedTotalNanoseconds = std::llround(stat_->correctedTotalTime * 1e9);
+        section.correctedMinNanoseconds = std::llround(stat_->correctedMinTime * 1e9);
+        section.correctedMaxNanoseconds = std::llround(stat_->correctedMaxTime * 1e9);
+        std::copy(stat_->counters, stat_->counters + PERF_COUNTER_COUNT, section.counterTotals);
+        section.allocations = stat_->allocations;
+        section.allocatedBytes = stat_->allocatedBytes;
+        section.peakLiveBytes = stat_->peakLiveBytes;
+        section.samples = stat_->samples;
+        section.selfSamples = stat_->selfSamples;
+        if (stat_->histogram) {
+            section.histogram.resize(LatencyHistogram::BUCKET_COUNT);
+            for (int i = 0; i < LatencyHistogram::BUCKET_COUNT; i++) {
+                section.histogram[i] = stat_->histogram->getBucketCount(i);
+            }
+        }
+    }
+    return snapshot;
+}
+
+void Profiler::saveSnapshot(const char* filename) {
+    getSnapshot().save(filename);
+}
+
+void Profiler::loadSnapshot(const char* filename) {
+    StatsSnapshot snapshot;
+    snapshot.load(filename);
+    loadSnapshot(snapshot);
+}
+
+void Profiler::loadSnapshot(StatsSnapshot const& snapshot) {
+    // Nanoseconds to this process's ticks
+    double scale = GetTicksPerSecond() * 1e-9;
+    loadedMeasurementBiasTicks = std::max<int64_t>(loadedMeasurementBiasTicks, std::llround(snapshot.measurementBiasNanoseconds * scale));
+    loadedProbeOverheadTicks = std::max<int64_t>(loadedProbeOverheadTicks, std::llround(snapshot.probeOverheadNanoseconds * scale));
+
+    std::lock_guard<std::mutex> lock(threadsMutex);
+    ProfilerThreadData* thread = new ProfilerThreadData((int)threads.size());
+    thread->recentEvents.setCapacity(recentEventsPerThread);
+    threads.push_back(thread);
+    SectionSamples* samples = nullptr;
+    if (snapshot.sampleCount > 0) {
+        samples = new SectionSamples();
+        samples->total.store(snapshot.sampleCount, std::memory_order_relaxed);
+        thread->samples.store(samples, std::memory_order_release);
+    }
+
+    // The totals go straight into one accumulator per section, as if the
+    // thread had recorded every call
+    int64_t calls = 0;
+    for (auto const& entry : snapshot.sections) {
+        SnapshotSection const& section = entry.second;
+        if (section.count == 0) {
+            continue;
+        }
+        int sectionId = RegisterSection(entry.first);
+        ThreadSectionSlot& slot = GetSlot(thread, sectionId);
+        SectionAccumulator* accumulator = new SectionAccumulator(sectionId, slot.sectionName);
+        accumulator->histogram = new LatencyHistogram();
+
+        loadedNames.push_back(section.fileName);
+        accumulator->fileName = loadedNames.back().c_str();
+        loadedNames.push_back(section.functionName);
+        accumulator->functionName = loadedNames.back().c_str();
+        accumulator->lineNumber = section.lineNumber;
+        accumulator->count = section.count;
+        accumulator->totalTicks = std::llround(section.totalNanoseconds * scale);
+        accumulator->minTicks = std::llround(section.minNanoseconds * scale);
+        accumulator->maxTicks = std::llround(section.maxNanoseconds * scale);
+        accumulator->mean = section.mean * scale;
+        accumulator->m2 = section.m2 * scale * scale;
+        accumulator->correctedTotalTicks = std::llround(section.correctedTotalNanoseconds * scale);
+        accumulator->correctedMinTicks = std::llround(section.correctedMinNanoseconds * scale);
+        accumulator->correctedMaxTicks = std::llround(section.correctedMaxNanoseconds * scale);
+        std::copy(section.counterTotals, section.counterTotals + PERF_COUNTER_COUNT, accumulator->counterTotals);
+        accumulator->allocations = section.allocations;
+        accumulator->allocatedBytes = section.allocatedBytes;
+        accumulator->peakLiveBytes = section.peakLiveBytes;
+        for (size_t i = 0; i < section.histogram.size(); i++) {
+            if (section.histogram[i] > 0) {
+                accumulator->histogram->recordCount((int)i, section.histogram[i]);
+            }
+        }
+        if (samples != nullptr && sectionId < SectionSamples::MAX_SECTIONS) {
+            samples->open[sectionId].store(section.samples, std::memory_order_relaxed);
+            samples->self[sectionId].store(section.selfSamples, std::memory_order_relaxed);
+        }
+
+        accumulator->next.store(thread->accumulators.load(std::memory_order_relaxed), std::memory_order_relaxed);
+        thread->accumulators.store(accumulator, std::memory_order_release);
+        slot.accumulator = accumulator;
+        calls += section.count;
+    }
+    thread->exitCount.store((size_t)calls, std::memory_order_release);
+}
+
+void Profiler::calibrateOverhead() {
+    constexpr int WARMUP_PAIRS = 1000;
+    constexpr int ROUNDS = 20;
+    constexpr int PAIRS_PER_ROUND = 1000;
+
+    // A scratch thread that is never registered, so calibration leaves no stats
+    // behind. It goes through the same code as a real probe in the current mode.
+    ProfilerThreadData scratch(-1);
+    scratch.recentEvents.setCapacity(recentEventsPerThread);
+    scratch.traceEvents.setCapacity(traceEventsPerThread);
+    int sectionId = RegisterSection("Profiler Overhead Calibration");
+    measurementBiasTicks = 0;
+    probeOverheadTicks = 0;
+
+    for (int i = 0; i < WARMUP_PAIRS; i++) {
+        enterSection(&scratch, sectionId);
+        exitSection(&scratch, sectionId, GetCurrentTicks(), 0, "null", "null");
+    }
+    // Nothing drains the scratch thread's trace queue, so empty it by hand
+    scratch.traceEvents.drain([](TraceEvent const&) {});
+
+    // The fastest round is the one least disturbed by interrupts and migrations
+    int64_t bestRoundTicks = INT64_MAX;
+    for (int round = 0; round < ROUNDS; round++) {
+        int64_t roundStart = GetCurrentTicks();
+        for (int i = 0; i < PAIRS_PER_ROUND; i++) {
+            enterSection(&scratch, sectionId);
+            exitSection(&scratch, sectionId, GetCurrentTicks(), 0, "null", "null");
+        }
+        bestRoundTicks = std::min(bestRoundTicks, GetCurrentTicks() - roundStart);
+        scratch.traceEvents.drain([](TraceEvent const&) {});
+    }
+    int64_t pairTicks = bestRoundTicks / PAIRS_PER_ROUND;
+
+    // What an empty section reads is the median of what the pairs above measured
+    double biasNanoseconds = scratch.sections[sectionId].accumulator->histogram->getPercentile(50);
+    measurementBiasTicks = std::min(pairTicks, (int64_t)(biasNanoseconds * 1e-9 * GetTicksPerSecond()));
+    probeOverheadTicks = pairTicks;
+}
+
+double Profiler::getMeasurementBias() {
+    return TicksToSeconds(measurementBiasTicks);
+}
+
+double Profiler::getProbeOverhead() {
+    return TicksToSeconds(probeOverheadTicks);
+}
+
+double Profiler::getReportedMeasurementBias() {
+    return TicksToSeconds(loadedMeasurementBiasTicks >= 0 ? loadedMeasurementBiasTicks : measurementBiasTicks);
+}
+
+double Profiler::getReportedProbeOverhead() {
+    return TicksToSeconds(loadedProbeOverheadTicks >= 0 ? loadedProbeOverheadTicks : probeOverheadTicks);
+}
 
-ProfilerStats::ProfilerStats(char const* sectionName): sectionName(sectionName), count(0), totalTime(0), minTime(DBL_MAX), maxTime(0), avgTime(0), filename("null"), functionName("null"), lineNumber(0), timeline(std::vector<double>()) {}
-ProfilerStats::~ProfilerStats() {}
+bool Profiler::isMemoryBounded() {
+    return recentEventsPerThread > 0 || timelinePointsPerSection > 0;
+}
+
+template <typename Fn>
+void Profiler::forEachEvent(Fn&& fn) {
+    std::lock_guard<std::mutex> lock(threadsMutex);
+    for (ProfilerThreadData* thread : threads) {
+        if (isMemoryBounded()) {
+            thread->recentEvents.forEach(fn);
+        } else {
+            thread->elapsedTimes.forEach(fn);
+        }
+    }
+}
 
-ProfilerScopeObject::ProfilerScopeObject(char const* sectionName) {
-    Profiler::GetInstance()->EnterSection(sectionName);
-    this->sectionName = sectionName;
+std::vector<TimeRecordStop> Profiler::getRecentEvents() {
+    std::vector<TimeRecordStop> events;
+    forEachEvent([&](TimeRecordStop const& event) {
+        events.push_back(event);
+    });
+    return events;
 }
 
-ProfilerScopeObject::~ProfilerScopeObject() {
-    Profiler::GetInstance()->ExitSection(sectionName);
+int Profiler::RegisterSection(char const* sectionName) {
+    // Interning the name is the profiler's own heap use
+    ProfilerThreadData* thread = FindThreadData();
+    if (thread != nullptr) {
+        thread->insideProbe = true;
+    }
+    int sectionId = SectionRegistry::Register(sectionName);
+    if (thread != nullptr) {
+        thread->insideProbe = false;
+    }
+    return sectionId;
+}
+
+int Profiler::RegisterSection(std::string const& sectionName) {
+    ProfilerThreadData* thread = FindThreadData();
+    if (thread != nullptr) {
+        thread->insideProbe = true;
+    }
+    int sectionId = SectionRegistry::Register(sectionName);
+    if (thread != nullptr) {
+        thread->insideProbe = false;
+    }
+    return sectionId;
+}
+
+int Profiler::GetSectionId(ProfilerThreadData* thread, char const* sectionName) {
+    auto found = thread->sectionIdsByPointer.find(sectionName);
+    if (found != thread->sectionIdsByPointer.end()) {
+        return found->second;
+    }
+    thread->insideProbe = true;
+    int sectionId = SectionRegistry::Register(sectionName);
+    thread->sectionIdsByPointer[sectionName] = sectionId;
+    thread->insideProbe = false;
+    return sectionId;
+}
+
+ThreadSectionSlot& Profiler::GetSlot(ProfilerThreadData* thread, int sectionId) {
+    if (sectionId >= (int)thread->sections.size()) {
+        thread->sections.resize(sectionId + 1);
+    }
+    ThreadSectionSlot& slot = thread->sections[sectionId];
+    if (slot.sectionName == nullptr) {
+        slot.sectionName = SectionRegistry::PeekName(sectionId);
+    }
+    return slot;
 }
 
+SectionToken Profiler::EnterSection(int sectionId) {
+    ProfilerThreadData* thread = GetThreadData();
+    if (thread->recordingSuspended) {
+        return SectionToken();
+    }
+    return enterSection(thread, sectionId);
+}
 
+SectionToken Profiler::enterSection(ProfilerThreadData* thread, int sectionId) {
+    thread->insideProbe = true;
 
+    // Where this activation sits in the call tree
+    int parentIndex = thread->activeSections.empty() ? -1 : thread->activeSections.back().callTreeNode;
+    int nodeIndex = GetCallTreeNode(thread, parentIndex, sectionId);
 
+    // Publish the section to the sample handler
+    int depth = (int)thread->activeSections.size();
+    if (depth < ProfilerThreadData::MAX_SAMPLED_DEPTH) {
+        thread->sampledStack[depth] = sectionId;
+    }
+    std::atomic_signal_fence(std::memory_order_release);
+    thread->sampledDepth.store(depth + 1, std::memory_order_relaxed);
 
+    // The counters are read outside the clock reads, so they don't count the
+    // clock, and the same way round on exit
+    int64_t counters[PERF_COUNTER_COUNT];
+    if (hardwareCounters) {
+        if (thread->perfCounters == nullptr) {
+            // Counters only count the thread that opened them. If this thread
+            // can't open any, it reads zeros.
+            thread->perfCounters = new PerfCounters();
+            thread->perfCounters->open();
+        }
+        thread->perfCounters->read(counters);
+    }
 
-Profiler::Profiler() {
-    gProfiler = this;
+    int64_t ticksAtStart = GetCurrentTicks();
 
-    // startTimes.reserve(100);
-    // elapsedTimes.reserve(1000000);
+    thread->activeSections.emplace_back(sectionId, ticksAtStart, thread->probeCount, nodeIndex, thread->liveBytes);
+    if (hardwareCounters) {
+        std::copy(counters, counters + PERF_COUNTER_COUNT, thread->activeSections.back().countersAtStart);
+    }
+    thread->insideProbe = false;
+    return SectionToken(sectionId, ticksAtStart, depth, thread);
 }
 
-Profiler* Profiler::GetInstance() {
-    if (gProfiler == nullptr) {
-        gProfiler = new Profiler();
+SectionToken Profiler::EnterAsyncSection(int sectionId) {
+    return SectionToken(sectionId, GetCurrentTicks(), -1, nullptr);
+}
+
+int Profiler::GetCallTreeNode(ProfilerThreadData* thread, int parentIndex, int sectionId) {
+    std::vector<std::pair<int, int>>& children = parentIndex < 0 ? thread->callTreeRoots : thread->callTreeNodes[parentIndex]->children;
+    for (std::pair<int, int> const& child : children) {
+        if (child.first == sectionId) {
+            return child.second;
+        }
     }
-    return gProfiler;
+
+    // First time this section runs under this parent
+    int nodeIndex = (int)thread->callTreeNodes.size();
+    thread->callTreeNodes.push_back(&thread->callTree.emplace_back(sectionId, parentIndex));
+    children.emplace_back(sectionId, nodeIndex);
+    return nodeIndex;
 }
 
-Profiler::~Profiler() {
-    for (auto& stat : stats) {
-        delete stat.second;
+void Profiler::ExitSection(int sectionId) {
+    ExitSection(sectionId, 0, "null", "null");
+}
+
+void Profiler::ExitSection(int sectionId, int lineNumber, const char* fileName, const char* functionName) {
+    int64_t ticksAtStop = GetCurrentTicks();
+    ProfilerThreadData* thread = GetThreadData();
+    if (thread->recordingSuspended) {
+        return;
     }
+    exitSection(thread, sectionId, ticksAtStop, lineNumber, fileName, functionName);
+}
+
+void Profiler::ExitSection(SectionToken const& token) {
+    ExitSection(token, 0, "null", "null");
 }
 
-void Profiler::EnterSection(char const* sectionName) {
-    // Does the map contain the sectionName?
-    if (startTimes.find(sectionName) == startTimes.end()) {
-        startTimes[sectionName] = std::vector<TimeRecordStart>();
+void Profiler::ExitSection(SectionToken const& token, int lineNumber, const char* fileName, const char* functionName) {
+    int64_t ticksAtStop = GetCurrentTicks();
+    ProfilerThreadData* thread = GetThreadData();
+    if (thread->recordingSuspended) {
+        return;
+    }
+    if (token.sectionId < 0) {
+        throw std::invalid_argument("ExitSection called with an empty token");
     }
 
-    double secondsAtStart = GetCurrentTimeSeconds();
+    if (token.depth < 0) {
+        // Async: nothing to unwind, just the time since the token was made
+        thread->insideProbe = true;
+        ThreadSectionSlot& slot = GetSlot(thread, token.sectionId);
+        int64_t elapsedTicks = ticksAtStop - token.ticksAtStart;
+        int64_t correctedTicks = std::max<int64_t>(elapsedTicks - measurementBiasTicks, 0);
+        recordExit(thread, token.sectionId, slot, token.ticksAtStart, elapsedTicks, correctedTicks, nullptr, nullptr, lineNumber, fileName, functionName);
+        thread->probeCount++;
+        thread->insideProbe = false;
+        return;
+    }
 
-    startTimes.at(sectionName).emplace_back(sectionName, secondsAtStart);
-    // TimeRecordStart* start = new TimeRecordStart(sectionName, secondsAtStart);
-    // startTimes.push_back(start);
+    if (token.thread != thread) {
+        throw std::invalid_argument("ExitSection called with a token from another thread; use EnterAsyncSection for sections that change threads");
+    }
+    // The activation is where it was entered, unless a section below it has
+    // since exited out of order, which moves it down
+    std::vector<TimeRecordStart>& active = thread->activeSections;
+    int position = std::min(token.depth, (int)active.size() - 1);
+    while (position >= 0 && (active[position].ticksAtStart != token.ticksAtStart || active[position].sectionId != token.sectionId)) {
+        position--;
+    }
+    if (position < 0) {
+        throw std::out_of_range("ExitSection called with a token that has already exited");
+    }
+    exitActivation(thread, position, ticksAtStop, lineNumber, fileName, functionName);
 }
 
-void Profiler::ExitSection(char const* sectionName) {
-    double secondsAtStop = GetCurrentTimeSeconds();
-
-    // Get the last start time
-    TimeRecordStart const& currentSection = startTimes.at(sectionName).back();
+void Profiler::exitSection(ProfilerThreadData* thread, int sectionId, int64_t ticksAtStop, int lineNumber, const char* fileName, const char* functionName) {
+    // Find the innermost open activation of this section. It is almost always
+    // on top; anything above it was entered later and is still open, so the two
+    // sections overlap instead of nesting.
+    std::vector<TimeRecordStart>& active = thread->activeSections;
+    int position = (int)active.size() - 1;
+    while (position >= 0 && active[position].sectionId != sectionId) {
+        position--;
+    }
+    if (position < 0) {
+        throw std::out_of_range("ExitSection called without a matching EnterSection");
+    }
+    exitActivation(thread, position, ticksAtStop, lineNumber, fileName, functionName);
+}
 
-    #if defined( DEBUG_PROFIER )
-        // Verify the stack isn't empty
+void Profiler::exitActivation(ProfilerThreadData* thread, int position, int64_t ticksAtStop, int lineNumber, const char* fileName, const char* functionName) {
+    thread->insideProbe = true;
+    std::vector<TimeRecordStart>& active = thread->activeSections;
+    int sectionId = active[position].sectionId;
+    ThreadSectionSlot& slot = GetSlot(thread, sectionId);
 
-        // Verify the currentSection matches the sectionName.
-    #endif
+    // Get the start time
+    TimeRecordStart const& currentSection = active[position];
 
     // Calculate the elapsed time
-    double elapsedTime = secondsAtStop - currentSection.secondsAtStart;
-    // ReportSectionTime(sectionName, elapsedTime);
-    elapsedTimes.emplace_back(sectionName, elapsedTime);
-    startTimes.at(sectionName).pop_back();
+    int64_t elapsedTicks = ticksAtStop - currentSection.ticksAtStart;
+
+    // Take out what the probes themselves cost: this section's own measurement
+    // bias, and a full enter/exit for every probe that completed inside it
+    int64_t nestedProbes = thread->probeCount - currentSection.probesAtStart;
+    int64_t correctedTicks = elapsedTicks - measurementBiasTicks - nestedProbes * probeOverheadTicks;
+    if (correctedTicks < 0) {
+        correctedTicks = 0;
+    }
+
+    // What the hardware counted while the section was open
+    int64_t counterDeltas[PERF_COUNTER_COUNT];
+    int64_t const* counted = nullptr;
+    if (hardwareCounters && thread->perfCounters != nullptr) {
+        thread->perfCounters->read(counterDeltas);
+        for (int i = 0; i < PERF_COUNTER_COUNT; i++) {
+            counterDeltas[i] -= currentSection.countersAtStart[i];
+        }
+        counted = counterDeltas;
+    }
+
+    SectionAllocations allocations;
+    SectionAllocations const* tracked = nullptr;
+    int64_t peakLiveBytes = currentSection.peakLiveBytes;
+    if (trackingAllocations.load(std::memory_order_relaxed)) {
+        allocations.allocations = currentSection.allocations;
+        allocations.allocatedBytes = currentSection.allocatedBytes;
+        allocations.peakLiveBytes = peakLiveBytes - currentSection.liveBytesAtStart;
+        tracked = &allocations;
+    }
+
+    recordExit(thread, sectionId, slot, currentSection.ticksAtStart, elapsedTicks, correctedTicks, counted, tracked, lineNumber, fileName, functionName);
+
+    // Update the call tree node
+    CallTreeNode* node = thread->callTreeNodes[currentSection.callTreeNode];
+    node->count.store(node->count.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+    node->inclusiveTicks.store(node->inclusiveTicks.load(std::memory_order_relaxed) + elapsedTicks, std::memory_order_relaxed);
+    node->childTicks.store(node->childTicks.load(std::memory_order_relaxed) + currentSection.childTicks, std::memory_order_relaxed);
+
+    if (position == (int)active.size() - 1) {
+        // Properly nested. The enclosing section counts this as child time.
+        active.pop_back();
+        thread->sampledDepth.store((int)active.size(), std::memory_order_relaxed);
+        if (!active.empty()) {
+            active.back().childTicks += elapsedTicks;
+            // The enclosing section's heap peak includes this one's
+            active.back().peakLiveBytes = std::max(active.back().peakLiveBytes, peakLiveBytes);
+        }
+    } else {
+        // Overlap: flag this section and every section still open above it
+        node->overlapCount.store(node->overlapCount.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+        for (size_t above = position + 1; above < active.size(); above++) {
+            CallTreeNode* aboveNode = thread->callTreeNodes[active[above].callTreeNode];
+            aboveNode->overlapCount.store(aboveNode->overlapCount.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+        }
+        active.erase(active.begin() + position);
+        syncSampledStack(thread, position);
+    }
+    thread->probeCount++;
+    thread->insideProbe = false;
 }
 
-void Profiler::ExitSection(char const* sectionName, int lineNumber, const char* fileName, const char* functionName) {
-    double secondsAtStop = GetCurrentTimeSeconds();
+void Profiler::suspendRecording() {
+    GetThreadData()->recordingSuspended = true;
+}
 
-    // Get the last start time
-    TimeRecordStart const& currentSection = startTimes.at(sectionName).back();
+void Profiler::resumeRecording() {
+    GetThreadData()->recordingSuspended = false;
+}
 
-    #if defined( DEBUG_PROFIER )
-        // Verify the stack isn't empty
+SectionToken Profiler::EnterSection(char const* sectionName) {
+    return EnterSection(GetSectionId(GetThreadData(), sectionName));
+}
 
-        // Verify the currentSection matches the sectionName.
-    #endif
+void Profiler::ExitSection(char const* sectionName) {
+    ExitSection(GetSectionId(GetThreadData(), sectionName));
+}
 
-    // Calculate the elapsed time
-    double elapsedTime = secondsAtStop - currentSection.secondsAtStart;
-    ReportSectionTime(sectionName, elapsedTime, lineNumber, fileName, functionName);
-    // elapsedTimes.emplace_back(sectionName, elapsedTime);
-    startTimes.at(sectionName).pop_back();
+void Profiler::ExitSection(char const* sectionName, int lineNumber, const char* fileName, const char* functionName) {
+    ExitSection(GetSectionId(GetThreadData(), sectionName), lineNumber, fileName, functionName);
 }
 
-void Profiler::calculateStats() {
-    // Clear the stats
+void Profiler::recordExit(ProfilerThreadData* thread, int sectionId, ThreadSectionSlot& slot, int64_t ticksAtStart, int64_t elapsedTicks, int64_t correctedTicks, int64_t const* counterDeltas, SectionAllocations const* allocations, int lineNumber, const char* fileName, const char* functionName) {
+    SectionAccumulator* accumulator = slot.accumulator;
+    if (accumulator == nullptr) {
+        // First exit of this section on this thread. Publish a new accumulator.
+        accumulator = new SectionAccumulator(sectionId, slot.sectionName);
+        accumulator->histogram = new LatencyHistogram();
+        if (timelinePointsPerSection > 0) {
+            accumulator->timeline = new SampledTimeline(timelinePointsPerSection);
+        }
+        accumulator->next.store(thread->accumulators.load(std::memory_order_relaxed), std::memory_order_relaxed);
+        thread->accumulators.store(accumulator, std::memory_order_release);
+        slot.accumulator = accumulator;
+    }
+
+    // Update the stats before logging the event, so a report that sees the event
+    // also sees its stats
+    accumulator->add(elapsedTicks, correctedTicks, counterDeltas, allocations, lineNumber, fileName, functionName);
+    accumulator->histogram->record((int64_t)(TicksToNanoseconds(elapsedTicks) + 0.5));
+    if (!isMemoryBounded()) {
+        thread->elapsedTimes.emplace_back(sectionId, ticksAtStart, elapsedTicks, thread->threadIndex, lineNumber, fileName, functionName);
+    } else {
+        if (accumulator->timeline != nullptr) {
+            accumulator->timeline->record(accumulator->count, accumulator->totalTicks);
+        }
+        if (thread->recentEvents.getCapacity() > 0) {
+            thread->recentEvents.push(TimeRecordStop(sectionId, ticksAtStart, elapsedTicks, thread->threadIndex, lineNumber, fileName, functionName));
+        }
+    }
+    if (thread->traceEvents.getCapacity() > 0) {
+        thread->traceEvents.push(TraceEvent(sectionId, ticksAtStart, elapsedTicks, correctedTicks, lineNumber, fileName, functionName));
+    }
+    thread->exitCount.store(thread->exitCount.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+}
+
+void Profiler::clearStats() {
     for (auto& stat : stats) {
-        delete stat.second;
+        statsPool.release(stat.second);
     }
     stats.clear();
 
-    // Cumulative time for each section
-    std::map<char const*, std::vector<double>> cumulativeTime;
+    for (auto& threadStat : threadStats) {
+        for (auto& stat : threadStat) {
+            statsPool.release(stat.second);
+        }
+    }
+    threadStats.clear();
+
+    statsEventCount = 0;
+    statsThreadCount = 0;
+}
 
-    // Calculate the stats
-    for (auto& elapsed : elapsedTimes) {
-        // Does the map contain the sectionName?
-        if (stats.find(elapsed.sectionName) == stats.end()) {
-            stats[elapsed.sectionName] = new ProfilerStats(elapsed.sectionName);
-        }
-
-        // Stats for this section name
-        ProfilerStats* stat = stats.at(elapsed.sectionName);
-        // Total number of times this section was called
-        stat->count++;
-        // Total time of all calls to this section
-        stat->totalTime += elapsed.elapsedTime;
-        // Min and max time of this section
-        stat->minTime = std::min(stat->minTime, elapsed.elapsedTime);
-        stat->maxTime = std::max(stat->maxTime, elapsed.elapsedTime);
-
-        // Filename for each section
-        stat->filename = elapsed.fileName;
-        stat->functionName = elapsed.functionName;
-        stat->lineNumber = elapsed.lineNumber;
-
-        // Add the time to the timeline
-        if (cumulativeTime.find(elapsed.sectionName) == cumulativeTime.end()) {
-            // If it doesn't exist, add the section name and current time
-            cumulativeTime[elapsed.sectionName] = std::vector<double>();
-            cumulativeTime[elapsed.sectionName].push_back(elapsed.elapsedTime);
-        } else {
-            // If it does exist, add the current time to the timeline
-            cumulativeTime[elapsed.sectionName].push_back(cumulativeTime[elapsed.sectionName].back() + elapsed.elapsedTime);
+ProfilerStats* Profiler::findOrCreateStats(std::map<int, ProfilerStats*>& into, int sectionId) {
+    // Does the map contain the section?
+    auto found = into.find(sectionId);
+    if (found != into.end()) {
+        return found->second;
+    }
+    ProfilerStats* stat = statsPool.acquire(SectionRegistry::GetName(sectionId));
+    into[sectionId] = stat;
+    return stat;
+}
+
+void Profiler::copyStats(ProfilerStats* stat, SectionAccumulator const& totals) {
+    stat->count = totals.count;
+    // Convert from ticks only now, at report time
+    stat->totalTime = TicksToSeconds(totals.totalTicks);
+    stat->minTime = TicksToSeconds(totals.minTicks);
+    stat->maxTime = TicksToSeconds(totals.maxTicks);
+    stat->avgTime = totals.mean * TicksToSeconds(1);
+    stat->stdDevTime = totals.count > 1 ? std::sqrt(totals.m2 / (totals.count - 1)) * TicksToSeconds(1) : 0;
+    stat->m2 = totals.m2 * TicksToSeconds(1) * TicksToSeconds(1);
+    stat->correctedTotalTime = TicksToSeconds(totals.correctedTotalTicks);
+    stat->correctedMinTime = TicksToSeconds(totals.correctedMinTicks);
+    stat->correctedMaxTime = TicksToSeconds(totals.correctedMaxTicks);
+    stat->correctedAvgTime = totals.count > 0 ? stat->correctedTotalTime / totals.count : 0;
+    std::copy(totals.counterTotals, totals.counterTotals + PERF_COUNTER_COUNT, stat->counters);
+    int64_t cycles = totals.counterTotals[(int)PerfCounter::Cycles];
+    stat->instructionsPerCycle = cycles > 0 ? double(totals.counterTotals[(int)PerfCounter::Instructions]) / cycles : 0;
+    stat->allocations = totals.allocations;
+    stat->allocatedBytes = totals.allocatedBytes;
+    stat->peakLiveBytes = totals.peakLiveBytes;
+    stat->filename = totals.fileName;
+    stat->functionName = totals.functionName;
+    stat->lineNumber = totals.lineNumber;
+}
+
+void Profiler::copyPercentiles(ProfilerStats* stat, std::shared_ptr<LatencyHistogram> histogram) {
+    stat->histogram = histogram;
+    stat->p50Time = histogram->getPercentile(50) * 1e-9;
+    stat->p90Time = histogram->getPercentile(90) * 1e-9;
+    stat->p99Time = histogram->getPercentile(99) * 1e-9;
+    stat->p999Time = histogram->getPercentile(99.9) * 1e-9;
+}
+
+void Profiler::calculateStats() {
+    std::lock_guard<std::mutex> lock(threadsMutex);
+
+    // Nothing new since the last report, so the cached stats are still current
+    size_t eventCount = 0;
+    int64_t sampleCount = unregisteredSamples.load(std::memory_order_relaxed);
+    for (ProfilerThreadData* thread : threads) {
+        eventCount += thread->exitCount.load(std::memory_order_acquire);
+        SectionSamples* samples = thread->samples.load(std::memory_order_acquire);
+        if (samples != nullptr) {
+            sampleCount += samples->total.load(std::memory_order_relaxed);
         }
     }
+    if (eventCount == statsEventCount && sampleCount == statsSampleCount && threads.size() == statsThreadCount && !stats.empty()) {
+        return;
+    }
 
-    // Save all the cumulative times
-    for (auto& stat : stats) {
-        ProfilerStats* stat_ = stat.second;
-        stat_->timeline = cumulativeTime[stat_->sectionName];
+    // Totals combined over all threads
+    std::map<int, SectionAccumulator> combined;
+    std::map<int, std::shared_ptr<LatencyHistogram>> combinedHistograms;
+    // (samples, self samples) combined over all threads
+    std::map<int, std::pair<int64_t, int64_t>> combinedSamples;
+    auto copySamples = [&](ProfilerStats* stat, int64_t samples, int64_t selfSamples) {
+        stat->samples = samples;
+        stat->selfSamples = selfSamples;
+        stat->sampleShare = sampleCount > 0 ? double(samples) / sampleCount : 0;
+    };
+
+    threadStats.resize(threads.size());
+    for (ProfilerThreadData* thread : threads) {
+        std::map<int, ProfilerStats*>& threadStat = threadStats[thread->threadIndex];
+
+        // The running stats are already up to date, so this is one step per section
+        for (SectionAccumulator* accumulator = thread->accumulators.load(std::memory_order_acquire); accumulator != nullptr; accumulator = accumulator->next.load(std::memory_order_relaxed)) {
+            SectionAccumulator totals(accumulator->sectionId, accumulator->sectionName);
+            accumulator->snapshot(totals);
+            ProfilerStats* stat = findOrCreateStats(threadStat, totals.sectionId);
+            copyStats(stat, totals);
+
+            // Copy the thread's histogram so the report doesn't change under the caller
+            std::shared_ptr<LatencyHistogram> histogram = std::make_shared<LatencyHistogram>();
+            histogram->merge(*accumulator->histogram);
+            copyPercentiles(stat, histogram);
+
+            SectionSamples* samples = thread->samples.load(std::memory_order_acquire);
+            if (samples != nullptr && totals.sectionId < SectionSamples::MAX_SECTIONS) {
+                int64_t open = samples->open[totals.sectionId].load(std::memory_order_relaxed);
+                int64_t self = samples->self[totals.sectionId].load(std::memory_order_relaxed);
+                copySamples(stat, open, self);
+                combinedSamples[totals.sectionId].first += open;
+                combinedSamples[totals.sectionId].second += self;
+            }
+
+            std::shared_ptr<LatencyHistogram>& combinedHistogram = combinedHistograms[totals.sectionId];
+            if (!combinedHistogram) {
+                combinedHistogram = std::make_shared<LatencyHistogram>();
+            }
+            combinedHistogram->merge(*histogram);
+
+            // In bounded-memory mode the timeline comes from the sampled points,
+            // always ending on the latest call
+            if (accumulator->timeline != nullptr) {
+                accumulator->timeline->copyTo(stat->timelineCalls, stat->timeline);
+                if (stat->timelineCalls.empty() || stat->timelineCalls.back() != totals.count) {
+                    stat->timelineCalls.push_back(totals.count);
+                    stat->timeline.push_back(TicksToSeconds(totals.totalTicks));
+                }
+            }
+
+            auto found = combined.find(totals.sectionId);
+            if (found == combined.end()) {
+                found = combined.emplace(std::piecewise_construct, std::forward_as_tuple(totals.sectionId), std::forward_as_tuple(totals.sectionId, totals.sectionName)).first;
+            }
+            found->second.merge(totals);
+        }
+
+        if (isMemoryBounded()) {
+            continue;
+        }
+
+        // Extend the cumulative timelines with the events that arrived since the
+        // last report. Threads keep recording while we read; only the events
+        // published so far are included.
+        size_t published = thread->elapsedTimes.size();
+        thread->elapsedTimes.forEach(thread->reportedEvents, [&](TimeRecordStop const& elapsed) {
+            std::vector<double>& threadTimeline = findOrCreateStats(threadStat, elapsed.sectionId)->timeline;
+            double elapsedTime = TicksToSeconds(elapsed.elapsedTicks);
+            threadTimeline.push_back(threadTimeline.empty() ? elapsedTime : threadTimeline.back() + elapsedTime);
+
+            std::vector<double>& timeline = findOrCreateStats(stats, elapsed.sectionId)->timeline;
+            timeline.push_back(timeline.empty() ? elapsedTime : timeline.back() + elapsedTime);
+        });
+        thread->reportedEvents = published;
     }
 
-    // Calculate the average times
+    for (auto& total : combined) {
+        ProfilerStats* stat = findOrCreateStats(stats, total.first);
+        copyStats(stat, total.second);
+        copyPercentiles(stat, combinedHistograms[total.first]);
+        copySamples(stat, combinedSamples[total.first].first, combinedSamples[total.first].second);
+    }
+    if (timelinePointsPerSection > 0) {
+        combineSampledTimelines();
+    }
+    buildCallTree();
+
+    statsEventCount = eventCount;
+    statsSampleCount = sampleCount;
+    statsThreadCount = threads.size();
+}
+
+void Profiler::combineSampledTimelines() {
     for (auto& stat : stats) {
         ProfilerStats* stat_ = stat.second;
-        stat_->avgTime = stat_->totalTime / stat_->count;
+        stat_->timeline.clear();
+        stat_->timelineCalls.clear();
+
+        // Threads are laid end to end, the same order the unbounded timeline uses
+        int64_t callOffset = 0;
+        double timeOffset = 0;
+        for (std::map<int, ProfilerStats*>& threadStat : threadStats) {
+            auto found = threadStat.find(stat.first);
+            if (found == threadStat.end()) {
+                continue;
+            }
+            ProfilerStats* threadStat_ = found->second;
+            for (size_t i = 0; i < threadStat_->timeline.size(); i++) {
+                stat_->timelineCalls.push_back(threadStat_->timelineCalls[i] + callOffset);
+                stat_->timeline.push_back(threadStat_->timeline[i] + timeOffset);
+            }
+            callOffset += threadStat_->count;
+            timeOffset += threadStat_->totalTime;
+        }
+
+        // Thin the merged points back down to the per-section limit, keeping the last one
+        size_t points = stat_->timeline.size();
+        if (points > timelinePointsPerSection) {
+            size_t step = (points + timelinePointsPerSection - 1) / timelinePointsPerSection;
+            size_t kept = 0;
+            for (size_t i = 0; i < points; i++) {
+                if ((i + 1) % step == 0 || i == points - 1) {
+                    stat_->timelineCalls[kept] = stat_->timelineCalls[i];
+                    stat_->timeline[kept] = stat_->timeline[i];
+                    kept++;
+                }
+            }
+            stat_->timelineCalls.resize(kept);
+            stat_->timeline.resize(kept);
+        }
     }
 }
 
+void Profiler::buildCallTree() {
+    for (auto& child : callTree.children) {
+        delete child.second;
+    }
+    callTree.children.clear();
+
+    for (ProfilerThreadData* thread : threads) {
+        // Merged node for each of this thread's nodes. Parents come first.
+        std::vector<CallTreeStats*> merged;
+        thread->callTree.forEach([&](CallTreeNode const& node) {
+            CallTreeStats* parent = node.parentIndex < 0 ? &callTree : merged[node.parentIndex];
+            CallTreeStats*& target = parent->children[node.sectionId];
+            if (target == nullptr) {
+                target = new CallTreeStats(node.sectionId, SectionRegistry::GetName(node.sectionId));
+            }
+
+            int64_t inclusiveTicks = node.inclusiveTicks.load(std::memory_order_relaxed);
+            int64_t childTicks = node.childTicks.load(std::memory_order_relaxed);
+            target->count += node.count.load(std::memory_order_relaxed);
+            target->inclusiveTime += TicksToSeconds(inclusiveTicks);
+            target->exclusiveTime += TicksToSeconds(std::max<int64_t>(inclusiveTicks - childTicks, 0));
+            target->overlapCount += node.overlapCount.load(std::memory_order_relaxed);
+            merged.push_back(target);
+        });
+    }
+}
+
+CallTreeStats const& Profiler::getCallTree() {
+    calculateStats();
+    return callTree;
+}
+
+void Profiler::printCallTree(CallTreeStats const* node, int depth) {
+    for (auto& child : node->children) {
+        CallTreeStats const* child_ = child.second;
+        std::cout << std::string(depth * 2, ' ') << child_->sectionName << ": ";
+        std::cout << "Count " << child_->count << ", ";
+        std::cout << "Inclusive " << child_->inclusiveTime << ", ";
+        std::cout << "Exclusive " << child_->exclusiveTime;
+        if (child_->overlapCount > 0) {
+            std::cout << " [overlapped " << child_->overlapCount << "x, not nested]";
+        }
+        std::cout << "\n";
+        printCallTree(child_, depth + 1);
+    }
+}
+
+void Profiler::writeCallTreeJSON(ReportWriter& file, CallTreeStats const* node, int depth, bool compact) {
+    char const* colon = compact ? "\":" : "\": ";
+    char const* comma = compact ? "," : ", ";
+    file << '[';
+    int count = 0;
+    for (auto& child : node->children) {
+        CallTreeStats const* child_ = child.second;
+        if (!compact) {
+            file << '\n';
+            file.writeSpaces(depth * 2 + 2);
+        }
+        file << "{\"Section Name" << colon;
+        file.writeJSONString(child_->sectionName);
+        file << comma << "\"Count" << colon << child_->count;
+        file << comma << "\"Inclusive Time" << colon << child_->inclusiveTime;
+        file << comma << "\"Exclusive Time" << colon << child_->exclusiveTime;
+        file << comma << "\"Overlapped" << colon << (child_->overlapCount > 0 ? "true" : "false");
+        file << comma << "\"Overlap Count" << colon << child_->overlapCount;
+        file << comma << "\"Children" << colon;
+        writeCallTreeJSON(file, child_, depth + 2, compact);
+        file << '}';
+        count++;
+        if (count < (int)node->children.size()) {
+            file << ',';
+        }
+    }
+    if (!node->children.empty() && !compact) {
+        file << '\n';
+        file.writeSpaces(depth * 2);
+    }
+    file << ']';
+}
+
+void Profiler::writeCollapsed(ReportWriter& file, CallTreeStats const* node, std::string const& path) {
+    for (auto& child : node->children) {
+        CallTreeStats const* child_ = child.second;
+
+        // Semicolons separate frames in this format, so they can't appear in names
+        std::string name = child_->sectionName;
+        for (char& c : name) {
+            if (c == ';') {
+                c = ':';
+            }
+        }
+        std::string childPath = path.empty() ? name : path + ";" + name;
+
+        int64_t selfNanoseconds = (int64_t)(child_->exclusiveTime * 1e9 + 0.5);
+        if (selfNanoseconds > 0) {
+            file << childPath << " " << selfNanoseconds << "\n";
+        }
+        writeCollapsed(file, child_, childPath);
+    }
+}
+
+void Profiler::saveCallTreeToCollapsed(const char* filename) {
+    // Calculate the stats
+    calculateStats();
+
+    ReportWriter file;
+    file.open(filename);
+    writeCollapsed(file, &callTree, "");
+    file.close();
+}
+
 // Calculate statistics for a specific section and return them
 ProfilerStats Profiler::calculateStats(char const* sectionName) {
     // Calculate the stats
     calculateStats();
 
-    // Return the stats for the section
-    return *stats.at(sectionName);
+    // Return the stats for the section, looked up without registering the name
+    int sectionId = SectionRegistry::Find(sectionName);
+    if (sectionId == -1) {
+        throw std::out_of_range(std::string("calculateStats: no section named \"") + sectionName + "\" has been registered");
+    }
+    auto found = stats.find(sectionId);
+    if (found == stats.end()) {
+        throw std::out_of_range(std::string("calculateStats: section \"") + sectionName + "\" has no recorded calls");
+    }
+    return *found->second;
 }
 
 
@@ -176,6 +1870,13 @@ void Profiler::printStats() {
     // Calculate the stats
     calculateStats();
 
+    std::cout << "Probe Overhead: " << getReportedProbeOverhead() << " per enter/exit, ";
+    std::cout << "Measurement Bias: " << getReportedMeasurementBias() << "\n";
+    if (statsSampleCount > 0) {
+        std::cout << "Samples: " << statsSampleCount << "\n";
+    }
+    std::cout << "\n";
+
     // Print out the stats
     for (auto& stat : stats) {
         ProfilerStats* stat_ = stat.second;
@@ -185,25 +1886,104 @@ void Profiler::printStats() {
         std::cout << "Min Time: " << stat_->minTime << "\n";
         std::cout << "Max Time: " << stat_->maxTime << "\n";
         std::cout << "Avg Time: " << stat_->avgTime << "\n";
+        std::cout << "Std Dev Time: " << stat_->stdDevTime << "\n";
+        std::cout << "P50 Time: " << stat_->p50Time << "\n";
+        std::cout << "P90 Time: " << stat_->p90Time << "\n";
+        std::cout << "P99 Time: " << stat_->p99Time << "\n";
+        std::cout << "P99.9 Time: " << stat_->p999Time << "\n";
+        std::cout << "Corrected Total Time: " << stat_->correctedTotalTime << "\n";
+        std::cout << "Corrected Min Time: " << stat_->correctedMinTime << "\n";
+        std::cout << "Corrected Max Time: " << stat_->correctedMaxTime << "\n";
+        std::cout << "Corrected Avg Time: " << stat_->correctedAvgTime << "\n";
+        if (statsSampleCount > 0) {
+            std::cout << "Samples: " << stat_->samples << " (" << stat_->sampleShare * 100 << "% of all samples), Self Samples: " << stat_->selfSamples << "\n";
+        }
+        if (hardwareCounters) {
+            for (int i = 0; i < PERF_COUNTER_COUNT; i++) {
+                std::cout << GetPerfCounterName(i) << ": " << stat_->counters[i] << (i + 1 < PERF_COUNTER_COUNT ? ", " : "\n");
+            }
+            std::cout << "IPC: " << stat_->instructionsPerCycle << "\n";
+        }
+        if (isTrackingAllocations()) {
+            std::cout << "Allocations: " << stat_->allocations << ", Allocated Bytes: " << stat_->allocatedBytes << ", Peak Live Bytes: " << stat_->peakLiveBytes << "\n";
+        }
         std::cout << "Filename: " << stat_->filename << "\n";
         std::cout << "Function Name: " << stat_->functionName << "\n";
         std::cout << "Line Number: " << stat_->lineNumber << "\n";
         std::cout << "\n";
     }
+
+    // Only break the stats down by thread when more than one thread recorded
+    if (threadStats.size() > 1) {
+        for (size_t thread = 0; thread < threadStats.size(); thread++) {
+            for (auto& stat : threadStats[thread]) {
+                ProfilerStats* stat_ = stat.second;
+                std::cout << "Thread " << thread << " - " << stat_->sectionName << ": ";
+                std::cout << "Count " << stat_->count << ", ";
+                std::cout << "Total " << stat_->totalTime << ", ";
+                std::cout << "Min " << stat_->minTime << ", ";
+                std::cout << "Max " << stat_->maxTime << ", ";
+                std::cout << "Avg " << stat_->avgTime << ", ";
+                std::cout << "Std Dev " << stat_->stdDevTime << ", ";
+                std::cout << "P50 " << stat_->p50Time << ", ";
+                std::cout << "P99 " << stat_->p99Time << "\n";
+            }
+        }
+        std::cout << "\n";
+    }
+
+    std::cout << "Call Tree:\n";
+    printCallTree(&callTree, 1);
+    std::cout << "\n";
 }
 
 void Profiler::reset() {
-    // Clear the stats
-    for (auto& stat : stats) {
-        delete stat.second;
-    }
-    stats.clear();
+    // Under the lock calculateStats holds while it fills the stats
+    std::lock_guard<std::mutex> lock(threadsMutex);
+    clearStats();
+
+    unregisteredSamples.store(0, std::memory_order_relaxed);
+    loadedMeasurementBiasTicks = -1;
+    loadedProbeOverheadTicks = -1;
+    for (ProfilerThreadData* thread : threads) {
+        // Clear the elapsed times
+        thread->elapsedTimes.clear();
+        thread->recentEvents.clear();
+        thread->reportedEvents = 0;
+        thread->exitCount.store(0, std::memory_order_release);
 
-    // Clear the elapsed times
-    elapsedTimes.clear();
+        // Clear the running stats
+        thread->accumulators.store(nullptr, std::memory_order_release);
+        for (ThreadSectionSlot& slot : thread->sections) {
+            delete slot.accumulator;
+            slot.accumulator = nullptr;
+        }
+
+        // Clear the samples
+        SectionSamples* samples = thread->samples.load(std::memory_order_relaxed);
+        if (samples != nullptr) {
+            samples->total.store(0, std::memory_order_relaxed);
+            samples->outside.store(0, std::memory_order_relaxed);
+            for (int i = 0; i < SectionSamples::MAX_SECTIONS; i++) {
+                samples->open[i].store(0, std::memory_order_relaxed);
+                samples->self[i].store(0, std::memory_order_relaxed);
+            }
+        }
 
-    // Clear the start times
-    startTimes.clear();
+        // Clear the start times and the call tree. Functions still running
+        // aren't timed when they return.
+        thread->activeSections.clear();
+        for (std::pair<void const*, int>& open : thread->openFunctions) {
+            open.second = -1;
+        }
+        thread->sampledDepth.store(0, std::memory_order_relaxed);
+        thread->callTree.clear();
+        thread->callTreeNodes.clear();
+        thread->callTreeRoots.clear();
+    }
+
+    // Only once the totals are gone, so the window thread can't diff against them again
+    windowRoller.clear();
 }
 
 void Profiler::saveStatsToCSV(const char* filename) {
@@ -211,7 +1991,7 @@ void Profiler::saveStatsToCSV(const char* filename) {
     calculateStats();
 
     // Open the file
-    std::ofstream file;
+    ReportWriter file;
     file.open(filename);
 
     // Header
@@ -221,83 +2001,484 @@ void Profiler::saveStatsToCSV(const char* filename) {
     file << "Min Time,";
     file << "Max Time,";
     file << "Avg Time,";
+    file << "Std Dev Time,";
+    file << "P50 Time,";
+    file << "P90 Time,";
+    file << "P99 Time,";
+    file << "P99.9 Time,";
+    file << "Corrected Total Time,";
+    file << "Corrected Min Time,";
+    file << "Corrected Max Time,";
+    file << "Corrected Avg Time,";
+    file << "Samples,";
+    file << "Self Samples,";
+    file << "Sample Share,";
+    for (int i = 0; i < PERF_COUNTER_COUNT; i++) {
+        file << GetPerfCounterName(i) << ",";
+    }
+    file << "IPC,";
+    file << "Allocations,";
+    file << "Allocated Bytes,";
+    file << "Peak Live Bytes,";
     file << "Filename,";
     file << "Function Name,";
     file << "Line Number,";
+    file << "Thread,";
+    file << "\n";
 
-
-    // Write the stats to the file
-    for (auto& stat : stats) {
-        ProfilerStats* stat_ = stat.second;
-        file << stat_->sectionName << ",";
+    // Write the stats to the file. Combined rows come first, then one row per
+    // section for each thread.
+    auto writeRow = [&](ProfilerStats* stat_, std::string const& thread) {
+        file.writeCSVField(stat_->sectionName);
+        file << ",";
         file << stat_->count << ",";
         file << stat_->totalTime << ",";
         file << stat_->minTime << ",";
         file << stat_->maxTime << ",";
         file << stat_->avgTime << ",";
-        file << stat_->filename << ",";
-        file << stat_->functionName << ",";
+        file << stat_->stdDevTime << ",";
+        file << stat_->p50Time << ",";
+        file << stat_->p90Time << ",";
+        file << stat_->p99Time << ",";
+        file << stat_->p999Time << ",";
+        file << stat_->correctedTotalTime << ",";
+        file << stat_->correctedMinTime << ",";
+        file << stat_->correctedMaxTime << ",";
+        file << stat_->correctedAvgTime << ",";
+        file << stat_->samples << ",";
+        file << stat_->selfSamples << ",";
+        file << stat_->sampleShare << ",";
+        for (int i = 0; i < PERF_COUNTER_COUNT; i++) {
+            file << stat_->counters[i] << ",";
+        }
+        file << stat_->instructionsPerCycle << ",";
+        file << stat_->allocations << ",";
+        file << stat_->allocatedBytes << ",";
+        file << stat_->peakLiveBytes << ",";
+        file.writeCSVField(stat_->filename);
+        file << ",";
+        file.writeCSVField(stat_->functionName);
+        file << ",";
         file << stat_->lineNumber << ",";
+        file << thread << ",";
         file << "\n";
+    };
+    for (auto& stat : stats) {
+        writeRow(stat.second, "all");
+    }
+    for (size_t thread = 0; thread < threadStats.size(); thread++) {
+        for (auto& stat : threadStats[thread]) {
+            writeRow(stat.second, std::to_string(thread));
+        }
     }
 
     // Close the file
     file.close();
 }
 
-void Profiler::saveStatsToJSON(const char* filename) {
+void Profiler::saveStatsToJSON(const char* filename, bool compact) {
     // Calculate the stats
     calculateStats();
 
     // Open the file
-    std::ofstream file;
-    file.open(filename);
+    ReportWriter file;
+    file.open(filename, ReportFormat::JSON);
+
+    // Pretty output puts each field on its own indented line; compact output
+    // leaves out every space and line break
+    char const* colon = compact ? "\":" : "\": ";
+    char const* comma = compact ? "," : ", ";
+    auto newline = [&](int depth) {
+        if (!compact) {
+            file << '\n';
+            file.writeSpaces(depth * 2);
+        }
+    };
+    auto key = [&](char const* name) {
+        file << '"' << name << colon;
+    };
+    auto field = [&](int depth, char const* name, auto value) {
+        newline(depth);
+        key(name);
+        file << value << ',';
+    };
+    auto stringField = [&](int depth, char const* name, char const* value) {
+        newline(depth);
+        key(name);
+        file.writeJSONString(value);
+        file << ',';
+    };
+
+    // The finer levels of long timelines go into a second file, opened only if
+    // some section needs it
+    std::string levelPath = filename;
+    if (levelPath.size() >= 5 && levelPath.compare(levelPath.size() - 5, 5, ".json") == 0) {
+        levelPath.resize(levelPath.size() - 5);
+    }
+    levelPath += ".timeline.json";
+    bool hasLevels = false;
+    for (auto& stat : stats) {
+        hasLevels = hasLevels || stat.second->timeline.size() > TIMELINE_INLINE_POINTS;
+    }
+    ReportWriter levelFile;
+    if (hasLevels) {
+        levelFile.open(levelPath.c_str(), ReportFormat::JSON);
+        levelFile << '[';
+    }
 
     // Header
-    file << "{\n";
-    file << "  \"profiler\": [\n";
+    file << '{';
+    field(1, "Probe Overhead", getReportedProbeOverhead());
+    field(1, "Measurement Bias", getReportedMeasurementBias());
+    if (hasLevels) {
+        // Relative to this file, so the pair can be moved together
+        size_t slash = levelPath.find_last_of("/\\");
+        stringField(1, "Timeline File", levelPath.c_str() + (slash == std::string::npos ? 0 : slash + 1));
+    }
+    newline(1);
+    key("profiler");
+    file << '[';
 
     // Write the stats to the file
     // Skip the last comma
-    int count = 0;
+    size_t count = 0;
     for (auto& stat : stats) {
         ProfilerStats* stat_ = stat.second;
-        file << "    {\n";
-        file << "      \"Section Name\": \"" << stat_->sectionName << "\",\n";
-        file << "      \"Count\": " << stat_->count << ",\n";
-        file << "      \"Total Time\": " << stat_->totalTime << ",\n";
-        file << "      \"Min Time\": " << stat_->minTime << ",\n";
-        file << "      \"Max Time\": " << stat_->maxTime << ",\n";
-        file << "      \"Avg Time\": " << stat_->avgTime << ",\n";
-        file << "      \"Filename\": \"" << stat_->filename << "\",\n";
-        file << "      \"Function Name\": \"" << stat_->functionName << "\",\n";
-        file << "      \"Line Number\": " << stat_->lineNumber << ",\n";
-        file << "      \"Timeline\": [";
-        for (int i = 0; i < stat_->timeline.size(); i++) {
-            file << stat_->timeline[i];
-            if (i < stat_->timeline.size() - 1) {
-                file << ", ";
+        newline(2);
+        file << '{';
+        stringField(3, "Section Name", stat_->sectionName);
+        field(3, "Count", stat_->count);
+        field(3, "Total Time", stat_->totalTime);
+        field(3, "Min Time", stat_->minTime);
+        field(3, "Max Time", stat_->maxTime);
+        field(3, "Avg Time", stat_->avgTime);
+        field(3, "Std Dev Time", stat_->stdDevTime);
+        field(3, "P50 Time", stat_->p50Time);
+        field(3, "P90 Time", stat_->p90Time);
+        field(3, "P99 Time", stat_->p99Time);
+        field(3, "P99.9 Time", stat_->p999Time);
+        field(3, "Corrected Total Time", stat_->correctedTotalTime);
+        field(3, "Corrected Min Time", stat_->correctedMinTime);
+        field(3, "Corrected Max Time", stat_->correctedMaxTime);
+        field(3, "Corrected Avg Time", stat_->correctedAvgTime);
+        field(3, "Samples", stat_->samples);
+        field(3, "Self Samples", stat_->selfSamples);
+        field(3, "Sample Share", stat_->sampleShare);
+        for (int i = 0; i < PERF_COUNTER_COUNT; i++) {
+            field(3, GetPerfCounterName(i), stat_->counters[i]);
+        }
+        field(3, "IPC", stat_->instructionsPerCycle);
+        field(3, "Allocations", stat_->allocations);
+        field(3, "Allocated Bytes", stat_->allocatedBytes);
+        field(3, "Peak Live Bytes", stat_->peakLiveBytes);
+        stringField(3, "Filename", stat_->filename);
+        stringField(3, "Function Name", stat_->functionName);
+        field(3, "Line Number", stat_->lineNumber);
+
+        // Stats for each thread that ran this section
+        newline(3);
+        key("Threads");
+        file << '[';
+        bool firstThread = true;
+        for (size_t thread = 0; thread < threadStats.size(); thread++) {
+            auto found = threadStats[thread].find(stat.first);
+            if (found == threadStats[thread].end()) {
+                continue;
             }
+            ProfilerStats* threadStat = found->second;
+            if (!firstThread) {
+                file << comma;
+            }
+            firstThread = false;
+            file << "{\"Thread" << colon << thread;
+            file << comma << "\"Count" << colon << threadStat->count;
+            file << comma << "\"Total Time" << colon << threadStat->totalTime;
+            file << comma << "\"Min Time" << colon << threadStat->minTime;
+            file << comma << "\"Max Time" << colon << threadStat->maxTime;
+            file << comma << "\"Avg Time" << colon << threadStat->avgTime;
+            file << comma << "\"Std Dev Time" << colon << threadStat->stdDevTime;
+            file << comma << "\"P50 Time" << colon << threadStat->p50Time;
+            file << comma << "\"P90 Time" << colon << threadStat->p90Time;
+            file << comma << "\"P99 Time" << colon << threadStat->p99Time;
+            file << comma << "\"P99.9 Time" << colon << threadStat->p999Time;
+            file << comma << "\"Corrected Total Time" << colon << threadStat->correctedTotalTime;
+            file << comma << "\"Corrected Avg Time" << colon << threadStat->correctedAvgTime;
+            file << comma << "\"Samples" << colon << threadStat->samples;
+            file << comma << "\"Self Samples" << colon << threadStat->selfSamples;
+            file << comma << "\"Cycles" << colon << threadStat->counters[(int)PerfCounter::Cycles];
+            file << comma << "\"Instructions" << colon << threadStat->counters[(int)PerfCounter::Instructions];
+            file << comma << "\"IPC" << colon << threadStat->instructionsPerCycle;
+            file << comma << "\"Allocations" << colon << threadStat->allocations;
+            file << comma << "\"Allocated Bytes" << colon << threadStat->allocatedBytes;
+            file << comma << "\"Peak Live Bytes" << colon << threadStat->peakLiveBytes << '}';
         }
-        file << "]\n";
-        file << "    }";
+        file << "],";
+        std::vector<double> const& timeline = stat_->timeline;
+        std::vector<int64_t> const& timelineCalls = stat_->timelineCalls;
+        // Write the calls or the times of the points index(0), index(1), ...
+        auto writeCalls = [&](ReportWriter& out, char const* separator, size_t points, auto index) {
+            out << '[';
+            for (size_t i = 0; i < points; i++) {
+                if (i > 0) {
+                    out << separator;
+                }
+                size_t point = index(i);
+                out << (timelineCalls.empty() ? (int64_t)(point + 1) : timelineCalls[point]);
+            }
+            out << ']';
+        };
+        auto writeTimes = [&](ReportWriter& out, char const* separator, size_t points, auto index) {
+            out << '[';
+            for (size_t i = 0; i < points; i++) {
+                if (i > 0) {
+                    out << separator;
+                }
+                out << timeline[index(i)];
+            }
+            out << ']';
+        };
+        auto whole = [](size_t i) { return i; };
+
+        if (timeline.size() > TIMELINE_INLINE_POINTS) {
+            // Every level is downsampled from the whole timeline, by call number
+            std::vector<double> calls(timeline.size());
+            for (size_t i = 0; i < calls.size(); i++) {
+                calls[i] = timelineCalls.empty() ? double(i + 1) : double(timelineCalls[i]);
+            }
+            std::vector<size_t> sizes = GetTimelineLevelSizes(timeline.size(), TIMELINE_INLINE_POINTS, TIMELINE_LEVEL_FACTOR);
+            newline(3);
+            key("Timeline Levels");
+            file << '[';
+            for (size_t level = 1; level < sizes.size(); level++) {
+                // Past the opening bracket means a level was written before
+                if (levelFile.getBytesWritten() > 1) {
+                    levelFile << ',';
+                }
+                size_t offset = levelFile.getBytesWritten();
+                levelFile << "{\"Section Name\":";
+                levelFile.writeJSONString(stat_->sectionName);
+                levelFile << ",\"Calls\":";
+                if (level + 1 < sizes.size()) {
+                    std::vector<size_t> kept = DownsampleLTTB(calls, timeline, sizes[level]);
+                    auto index = [&](size_t i) { return kept[i]; };
+                    writeCalls(levelFile, ",", kept.size(), index);
+                    levelFile << ",\"Times\":";
+                    writeTimes(levelFile, ",", kept.size(), index);
+                } else {
+                    writeCalls(levelFile, ",", timeline.size(), whole);
+                    levelFile << ",\"Times\":";
+                    writeTimes(levelFile, ",", timeline.size(), whole);
+                }
+                levelFile << '}';
+
+                if (level > 1) {
+                    file << comma;
+                }
+                file << "{\"Points" << colon << sizes[level];
+                file << comma << "\"Offset" << colon << offset;
+                file << comma << "\"Length" << colon << levelFile.getBytesWritten() - offset << '}';
+            }
+            file << "],";
+
+            // The coarsest level stands in for the timeline, as a sampled one
+            std::vector<size_t> kept = DownsampleLTTB(calls, timeline, sizes[0]);
+            auto index = [&](size_t i) { return kept[i]; };
+            newline(3);
+            key("Timeline Calls");
+            writeCalls(file, comma, kept.size(), index);
+            file << ',';
+            newline(3);
+            key("Timeline");
+            writeTimes(file, comma, kept.size(), index);
+        } else {
+            if (!timelineCalls.empty()) {
+                newline(3);
+                key("Timeline Calls");
+                writeCalls(file, comma, timelineCalls.size(), whole);
+                file << ',';
+            }
+            newline(3);
+            key("Timeline");
+            writeTimes(file, comma, timeline.size(), whole);
+        }
+        newline(2);
+        file << '}';
         count++;
         if (count < stats.size()) {
-            file << ",";
+            file << ',';
         }
-        file << "\n";
     }
 
+    newline(1);
+    file << "],";
+
+    // Fixed-interval windows as a time series: one array of window times, and
+    // one array per measure and section with an entry for every window. Sections
+    // without calls in a window have a count of 0 and null times there.
+    std::vector<StatsWindow> windows = getWindows();
+    if (!windows.empty()) {
+        std::map<int, char const*> windowSections;
+        for (StatsWindow const& window : windows) {
+            for (auto const& section : window.sections) {
+                windowSections[section.first] = SectionRegistry::GetName(section.first);
+            }
+        }
+        auto series = [&](int depth, char const* name, auto value) {
+            newline(depth);
+            key(name);
+            file << '[';
+            for (size_t i = 0; i < windows.size(); i++) {
+                if (i > 0) {
+                    file << comma;
+                }
+                value(windows[i]);
+            }
+            file << ']';
+        };
+
+        newline(1);
+        key("Windows");
+        file << '{';
+        field(2, "Window Seconds", windowRoller.getWindowSeconds());
+        series(2, "Start Time", [&](StatsWindow const& window) { file << window.startTime; });
+        file << ',';
+        series(2, "End Time", [&](StatsWindow const& window) { file << window.endTime; });
+        file << ',';
+        newline(2);
+        key("Sections");
+        file << '[';
+        size_t sectionCount = 0;
+        for (auto const& windowSection : windowSections) {
+            int sectionId = windowSection.first;
+            auto measure = [&](double WindowSectionStats::*member) {
+                return [&, member](StatsWindow const& window) {
+                    auto found = window.sections.find(sectionId);
+                    if (found == window.sections.end()) {
+                        file << "null";
+                    } else {
+                        file << found->second.*member;
+                    }
+                };
+            };
+            newline(3);
+            file << '{';
+            stringField(4, "Section Name", windowSection.second);
+            series(4, "Count", [&](StatsWindow const& window) {
+                auto found = window.sections.find(sectionId);
+                file << (found == window.sections.end() ? 0 : found->second.count);
+            });
+            file << ',';
+            series(4, "Avg Time", measure(&WindowSectionStats::avgTime));
+            file << ',';
+            series(4, "Max Time", measure(&WindowSectionStats::maxTime));
+            file << ',';
+            series(4, "P99 Time", measure(&WindowSectionStats::p99Time));
+            newline(3);
+            file << '}';
+            sectionCount++;
+            if (sectionCount < windowSections.size()) {
+                file << ',';
+            }
+        }
+        newline(2);
+        file << ']';
+        newline(1);
+        file << "},";
+    }
+
+    // Sections nested by the path they ran under
+    newline(1);
+    key("Call Tree");
+    writeCallTreeJSON(file, &callTree, 1, compact);
+
+    // Close the file
+    newline(0);
+    file << '}';
+    if (!compact) {
+        file << '\n';
+    }
+    file.close();
+    if (hasLevels) {
+        levelFile << "]\n";
+        levelFile.close();
+    }
+}
+
+void Profiler::saveChromeTrace(const char* filename) {
+    writeTraceEvents(filename, false);
+}
+
+void Profiler::saveCompactChromeTrace(const char* filename) {
+    writeTraceEvents(filename, true);
+}
+
+void Profiler::writeTraceEvents(const char* filename, bool compact) {
+    // Open the file
+    ReportWriter file;
+    file.open(filename, ReportFormat::JSON);
+    // Microseconds, rounded to the nanosecond so they print short
+    auto microseconds = [](int64_t ticks) {
+        return std::round(TicksToNanoseconds(ticks)) / 1e3;
+    };
+
+    if (compact) {
+        file << "[";
+    } else {
+        file << "{\n";
+        file << "  \"displayTimeUnit\": \"ns\",\n";
+        file << "  \"traceEvents\": [\n";
+
+        // Name the process and each thread in the viewer
+        file << "    {\"name\": \"process_name\", \"ph\": \"M\", \"pid\": 1, \"tid\": 0, \"args\": {\"name\": \"Profiler\"}}";
+        for (int thread = 0; thread < getThreadCount(); thread++) {
+            file << ",\n    {\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": 1, \"tid\": " << thread << ", \"args\": {\"name\": \"Thread " << thread << "\"}}";
+        }
+    }
+
+    // The compact file has no metadata events ahead of the first section
+    bool first = compact;
+    int64_t startTicks = GetStartTicks();
+    forEachEvent([&](TimeRecordStop const& event) {
+        double start = microseconds(event.ticksAtStart - startTicks);
+        double duration = microseconds(event.elapsedTicks);
+        char const* name = SectionRegistry::GetName(event.sectionId);
+        if (compact) {
+            file << (first ? "" : ",\n");
+            file << "{\"name\":";
+            file.writeJSONString(name);
+            file << ",\"ph\":\"X\",\"ts\":" << start << ",\"dur\":" << duration << ",\"pid\":1,\"tid\":" << event.threadIndex << "}";
+        } else {
+            file << ",\n    {\"name\": ";
+            file.writeJSONString(name);
+            file << ", \"cat\": \"section\", \"ph\": \"X\"";
+            file << ", \"ts\": " << start << ", \"dur\": " << duration;
+            file << ", \"pid\": 1, \"tid\": " << event.threadIndex;
+            file << ", \"args\": {\"Filename\": ";
+            file.writeJSONString(event.fileName);
+            file << ", \"Function Name\": ";
+            file.writeJSONString(event.functionName);
+            file << ", \"Line Number\": " << event.lineNumber << "}}";
+        }
+        first = false;
+    });
+
     // Close the file
-    file << "  ]\n";
-    file << "}\n";
+    if (compact) {
+        file << "]\n";
+    } else {
+        file << "\n  ]\n";
+        file << "}\n";
+    }
     file.close();
 }
 
-void Profiler::ReportSectionTime(char const* sectionName, double elapsedTime) {
-    elapsedTimes.emplace_back(sectionName, elapsedTime);
+void Profiler::ReportSectionTime(char const* sectionName, int64_t elapsedTicks) {
+    ReportSectionTime(sectionName, elapsedTicks, 0, "null", "null");
 }
 
-void Profiler::ReportSectionTime(char const* sectionName, double elapsedTime, int lineNumber, const char* fileName, const char* functionName) {
-    elapsedTimes.emplace_back(sectionName, elapsedTime, lineNumber, fileName, functionName);
+void Profiler::ReportSectionTime(char const* sectionName, int64_t elapsedTicks, int lineNumber, const char* fileName, const char* functionName) {
+    ProfilerThreadData* thread = GetThreadData();
+    int sectionId = GetSectionId(thread, sectionName);
+    // Reported after the fact, so the section ended now
+    recordExit(thread, sectionId, GetSlot(thread, sectionId), GetCurrentTicks() - elapsedTicks, elapsedTicks, elapsedTicks, nullptr, nullptr, lineNumber, fileName, functionName);
 }
\ No newline at end of file
@@ -1,37 +1,212 @@
 #pragma once
+#include <atomic>
 #include <cfloat>
+#include <cstdint>
+#include <fstream>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <utility>
 #include <vector>
 #include <map>
+#include <memory>
+#include "arena.hpp"
+#include "event_buffer.hpp"
+#include "histogram.hpp"
+#include "live_stats.hpp"
+#include "perf_counters.hpp"
+#include "report_writer.hpp"
+#include "stats_snapshot.hpp"
+#include "stats_windows.hpp"
+#include "trace_file.hpp"
 
 
-#define PROFILER_ENTER(sectionName) Profiler::GetInstance()->EnterSection(sectionName);
-#define PROFILER_EXIT(sectionName) Profiler::GetInstance()->ExitSection(sectionName, __LINE__, __FILE__, __FUNCTION__);
+// Each call site interns its section name once, the first time it runs, and
+// afterwards only passes the integer id. The name must be the same on every
+// call; for names built at runtime, register them with Profiler::RegisterSection
+// and use PROFILER_ENTER_ID/PROFILER_EXIT_ID.
+#define PROFILER_ENTER(sectionName) { static int const profilerSectionId_ = Profiler::RegisterSection(sectionName); Profiler::GetInstance()->EnterSection(profilerSectionId_); }
+#define PROFILER_EXIT(sectionName) { static int const profilerSectionId_ = Profiler::RegisterSection(sectionName); Profiler::GetInstance()->ExitSection(profilerSectionId_, __LINE__, __FILE__, __FUNCTION__); }
+#define PROFILER_ENTER_ID(sectionId) Profiler::GetInstance()->EnterSection(sectionId);
+#define PROFILER_EXIT_ID(sectionId) Profiler::GetInstance()->ExitSection(sectionId, __LINE__, __FILE__, __FUNCTION__);
 #define PROFILER_STATISTICS(sectionName) Profiler::GetInstance()->calculateStats(sectionName);
+// Times the rest of the enclosing block, recording where it is
+#define PROFILER_CONCAT_(a, b) a##b
+#define PROFILER_CONCAT(a, b) PROFILER_CONCAT_(a, b)
+#define PROFILER_SCOPE(sectionName) static int const PROFILER_CONCAT(profilerScopeId_, __LINE__) = Profiler::RegisterSection(sectionName); ProfilerScopeObject PROFILER_CONCAT(profilerScope_, __LINE__)(PROFILER_CONCAT(profilerScopeId_, __LINE__), __LINE__, __FILE__, __FUNCTION__)
 
+// Where the caller of a function is, for default arguments. Other compilers
+// get no location.
+#if defined(__GNUC__) || defined(__clang__)
+#define PROFILER_CALLER_LINE __builtin_LINE()
+#define PROFILER_CALLER_FILE __builtin_FILE()
+#define PROFILER_CALLER_FUNCTION __builtin_FUNCTION()
+#else
+#define PROFILER_CALLER_LINE 0
+#define PROFILER_CALLER_FILE "null"
+#define PROFILER_CALLER_FUNCTION "null"
+#endif
+
+// Process-wide table that interns section names into small integer ids.
+// Names with the same text share an id no matter which translation unit or
+// buffer they came from. Ids and interned names stay valid for the life of the
+// process, independent of any Profiler instance.
+class SectionRegistry {
+public:
+    static int Register(char const* sectionName);
+    static int Register(std::string const& sectionName);
+    // Id of a registered name without registering it, or -1
+    static int Find(char const* sectionName);
+    // Registers a section whose name is only worked out when a report first
+    // asks for it, e.g. a function known only by its address. Until then it
+    // goes by the placeholder, which must not clash with any other name. If the
+    // resolved name is already taken, the placeholder is appended to it.
+    static int RegisterDeferred(std::string const& placeholder, std::function<std::string()> resolve);
+    // Interned copy of the name, resolving a deferred one
+    static char const* GetName(int sectionId);
+    // The same without resolving, for the probes
+    static char const* PeekName(int sectionId);
+    static int GetCount();
+
+private:
+    static SectionRegistry& Instance();
+
+    std::mutex mutex;
+    std::unordered_map<std::string, int> ids;
+    // A deque never moves its elements, so interned names stay put. Resolved
+    // names are appended, so the placeholders stay valid as well.
+    std::deque<std::string> names;
+    // Name of each section id, and the resolver of each deferred one not yet resolved
+    std::vector<char const*> current;
+    std::unordered_map<int, std::function<std::string()>> resolvers;
+};
+
+class ProfilerThreadData;
+
+// One open section, as returned by EnterSection. Passing it back to
+// ExitSection ends exactly that activation without looking anything up, so
+// several open activations of the same section each keep their own start.
+// Small enough to pass by value.
+class SectionToken {
+public:
+    SectionToken();
+    SectionToken(int sectionId, int64_t ticksAtStart, int depth, ProfilerThreadData* thread);
+
+    // -1 for a token that doesn't stand for a section
+    int sectionId;
+    // Raw clock ticks, see time.hpp
+    int64_t ticksAtStart;
+    // Position on the entering thread's stack of open sections, or -1 for an
+    // async section, which isn't on any stack
+    int depth;
+    ProfilerThreadData* thread;
+};
+
+// Times its own lifetime as a section, e.g. a whole function or block. The
+// location defaults to where it is constructed.
 class ProfilerScopeObject {
 public:
-    ProfilerScopeObject(char const* sectionName);
+    ProfilerScopeObject(char const* sectionName, int lineNumber = PROFILER_CALLER_LINE, const char* fileName = PROFILER_CALLER_FILE, const char* functionName = PROFILER_CALLER_FUNCTION);
+    ProfilerScopeObject(int sectionId, int lineNumber = PROFILER_CALLER_LINE, const char* fileName = PROFILER_CALLER_FILE, const char* functionName = PROFILER_CALLER_FUNCTION);
     ~ProfilerScopeObject();
-    char const* sectionName;
+
+    ProfilerScopeObject(ProfilerScopeObject const&) = delete;
+    ProfilerScopeObject& operator=(ProfilerScopeObject const&) = delete;
+
+    SectionToken token;
+    int lineNumber;
+    const char* fileName;
+    const char* functionName;
 };
 
+// An open section on a thread's stack of active sections
 class TimeRecordStart {
 public:
-    TimeRecordStart(char const* sectionName, double secondsAtStart);
+    TimeRecordStart(int sectionId, int64_t ticksAtStart, int64_t probesAtStart, int callTreeNode, int64_t liveBytesAtStart);
     ~TimeRecordStart();
 
+    int sectionId;
+    // Raw clock ticks, see time.hpp
+    int64_t ticksAtStart;
+    // The thread's completed probe count at entry, to count the nested probes
+    int64_t probesAtStart;
+    // Index of this activation's node in the thread's call tree
+    int callTreeNode;
+    // Time spent in child sections that exited while this one was open
+    int64_t childTicks;
+    // Hardware counter values at entry. Only set while hardware counters are on.
+    int64_t countersAtStart[PERF_COUNTER_COUNT];
+    // Heap allocations made while this was the innermost open section, and the
+    // thread's live heap bytes at entry and at their highest since
+    int64_t allocations;
+    int64_t allocatedBytes;
+    int64_t liveBytesAtStart;
+    int64_t peakLiveBytes;
+};
+
+// Heap use of one section exit, see Profiler::startAllocationTracking
+struct SectionAllocations {
+    int64_t allocations;
+    int64_t allocatedBytes;
+    // Highest the thread's live heap bytes rose above their level at entry
+    int64_t peakLiveBytes;
+};
+
+// One node of a thread's call tree: a section reached through one particular
+// path of enclosing sections. The owning thread updates the counters with plain
+// atomic stores; reports read them while it runs.
+class CallTreeNode {
+public:
+    CallTreeNode(int sectionId, int parentIndex);
+    ~CallTreeNode();
+
+    int sectionId;
+    // -1 for sections entered with nothing else open
+    int parentIndex;
+    std::atomic<int64_t> count;
+    std::atomic<int64_t> inclusiveTicks;
+    std::atomic<int64_t> childTicks;
+    // Times this section exited while a section entered after it was still
+    // open, i.e. the two did not nest
+    std::atomic<int64_t> overlapCount;
+    // (section id, node index) of each child. Owning thread only.
+    std::vector<std::pair<int, int>> children;
+};
+
+// Call tree merged over all threads, built by calculateStats
+class CallTreeStats {
+public:
+    CallTreeStats(int sectionId, char const* sectionName);
+    ~CallTreeStats();
+
+    int sectionId;
     char const* sectionName;
-    double secondsAtStart;
+    int64_t count;
+    // Time from enter to exit
+    double inclusiveTime;
+    // Inclusive time minus the time spent in nested sections
+    double exclusiveTime;
+    int64_t overlapCount;
+    // Keyed by section id
+    std::map<int, CallTreeStats*> children;
 };
 
 class TimeRecordStop {
 public:
-    TimeRecordStop(char const* sectionName, double elapsedTime);
-    TimeRecordStop(char const* sectionName, double elapsedTime, int lineNumber, const char* fileName, const char* functionName);
+    TimeRecordStop();
+    TimeRecordStop(int sectionId, int64_t elapsedTicks);
+    TimeRecordStop(int sectionId, int64_t ticksAtStart, int64_t elapsedTicks, int threadIndex, int lineNumber, const char* fileName, const char* functionName);
     ~TimeRecordStop();
 
-    char const* sectionName;
-    double elapsedTime;
+    int sectionId;
+    // Raw clock ticks, converted to seconds when reporting. The start is an
+    // absolute timestamp, see GetStartTicks.
+    int64_t ticksAtStart;
+    int64_t elapsedTicks;
+    // Index of the thread that recorded it
+    int threadIndex;
     int lineNumber;
     const char* fileName;
     const char* functionName;
@@ -41,47 +216,563 @@ class ProfilerStats {
 public:
     ProfilerStats(char const* sectionName);
     ~ProfilerStats();
+    // Back to a freshly constructed state for another section, keeping the
+    // memory the timelines already have. Lets ObjectPool reuse it.
+    void reset(char const* sectionName);
 
     char const* sectionName;
-    int count;
+    int64_t count;
     double totalTime;
     double minTime;
     double maxTime;
     double avgTime;
+    double stdDevTime;
+    // Sum of squared differences from avgTime in seconds squared, as merged
+    // over the threads, which stdDevTime comes from
+    double m2;
+    // Tail latency from the section's histogram, in seconds
+    double p50Time;
+    double p90Time;
+    double p99Time;
+    double p999Time;
+    // Times with the profiler's own probe overhead taken out, see Profiler::calibrateOverhead
+    double correctedTotalTime;
+    double correctedMinTime;
+    double correctedMaxTime;
+    double correctedAvgTime;
+    // Statistical samples, see Profiler::startSampling. Samples counts the ones
+    // taken while the section was open, Self Samples the ones where it was the
+    // innermost open section, and the share is Samples over every sample taken.
+    int64_t samples;
+    int64_t selfSamples;
+    double sampleShare;
+    // Hardware counter totals indexed by PerfCounter, see
+    // Profiler::enableHardwareCounters. All 0 when counters were off.
+    int64_t counters[PERF_COUNTER_COUNT];
+    double instructionsPerCycle;
+    // Heap use, see Profiler::startAllocationTracking. Allocations and bytes
+    // are summed over all calls, the peak is the highest of any one call.
+    int64_t allocations;
+    int64_t allocatedBytes;
+    int64_t peakLiveBytes;
     const char* filename;
     const char* functionName;
     int lineNumber;
     std::vector<double> timeline;
+    // Distribution of call times. Merge histograms to combine runs.
+    std::shared_ptr<LatencyHistogram> histogram;
+    // Call number of each timeline point. Empty when the timeline has one point
+    // per call; filled when it was sampled in bounded-memory mode.
+    std::vector<int64_t> timelineCalls;
+};
+
+// Cumulative timeline holding at most a fixed number of points. Every
+// stride-th call is kept; when the buffer fills up, every other point is
+// dropped and the stride doubles, so the points always span the whole run.
+// The writer only takes the lock on calls it keeps.
+class SampledTimeline {
+public:
+    SampledTimeline(size_t capacity);
+    ~SampledTimeline();
+
+    // Writer thread only
+    void record(int64_t callNumber, int64_t cumulativeTicks);
+    // Safe from any thread. Times are converted to seconds.
+    void copyTo(std::vector<int64_t>& calls, std::vector<double>& times);
+
+    std::mutex mutex;
+    size_t capacity;
+    int64_t stride;
+    // Next call number to keep. Writer thread only.
+    int64_t nextSample;
+    std::vector<int64_t> calls;
+    std::vector<int64_t> ticks;
+};
+
+// Running statistics for one section on one thread, updated on every exit.
+// The mean and variance use Welford's update so they stay accurate over long
+// runs. Only the owning thread calls add(); readers take a consistent copy
+// through the sequence counter without ever blocking the writer.
+class SectionAccumulator {
+public:
+    SectionAccumulator(int sectionId, char const* sectionName);
+    ~SectionAccumulator();
+
+    // Writer thread only. counterDeltas and allocations are null when hardware
+    // counters and allocation tracking are off.
+    void add(int64_t elapsedTicks, int64_t correctedTicks, int64_t const* counterDeltas, SectionAllocations const* allocations, int lineNumber, const char* fileName, const char* functionName);
+    // Safe from any thread
+    void snapshot(SectionAccumulator& out) const;
+    // Combine another accumulator's totals into this one
+    void merge(SectionAccumulator const& other);
+
+    std::atomic<uint32_t> sequence;
+    int sectionId;
+    char const* sectionName;
+    int64_t count;
+    // Everything in clock ticks
+    int64_t totalTicks;
+    int64_t minTicks;
+    int64_t maxTicks;
+    double mean;
+    // Sum of squared differences from the mean
+    double m2;
+    // Overhead-corrected totals
+    int64_t correctedTotalTicks;
+    int64_t correctedMinTicks;
+    int64_t correctedMaxTicks;
+    // Hardware counter totals indexed by PerfCounter
+    int64_t counterTotals[PERF_COUNTER_COUNT];
+    // Heap use totals, and the highest peak of any call
+    int64_t allocations;
+    int64_t allocatedBytes;
+    int64_t peakLiveBytes;
+    int lineNumber;
+    const char* fileName;
+    const char* functionName;
+    // Distribution of call times, recorded next to the running stats
+    LatencyHistogram* histogram;
+    // Sampled timeline in bounded-memory mode, otherwise null
+    SampledTimeline* timeline;
+    // Next accumulator of the same thread
+    std::atomic<SectionAccumulator*> next;
+};
+
+// Sample counts for one thread, bumped from the SIGPROF handler. Section ids
+// from MAX_SECTIONS up are only counted in the totals.
+class SectionSamples {
+public:
+    static constexpr int MAX_SECTIONS = 4096;
+
+    SectionSamples();
+
+    std::atomic<int64_t> total;
+    // Samples with no section open
+    std::atomic<int64_t> outside;
+    // Indexed by section id
+    std::atomic<int64_t> open[MAX_SECTIONS];
+    std::atomic<int64_t> self[MAX_SECTIONS];
+};
+
+// One thread's state for one section, indexed by section id
+class ThreadSectionSlot {
+public:
+    ThreadSectionSlot();
+
+    // Interned name, set the first time the thread uses the section
+    char const* sectionName;
+    // Running stats, created on the first exit
+    SectionAccumulator* accumulator;
+};
+
+// Everything a single thread records. Only the owning thread writes to it, so the
+// hot path never takes a lock. Reports read the events through the buffer's
+// published size.
+class ProfilerThreadData {
+public:
+    ProfilerThreadData(int threadIndex);
+    ~ProfilerThreadData();
+
+    // Padding keeps two threads' hot members off the same cache line
+    char padBefore[64];
+    int threadIndex;
+    // Section state indexed by section id. Only the owning thread uses it.
+    std::vector<ThreadSectionSlot> sections;
+    // Section ids of names passed as raw pointers, so each pointer is only
+    // interned once per thread
+    std::unordered_map<char const*, int> sectionIdsByPointer;
+    // Function tracing: this thread's copy of Profiler::functionSectionIds, as
+    // of functionGeneration, and the address and section id (or -1) of every
+    // function entered and not yet exited, innermost last. Owning thread only.
+    std::unordered_map<void const*, int> functionIds;
+    uint64_t functionGeneration;
+    std::vector<std::pair<void const*, int>> openFunctions;
+    // Full event log, used when memory is unbounded
+    EventBuffer<TimeRecordStop> elapsedTimes;
+    // Most recent events, used in bounded-memory mode
+    EventRing<TimeRecordStop> recentEvents;
+    // Exits waiting for the trace writer. Empty unless a trace is being written.
+    EventQueue<TraceEvent> traceEvents;
+    // Number of exits recorded, published after the exit's stats and event
+    std::atomic<size_t> exitCount;
+    // Completed enter/exit pairs on this thread. Owning thread only.
+    int64_t probeCount;
+    // Open sections, innermost last. Owning thread only.
+    std::vector<TimeRecordStart> activeSections;
+    // The ids in activeSections again, in a fixed array a signal handler can
+    // read at any moment. Entries past MAX_SAMPLED_DEPTH are left out.
+    static constexpr int MAX_SAMPLED_DEPTH = 64;
+    int sampledStack[MAX_SAMPLED_DEPTH];
+    std::atomic<int> sampledDepth;
+    // Null unless sampling has been started
+    std::atomic<SectionSamples*> samples;
+    // Opened on the thread's first section once hardware counters are on,
+    // otherwise null
+    PerfCounters* perfCounters;
+    // Set while the thread runs profiler code, so the profiler's own heap use
+    // isn't counted against a section
+    bool insideProbe;
+    // Set between Profiler::suspendRecording and resumeRecording
+    bool recordingSuspended;
+    // Bytes of tracked allocations made minus tracked bytes freed on this
+    // thread. Owning thread only.
+    int64_t liveBytes;
+    // Nodes of this thread's call tree, in creation order, so a parent always
+    // comes before its children
+    EventBuffer<CallTreeNode, 256> callTree;
+    // The same nodes by index, and the top-level nodes as (section id, node
+    // index). Owning thread only.
+    std::vector<CallTreeNode*> callTreeNodes;
+    std::vector<std::pair<int, int>> callTreeRoots;
+    // Every accumulator in sections, as a list readers can walk while new ones are added
+    std::atomic<SectionAccumulator*> accumulators;
+    // Number of events already folded into the report timelines. Report side only.
+    size_t reportedEvents;
+    char padAfter[64];
 };
 
 class Profiler {
 public:
     ~Profiler();
 
-    void EnterSection(char const* sectionName);
+    // Turns a name into a section id. Call it once and keep the id; the
+    // id-based overloads below skip every name lookup.
+    static int RegisterSection(char const* sectionName);
+    static int RegisterSection(std::string const& sectionName);
+
+    SectionToken EnterSection(int sectionId);
+    void ExitSection(int sectionId);
+    void ExitSection(int sectionId, int lineNumber, const char* fileName, const char* functionName);
+    // Ends the activation the token came from. A section entered with
+    // EnterSection must end on the same thread, and throws
+    // std::invalid_argument otherwise; one entered with EnterAsyncSection may
+    // end on any thread.
+    void ExitSection(SectionToken const& token);
+    void ExitSection(SectionToken const& token, int lineNumber, const char* fileName, const char* functionName);
+    // Starts a section that isn't part of any thread's nesting, e.g. a request
+    // handed between threads or several overlapping ones on the same thread.
+    // Its time counts for the thread that exits it, which is the only thread it
+    // touches. It has no call tree node, and enclosing sections don't count it
+    // as child time; hardware counters and allocations aren't recorded for it.
+    SectionToken EnterAsyncSection(int sectionId);
+    // Name-based overloads. Each distinct pointer is interned once per thread.
+    SectionToken EnterSection(char const* sectionName);
     void ExitSection(char const* sectionName);
     void ExitSection(char const* sectionName, int lineNumber, const char* fileName, const char* functionName);
+    // Stops recording sections on the calling thread until resumeRecording,
+    // e.g. while a benchmark warms up. Its probes do nothing meanwhile, so a
+    // section entered while suspended must exit while suspended, and one open
+    // at the suspension must exit after resuming. Functions entered while
+    // suspended aren't traced.
+    void suspendRecording();
+    void resumeRecording();
     void calculateStats();
+    // Throws std::out_of_range if no section by that name has recorded a call
     ProfilerStats calculateStats(char const* sectionName);
     void printStats();
+    // Clears everything recorded so far. Call it while no thread is inside a section.
     void reset();
 
-    static Profiler* gProfiler;
+    // Number of threads that have recorded at least one section
+    int getThreadCount();
+
+    // Bounds the profiler's memory for long runs. Aggregate stats stay exact;
+    // each thread keeps only its most recent raw events and each section's
+    // timeline is sampled down to a fixed number of points. Passing 0 for both
+    // restores the default of keeping every event. Discards everything recorded
+    // so far, so call it while no thread is inside a section.
+    void setMemoryLimits(size_t recentEventsPerThread, size_t timelinePointsPerSection);
+    bool isMemoryBounded();
+    // Sections arranged by the path of enclosing sections they ran under,
+    // merged over all threads. The root itself is an empty placeholder.
+    CallTreeStats const& getCallTree();
+    // Writes the call tree in the collapsed-stack format flame graph tools read:
+    // one "outer;inner;innermost <self nanoseconds>" line per node
+    void saveCallTreeToCollapsed(const char* filename);
+
+    // Streams every exit to a binary trace file as the program runs. Each
+    // thread queues up to eventsPerThread exits for a background thread that
+    // writes them out every few milliseconds; if it falls that far behind, new
+    // exits are dropped from the trace (the stats still count them). Pair it
+    // with setMemoryLimits to keep the in-memory history bounded as well. Call
+    // both while no thread is inside a section. Throws std::runtime_error if the
+    // file can't be created.
+    void startTrace(const char* filename, size_t eventsPerThread = 65536);
+    // Writes out what is still queued and closes the trace
+    void stopTrace();
+    bool isTracing();
+    // Adds the exits in a trace file to this profiler, as if they were recorded
+    // here; each thread of the trace becomes a new thread. Call tree and timing
+    // of nesting are not part of the trace. The trace's probe costs only go to
+    // the reports, see getReportedProbeOverhead; this process's own
+    // measurements keep being corrected with its own calibration. Throws
+    // std::runtime_error if the file isn't a trace.
+    void loadTrace(const char* filename);
+
+    // Every section's totals over all threads, with their histograms, samples
+    // and call sites, in a form that merges with other processes' snapshots.
+    // See stats_snapshot.hpp.
+    StatsSnapshot getSnapshot();
+    // Writes getSnapshot() to a binary file, for combining the profiles of
+    // many worker processes with profile_merge. Throws std::runtime_error if
+    // the file can't be written.
+    void saveSnapshot(const char* filename);
+    // Adds a snapshot's totals to this profiler as one new thread, so the
+    // reports include them. Snapshots have no raw events, timelines or call
+    // tree. Its probe costs only go to the reports, as with loadTrace. Throws
+    // std::runtime_error if the file isn't a snapshot.
+    void loadSnapshot(const char* filename);
+    void loadSnapshot(StatsSnapshot const& snapshot);
+
+    // Statistical sampling, for code too hot to instrument on every call. A
+    // SIGPROF timer fires samplesPerSecond times per second of CPU time, and the
+    // handler counts which sections are open on the interrupted thread. Reports
+    // then show each section's samples and share next to its measured times.
+    // Probes keep working as usual. CPU-time timers expire on the kernel's
+    // scheduler tick, so the real rate tops out at its tick rate (often
+    // 100-1000 Hz). Throws std::runtime_error where SIGPROF doesn't exist.
+    // Call it while no thread is inside a section.
+    void startSampling(int samplesPerSecond = 1000);
+    void stopSampling();
+    bool isSampling();
+    // Samples taken since the last reset, including ones outside every section
+    int64_t getSampleCount();
+
+    // Publishes every section's call count, average, maximum and percentiles
+    // to the shared-memory segment /profiler-<pid> every intervalMs, for
+    // watching a process that never exits. Run `make tools` and
+    // `./profiler_top <pid>` to see them. A background thread builds the totals
+    // the same way calculateStats does, so the profiled threads never wait on
+    // it or on the readers. Throws std::runtime_error if the segment can't be
+    // created or the platform has no POSIX shared memory.
+    void startLiveStats(int intervalMs = 1000);
+    // Stops publishing and removes the segment
+    void stopLiveStats();
+    bool isPublishingLiveStats();
+
+    // Rolls every section's calls up into fixed windows of windowSeconds and
+    // keeps the most recent windowCount of them, each with the section's count,
+    // average, maximum and P99 in that window. Unlike the cumulative timeline
+    // this shows trends such as warm-up or a section slowly getting slower, at
+    // constant memory. A background thread closes each window by diffing the
+    // running totals, so the probes don't change. saveStatsToJSON writes the
+    // windows as a time series. Starting again drops the earlier windows.
+    void startWindows(double windowSeconds = 1.0, size_t windowCount = 60);
+    // Closes the current, partial window. The windows stay until the next
+    // start or reset.
+    void stopWindows();
+    bool isRecordingWindows();
+    // Oldest first
+    std::vector<StatsWindow> getWindows();
+
+    // Counts CPU cycles, instructions, branch misses and L1D/LLC misses inside
+    // every section, through Linux perf_event_open. Each thread opens its own
+    // counters on its first section after this. Reports then add each
+    // section's totals and instructions per cycle. Returns false and leaves the
+    // profiler on wall time alone when the kernel denies access (see
+    // /proc/sys/kernel/perf_event_paranoid) or the machine has no such counters,
+    // e.g. in many virtual machines. Call it while no thread is inside a section.
+    bool enableHardwareCounters();
+    void disableHardwareCounters();
+    bool isUsingHardwareCounters();
+
+    // Counts heap allocations through the global operator new and delete
+    // replacements in allocation_hooks.cpp. Each allocation counts towards the
+    // innermost section open on the allocating thread, and each exit records
+    // how far the thread's live heap bytes rose above where they were at entry.
+    // Memory freed on another thread than the one that allocated it lowers the
+    // freeing thread's level instead. The profiler's own allocations aren't
+    // counted. Call it while no thread is inside a section. Returns false and
+    // leaves tracking off when the program wasn't built with
+    // PROFILER_ALLOCATION_HOOKS defined.
+    bool startAllocationTracking();
+    void stopAllocationTracking();
+    bool isTrackingAllocations();
+    // Called by the operator new and delete replacements. OnAllocation returns
+    // whether it counted the allocation; only those are passed back to
+    // OnDeallocation.
+    static bool OnAllocation(size_t size);
+    static void OnDeallocation(size_t size);
+    // Whether allocation_hooks.cpp replaced operator new and delete
+    static bool HasAllocationHooks();
+
+    // Times every function compiled with -finstrument-functions as a section
+    // named after it, through the hooks in function_hooks.cpp. The probes only
+    // see the function's address; its name is looked up in the symbol tables
+    // when a report first needs it, and the reports give no file, line or
+    // calling function for these sections. Build the code to trace with
+    // -finstrument-functions, and the profiler's own sources without it (or
+    // list them in -finstrument-functions-exclude-file-list). Functions
+    // entered before tracing starts aren't timed; ones still running when it
+    // stops are timed to their end.
+    void startFunctionTracing();
+    void stopFunctionTracing();
+    bool isTracingFunctions();
+    // Limits tracing to functions whose demangled name matches one of the
+    // include patterns (all of them when there are none) and none of the
+    // exclude patterns. '*' matches any run of characters, e.g. "MyApp::*" or
+    // "std::*". Each function is then named the first time it runs, to decide
+    // whether to time it; excluded ones cost one lookup per call.
+    void setFunctionFilters(std::vector<std::string> const& include, std::vector<std::string> const& exclude);
+    // Called by the -finstrument-functions hooks
+    static void OnFunctionEnter(void* function);
+    static void OnFunctionExit(void* function);
+
+    // The raw events still held, thread by thread, oldest first
+    std::vector<TimeRecordStop> getRecentEvents();
+    // Writes the raw events still held in the Chrome Trace Event format, one
+    // complete ("X") event per exit with its start time, duration and thread,
+    // so a run can be opened in chrome://tracing or ui.perfetto.dev. Times are
+    // microseconds since the program started. In bounded-memory mode only the
+    // recent events are kept, so only they are written.
+    void saveChromeTrace(const char* filename);
+    // The same events as a bare JSON array without call sites or thread names,
+    // about half the size. Perfetto and chrome://tracing both load it.
+    void saveCompactChromeTrace(const char* filename);
+
+    // Measures what the profiler's own probes cost on this machine. Every exit
+    // then subtracts the measurement bias (what an empty section reads) from its
+    // own time, and one full enter/exit cost for each probe that completed
+    // inside it. Runs on construction and whenever the memory limits change.
+    void calibrateOverhead();
+    // Seconds an empty section reports
+    double getMeasurementBias();
+    // Seconds one nested enter/exit pair adds to its enclosing section
+    double getProbeOverhead();
+    // The probe costs the reports and snapshots show: the loaded ones once a
+    // trace or snapshot has been loaded, otherwise this process's own
+    double getReportedMeasurementBias();
+    double getReportedProbeOverhead();
+
+    static std::atomic<Profiler*> gProfiler;
     // Singleton. Static exists at the class level.
     static Profiler* GetInstance();
 
     // Used to save the statistics to a CSV file
     void saveStatsToCSV(const char* filename);
-    // Used to save the statistics to a JSON file
-    void saveStatsToJSON(const char* filename);
+    // Used to save the statistics to a JSON file. Compact output leaves out all
+    // the indentation and line breaks.
+    //
+    // Timelines longer than TIMELINE_INLINE_POINTS are written downsampled to
+    // that many points, with "Timeline Calls" saying which calls they are. The
+    // finer levels, each TIMELINE_LEVEL_FACTOR times the points of the one
+    // before and the last one the whole timeline, go into a second file next to
+    // it, "<name>.timeline.json" for "<name>.json", named by the top-level
+    // "Timeline File" key. Each section's "Timeline Levels" gives the points,
+    // byte offset and length of its levels there, so a viewer can read just the
+    // one it needs.
+    void saveStatsToJSON(const char* filename, bool compact = false);
+    static constexpr size_t TIMELINE_INLINE_POINTS = 1024;
+    static constexpr size_t TIMELINE_LEVEL_FACTOR = 8;
 
 private:
     Profiler();
-    void ReportSectionTime(char const* sectionName, double elapsedTime);
-    void ReportSectionTime(char const* sectionName, double elapsedTime, int lineNumber, const char* fileName, const char* functionName);
-    std::map<char const*, ProfilerStats*> stats;
-    // std::vector<TimeRecordStart> startTimes;
-    std::vector<TimeRecordStop> elapsedTimes;
-    // Map from section name to start time
-    std::map<char const*, std::vector<TimeRecordStart>> startTimes;
+    void ReportSectionTime(char const* sectionName, int64_t elapsedTicks);
+    void ReportSectionTime(char const* sectionName, int64_t elapsedTicks, int lineNumber, const char* fileName, const char* functionName);
+    // Returns the calling thread's data, registering the thread on first use
+    ProfilerThreadData* GetThreadData();
+    // The calling thread's data in the current profiler, or null if it hasn't
+    // registered. Never allocates, so the allocation hooks can use it.
+    static ProfilerThreadData* FindThreadData();
+    int getFunctionSectionId(void const* function);
+    // SIGPROF handler. Only touches atomics and the interrupted thread's data.
+    static void OnSampleSignal(int signal);
+    // Rewrites the sampled stack from the given depth of activeSections up
+    static void syncSampledStack(ProfilerThreadData* thread, size_t from);
+    SectionToken enterSection(ProfilerThreadData* thread, int sectionId);
+    void exitSection(ProfilerThreadData* thread, int sectionId, int64_t ticksAtStop, int lineNumber, const char* fileName, const char* functionName);
+    // Ends the activation at that position on the thread's stack
+    void exitActivation(ProfilerThreadData* thread, int position, int64_t ticksAtStop, int lineNumber, const char* fileName, const char* functionName);
+    // Section id for a raw name pointer, using the thread's cache
+    static int GetSectionId(ProfilerThreadData* thread, char const* sectionName);
+    // The thread's slot for a section, growing the table on first use
+    static ThreadSectionSlot& GetSlot(ProfilerThreadData* thread, int sectionId);
+    void clearStats();
+    // Update the calling thread's running stats, then log the event
+    void recordExit(ProfilerThreadData* thread, int sectionId, ThreadSectionSlot& slot, int64_t ticksAtStart, int64_t elapsedTicks, int64_t correctedTicks, int64_t const* counterDeltas, SectionAllocations const* allocations, int lineNumber, const char* fileName, const char* functionName);
+    // Visits the raw events still held, thread by thread, oldest first
+    template <typename Fn>
+    void forEachEvent(Fn&& fn);
+    void writeTraceEvents(const char* filename, bool compact);
+    // Totals for the live stats segment, on the publishing thread
+    void collectLiveStats(std::vector<LiveSectionStats>& sections, uint32_t& threadCount);
+    // Every thread's running totals, on the window thread
+    void collectWindowTotals(std::vector<WindowTotals>& totals);
+    ProfilerStats* findOrCreateStats(std::map<int, ProfilerStats*>& into, int sectionId);
+    static void copyStats(ProfilerStats* stat, SectionAccumulator const& totals);
+    static void copyPercentiles(ProfilerStats* stat, std::shared_ptr<LatencyHistogram> histogram);
+    // Builds the combined timelines from the per-thread sampled ones
+    void combineSampledTimelines();
+    // Node for a section under the given parent node, created on first use
+    static int GetCallTreeNode(ProfilerThreadData* thread, int parentIndex, int sectionId);
+    void buildCallTree();
+    static void printCallTree(CallTreeStats const* node, int depth);
+    static void writeCallTreeJSON(ReportWriter& file, CallTreeStats const* node, int depth, bool compact);
+    static void writeCollapsed(ReportWriter& file, CallTreeStats const* node, std::string const& path);
+
+    // Stats combined over all threads, keyed by section id
+    std::map<int, ProfilerStats*> stats;
+    // Stats for each thread, indexed by thread index
+    std::vector<std::map<int, ProfilerStats*>> threadStats;
+    // Stats dropped by clearStats, reused by findOrCreateStats
+    ObjectPool<ProfilerStats> statsPool;
+    // Call tree combined over all threads
+    CallTreeStats callTree;
+    // Total events and threads the current stats were built from. Reports are
+    // only rebuilt when one of them has changed.
+    size_t statsEventCount;
+    size_t statsThreadCount;
+
+    // Every thread that has recorded into this profiler. Only locked when a
+    // thread registers and when a report is built.
+    std::mutex threadsMutex;
+    std::vector<ProfilerThreadData*> threads;
+    // Calibrated probe costs in ticks
+    int64_t measurementBiasTicks;
+    int64_t probeOverheadTicks;
+    // Largest probe costs among the loaded traces and snapshots, which their
+    // times were already corrected with. Kept apart from the calibration above, which
+    // only ever corrects this process's own measurements. -1 until a load.
+    int64_t loadedMeasurementBiasTicks;
+    int64_t loadedProbeOverheadTicks;
+
+    // Memory limits, 0 when unbounded
+    size_t recentEventsPerThread;
+    size_t timelinePointsPerSection;
+
+    // Trace file being written, and each thread's queue size, 0 when not tracing
+    TraceWriter traceWriter;
+    size_t traceEventsPerThread;
+    // File and function names read from trace files and snapshots. A deque
+    // never moves its elements, so the stats can point into it.
+    std::deque<std::string> loadedNames;
+
+    // Segment the live stats are published to, see startLiveStats
+    LiveStatsWriter liveStatsWriter;
+    // Fixed-interval rollups, see startWindows
+    WindowRoller windowRoller;
+
+    // Sampling rate, 0 when not sampling, and samples that landed on threads
+    // this profiler has never seen
+    int samplesPerSecond;
+    std::atomic<int64_t> unregisteredSamples;
+    // Samples the current stats were built from
+    int64_t statsSampleCount;
+
+    // Whether sections read the hardware counters
+    bool hardwareCounters;
+    // Read by the allocation hooks on every thread
+    std::atomic<bool> trackingAllocations;
+    // Read by the function hooks on every thread
+    std::atomic<bool> tracingFunctions;
+    // Section id of every function seen, or -1 when the filters leave it out.
+    // Threads cache them, and drop their caches when functionGeneration changes.
+    std::mutex functionMutex;
+    std::unordered_map<void const*, int> functionSectionIds;
+    std::vector<std::string> functionIncludes;
+    std::vector<std::string> functionExcludes;
+    std::atomic<uint64_t> functionGeneration;
+
+    // Distinguishes this profiler from earlier instances in the thread-local cache
+    uint64_t instanceId;
 };
\ No newline at end of file
@@ -0,0 +1,395 @@
+#include "report_reader.hpp"
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <limits>
+#include <sstream>
+#include <stdexcept>
+#include <unordered_map>
+
+namespace {
+    // Pull parser over a whole JSON document in memory. Values the caller
+    // doesn't ask for are skipped without building anything, which keeps
+    // multi-megabyte reports with long timelines quick to load.
+    class JsonParser {
+    public:
+        JsonParser(std::string const& text): begin(text.c_str()), current(text.c_str()), end(text.c_str() + text.size()) {}
+
+        void expect(char c) {
+            if (!consume(c)) {
+                fail(std::string("expected '") + c + "'");
+            }
+        }
+
+        bool consume(char c) {
+            skipSpace();
+            if (current < end && *current == c) {
+                current++;
+                return true;
+            }
+            return false;
+        }
+
+        char peek() {
+            skipSpace();
+            return current < end ? *current : '\0';
+        }
+
+        // Calls fn(key) for every member; fn must read or skip the value
+        template <typename Fn>
+        void forEachMember(Fn&& fn) {
+            expect('{');
+            if (consume('}')) {
+                return;
+            }
+            do {
+                std::string key = readString();
+                expect(':');
+                fn(key);
+            } while (consume(','));
+            expect('}');
+        }
+
+        // Calls fn() for every element; fn must read or skip it
+        template <typename Fn>
+        void forEachElement(Fn&& fn) {
+            expect('[');
+            if (consume(']')) {
+                return;
+            }
+            do {
+                fn();
+            } while (consume(','));
+            expect(']');
+        }
+
+        std::string readString() {
+            skipSpace();
+            if (current >= end || *current != '"') {
+                fail("expected a string");
+            }
+            current++;
+            std::string text;
+            while (true) {
+                char const* run = current;
+                while (current < end && *current != '"' && *current != '\\') {
+                    current++;
+                }
+                text.append(run, current);
+                if (current >= end) {
+                    fail("unterminated string");
+                }
+                if (*current++ == '"') {
+                    return text;
+                }
+                readEscape(text);
+            }
+        }
+
+        // null reads as NaN
+        double readNumber() {
+            skipSpace();
+            if (end - current >= 4 && std::strncmp(current, "null", 4) == 0) {
+                current += 4;
+                return std::numeric_limits<double>::quiet_NaN();
+            }
+            char* after;
+            double value = std::strtod(current, &after);
+            if (after == current) {
+                fail("expected a number");
+            }
+            current = after;
+            return value;
+        }
+
+        void skipValue() {
+            char c = peek();
+            if (c == '{') {
+                forEachMember([this](std::string const&) { skipValue(); });
+            } else if (c == '[') {
+                forEachElement([this]() { skipValue(); });
+            } else if (c == '"') {
+                skipString();
+            } else if (c == 't' || c == 'f' || c == 'n') {
+                while (current < end && *current >= 'a' && *current <= 'z') {
+                    current++;
+                }
+            } else {
+                readNumber();
+            }
+        }
+
+    private:
+        void skipSpace() {
+            while (current < end && (*current == ' ' || *current == '\n' || *current == '\r' || *current == '\t')) {
+                current++;
+            }
+        }
+
+        void skipString() {
+            current++;
+            while (current < end && *current != '"') {
+                current += *current == '\\' ? 2 : 1;
+            }
+            if (current >= end) {
+                fail("unterminated string");
+            }
+            current++;
+        }
+
+        void readEscape(std::string& text) {
+            if (current >= end) {
+                fail("unterminated string");
+            }
+            char c = *current++;
+            switch (c) {
+                case 'b': text += '\b'; return;
+                case 'f': text += '\f'; return;
+                case 'n': text += '\n'; return;
+                case 'r': text += '\r'; return;
+                case 't': text += '\t'; return;
+                case 'u': break;
+                default: text += c; return;
+            }
+
+            uint32_t code = readHex4();
+            // A surrogate pair spells one character outside the basic plane
+            if (code >= 0xD800 && code < 0xDC00 && end - current >= 6 && current[0] == '\\' && current[1] == 'u') {
+                current += 2;
+                uint32_t low = readHex4();
+                code = 0x10000 + ((code - 0xD800) << 10) + (low - 0xDC00);
+            }
+            if (code < 0x80) {
+                text += (char)code;
+            } else if (code < 0x800) {
+                text += (char)(0xC0 | (code >> 6));
+                text += (char)(0x80 | (code & 0x3F));
+            } else if (code < 0x10000) {
+                text += (char)(0xE0 | (code >> 12));
+                text += (char)(0x80 | ((code >> 6) & 0x3F));
+                text += (char)(0x80 | (code & 0x3F));
+            } else {
+                text += (char)(0xF0 | (code >> 18));
+                text += (char)(0x80 | ((code >> 12) & 0x3F));
+                text += (char)(0x80 | ((code >> 6) & 0x3F));
+                text += (char)(0x80 | (code & 0x3F));
+            }
+        }
+
+        uint32_t readHex4() {
+            if (end - current < 4) {
+                fail("truncated \\u escape");
+            }
+            char digits[5] = { current[0], current[1], current[2], current[3], '\0' };
+            char* after;
+            uint32_t code = (uint32_t)std::strtoul(digits, &after, 16);
+            if (after != digits + 4) {
+                fail("bad \\u escape");
+            }
+            current += 4;
+            return code;
+        }
+
+        [[noreturn]] void fail(std::string const& message) {
+            throw std::runtime_error("JSON error at byte " + std::to_string(current - begin) + ": " + message);
+        }
+
+        char const* begin;
+        char const* current;
+        char const* end;
+    };
+
+    void ReadSection(JsonParser& parser, ReportSection& section) {
+        parser.forEachMember([&](std::string const& key) {
+            if (key == "Section Name") {
+                section.sectionName = parser.readString();
+            } else if (key == "Filename") {
+                section.fileName = parser.readString();
+            } else if (key == "Function Name") {
+                section.functionName = parser.readString();
+            } else if (key == "Line Number") {
+                section.lineNumber = (int)parser.readNumber();
+            } else if (key == "Count") {
+                section.count = (int64_t)parser.readNumber();
+            } else if (key == "Total Time") {
+                section.totalTime = parser.readNumber();
+            } else if (key == "Min Time") {
+                section.minTime = parser.readNumber();
+            } else if (key == "Max Time") {
+                section.maxTime = parser.readNumber();
+            } else if (key == "Avg Time") {
+                section.avgTime = parser.readNumber();
+            } else if (key == "Std Dev Time") {
+                section.stdDevTime = parser.readNumber();
+            } else if (key == "P99 Time") {
+                section.p99Time = parser.readNumber();
+            } else if (key == "Timeline") {
+                parser.forEachElement([&]() { section.timeline.push_back(parser.readNumber()); });
+            } else if (key == "Timeline Calls") {
+                parser.forEachElement([&]() { section.timelineCalls.push_back((int64_t)parser.readNumber()); });
+            } else {
+                parser.skipValue();
+            }
+        });
+    }
+
+    // Splits one line at the commas outside quotes. Quoted fields, such as
+    // demangled function names, have their quotes removed and doubled quotes
+    // turned back into one.
+    void SplitFields(std::string const& line, std::vector<std::string>& fields) {
+        fields.clear();
+        std::string field;
+        bool quoted = false;
+        for (size_t i = 0; i < line.size(); i++) {
+            char c = line[i];
+            if (quoted) {
+                if (c != '"') {
+                    field += c;
+                } else if (i + 1 < line.size() && line[i + 1] == '"') {
+                    field += '"';
+                    i++;
+                } else {
+                    quoted = false;
+                }
+            } else if (c == '"') {
+                quoted = true;
+            } else if (c == ',') {
+                fields.push_back(field);
+                field.clear();
+            } else {
+                field += c;
+            }
+        }
+        // Every row ends in a comma, which leaves nothing after the last one
+        if (!field.empty()) {
+            fields.push_back(field);
+        }
+    }
+
+    // Every column saveStatsToCSV has written
+    bool IsColumnName(std::string const& name) {
+        static char const* const names[] = {
+            "Section Name", "Count", "Total Time", "Min Time", "Max Time", "Avg Time", "Std Dev Time",
+            "P50 Time", "P90 Time", "P99 Time", "P99.9 Time", "Corrected Total Time", "Corrected Min Time",
+            "Corrected Max Time", "Corrected Avg Time", "Samples", "Self Samples", "Sample Share",
+            "Cycles", "Instructions", "Branch Misses", "L1D Misses", "LLC Misses", "IPC",
+            "Allocations", "Allocated Bytes", "Peak Live Bytes", "Filename", "Function Name", "Line Number", "Thread"
+        };
+        for (char const* known : names) {
+            if (name == known) {
+                return true;
+            }
+        }
+        return false;
+    }
+}
+
+ReportSection::ReportSection(): fileName("null"), functionName("null"), lineNumber(0), count(0), totalTime(0), minTime(0), maxTime(0), avgTime(0), stdDevTime(-1), p99Time(-1) {}
+
+std::vector<ReportSection> ParseReportJSON(std::string const& text) {
+    JsonParser parser(text);
+    std::vector<ReportSection> sections;
+    bool found = false;
+    parser.forEachMember([&](std::string const& key) {
+        if (key != "profiler") {
+            parser.skipValue();
+            return;
+        }
+        found = true;
+        parser.forEachElement([&]() {
+            sections.emplace_back();
+            ReadSection(parser, sections.back());
+        });
+    });
+    if (!found) {
+        throw std::runtime_error("JSON has no \"profiler\" array of sections");
+    }
+    return sections;
+}
+
+std::vector<ReportSection> ParseReportCSV(std::string const& text) {
+    std::istringstream lines(text);
+    std::string line;
+    std::vector<std::string> fields;
+    if (!std::getline(lines, line)) {
+        throw std::runtime_error("CSV is empty");
+    }
+    if (!line.empty() && line.back() == '\r') {
+        line.pop_back();
+    }
+    SplitFields(line, fields);
+
+    // The header is the run of known column names. Older versions left out the
+    // line break after it, so the first row may follow on the same line.
+    std::unordered_map<std::string, size_t> columns;
+    size_t headerLength = 0;
+    while (headerLength < fields.size() && IsColumnName(fields[headerLength])) {
+        columns[fields[headerLength]] = headerLength;
+        headerLength++;
+    }
+    if (columns.count("Section Name") == 0 || columns.count("Count") == 0) {
+        throw std::runtime_error("CSV header has no Section Name and Count columns");
+    }
+
+    auto textField = [&](std::vector<std::string> const& row, char const* name, std::string const& fallback) {
+        auto column = columns.find(name);
+        return column != columns.end() && column->second < row.size() ? row[column->second] : fallback;
+    };
+    auto numberField = [&](std::vector<std::string> const& row, char const* name, double fallback) {
+        auto column = columns.find(name);
+        return column != columns.end() && column->second < row.size() ? std::strtod(row[column->second].c_str(), nullptr) : fallback;
+    };
+
+    std::vector<ReportSection> sections;
+    std::vector<std::string> row(fields.begin() + headerLength, fields.end());
+    while (true) {
+        // Only the rows combined over all threads
+        if (row.size() >= headerLength && textField(row, "Thread", "all") == "all") {
+            sections.emplace_back();
+            ReportSection& section = sections.back();
+            section.sectionName = textField(row, "Section Name", "");
+            section.fileName = textField(row, "Filename", "null");
+            section.functionName = textField(row, "Function Name", "null");
+            section.lineNumber = (int)numberField(row, "Line Number", 0);
+            section.count = (int64_t)numberField(row, "Count", 0);
+            section.totalTime = numberField(row, "Total Time", 0);
+            section.minTime = numberField(row, "Min Time", 0);
+            section.maxTime = numberField(row, "Max Time", 0);
+            section.avgTime = numberField(row, "Avg Time", 0);
+            section.stdDevTime = numberField(row, "Std Dev Time", -1);
+            section.p99Time = numberField(row, "P99 Time", -1);
+        }
+
+        if (!std::getline(lines, line)) {
+            break;
+        }
+        if (!line.empty() && line.back() == '\r') {
+            line.pop_back();
+        }
+        SplitFields(line, row);
+    }
+    return sections;
+}
+
+std::vector<ReportSection> LoadReport(const char* filename) {
+    std::ifstream file(filename, std::ios::binary);
+    if (!file.is_open()) {
+        throw std::runtime_error(std::string("Could not open report ") + filename);
+    }
+    std::string text;
+    file.seekg(0, std::ios::end);
+    text.resize((size_t)file.tellg());
+    file.seekg(0, std::ios::beg);
+    file.read(&text[0], text.size());
+
+    size_t first = text.find_first_not_of(" \t\r\n");
+    try {
+        if (first != std::string::npos && text[first] == '{') {
+            return ParseReportJSON(text);
+        }
+        return ParseReportCSV(text);
+    } catch (std::runtime_error const& error) {
+        throw std::runtime_error(std::string(filename) + ": " + error.what());
+    }
+}
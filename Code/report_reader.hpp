@@ -0,0 +1,39 @@
+//report_reader.hpp
+#pragma once
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// Reads back the combined stats of a report written by saveStatsToJSON or
+// saveStatsToCSV, for tools that compare runs. Columns are found by their
+// names, so reports from older versions with fewer columns load as well; what
+// a report doesn't have is left at its default.
+
+// One section of a saved report. Times are in seconds.
+class ReportSection {
+public:
+    ReportSection();
+
+    std::string sectionName;
+    std::string fileName;
+    std::string functionName;
+    int lineNumber;
+    int64_t count;
+    double totalTime;
+    double minTime;
+    double maxTime;
+    double avgTime;
+    // Negative when the report doesn't have it
+    double stdDevTime;
+    double p99Time;
+    // Cumulative time after each call, or after the calls in timelineCalls when
+    // it was sampled. Always empty for CSV reports.
+    std::vector<double> timeline;
+    std::vector<int64_t> timelineCalls;
+};
+
+// Loads a JSON or CSV report, told apart by their first character. Throws
+// std::runtime_error if the file can't be read or isn't a report.
+std::vector<ReportSection> LoadReport(const char* filename);
+std::vector<ReportSection> ParseReportJSON(std::string const& text);
+std::vector<ReportSection> ParseReportCSV(std::string const& text);
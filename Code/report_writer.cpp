@@ -0,0 +1,426 @@
+#include "report_writer.hpp"
+#include <cmath>
+#include <cstring>
+
+namespace {
+    // Grisu2, after Florian Loitsch, "Printing Floating-Point Numbers Quickly and
+    // Accurately with Integers" (2010). The value and the two halfway points to
+    // its neighbours are scaled by a cached power of ten into 64-bit fixed point,
+    // and digits are generated until they pin down the value inside that range.
+    // The result always reads back exactly and is the shortest such decimal for
+    // all but a tiny fraction of inputs.
+
+    // A 64-bit significand and a binary exponent, value = f * 2^e
+    struct DiyFp {
+        DiyFp(uint64_t f, int e): f(f), e(e) {}
+
+        explicit DiyFp(double value) {
+            uint64_t bits;
+            std::memcpy(&bits, &value, sizeof(bits));
+            uint64_t significand = bits & SIGNIFICAND_MASK;
+            int biasedExponent = (int)((bits & EXPONENT_MASK) >> SIGNIFICAND_BITS);
+            if (biasedExponent != 0) {
+                f = significand + HIDDEN_BIT;
+                e = biasedExponent - EXPONENT_BIAS;
+            } else {
+                // Subnormal
+                f = significand;
+                e = 1 - EXPONENT_BIAS;
+            }
+        }
+
+        DiyFp operator-(DiyFp const& other) const {
+            return DiyFp(f - other.f, e);
+        }
+
+        // Upper 64 bits of the product, rounded
+        DiyFp operator*(DiyFp const& other) const {
+            unsigned __int128 product = (unsigned __int128)f * other.f;
+            uint64_t high = (uint64_t)(product >> 64);
+            uint64_t low = (uint64_t)product;
+            if (low & (uint64_t(1) << 63)) {
+                high++;
+            }
+            return DiyFp(high, e + other.e + 64);
+        }
+
+        DiyFp normalize() const {
+            int shift = __builtin_clzll(f);
+            return DiyFp(f << shift, e - shift);
+        }
+
+        // The halfway points to the neighbouring doubles, both with the upper
+        // one's exponent
+        void boundaries(DiyFp& minus, DiyFp& plus) const {
+            plus = DiyFp((f << 1) + 1, e - 1).normalize();
+            // At a power of two the neighbour below is twice as close
+            minus = f == HIDDEN_BIT ? DiyFp((f << 2) - 1, e - 2) : DiyFp((f << 1) - 1, e - 1);
+            minus.f <<= minus.e - plus.e;
+            minus.e = plus.e;
+        }
+
+        static constexpr int SIGNIFICAND_BITS = 52;
+        static constexpr int EXPONENT_BIAS = 0x3FF + SIGNIFICAND_BITS;
+        static constexpr uint64_t SIGNIFICAND_MASK = (uint64_t(1) << SIGNIFICAND_BITS) - 1;
+        static constexpr uint64_t EXPONENT_MASK = uint64_t(0x7FF) << SIGNIFICAND_BITS;
+        static constexpr uint64_t HIDDEN_BIT = uint64_t(1) << SIGNIFICAND_BITS;
+
+        uint64_t f;
+        int e;
+    };
+
+    // Normalized 10^k for k = -348, -340, ..., 340, rounded to nearest
+    struct CachedPower {
+        uint64_t f;
+        int e;
+    };
+    CachedPower const CACHED_POWERS[] = {
+        { 0xfa8fd5a0081c0288ULL, -1220 }, { 0xbaaee17fa23ebf76ULL, -1193 }, { 0x8b16fb203055ac76ULL, -1166 }, { 0xcf42894a5dce35eaULL, -1140 },
+        { 0x9a6bb0aa55653b2dULL, -1113 }, { 0xe61acf033d1a45dfULL, -1087 }, { 0xab70fe17c79ac6caULL, -1060 }, { 0xff77b1fcbebcdc4fULL, -1034 },
+        { 0xbe5691ef416bd60cULL, -1007 }, { 0x8dd01fad907ffc3cULL, -980 }, { 0xd3515c2831559a83ULL, -954 }, { 0x9d71ac8fada6c9b5ULL, -927 },
+        { 0xea9c227723ee8bcbULL, -901 }, { 0xaecc49914078536dULL, -874 }, { 0x823c12795db6ce57ULL, -847 }, { 0xc21094364dfb5637ULL, -821 },
+        { 0x9096ea6f3848984fULL, -794 }, { 0xd77485cb25823ac7ULL, -768 }, { 0xa086cfcd97bf97f4ULL, -741 }, { 0xef340a98172aace5ULL, -715 },
+        { 0xb23867fb2a35b28eULL, -688 }, { 0x84c8d4dfd2c63f3bULL, -661 }, { 0xc5dd44271ad3cdbaULL, -635 }, { 0x936b9fcebb25c996ULL, -608 },
+        { 0xdbac6c247d62a584ULL, -582 }, { 0xa3ab66580d5fdaf6ULL, -555 }, { 0xf3e2f893dec3f126ULL, -529 }, { 0xb5b5ada8aaff80b8ULL, -502 },
+        { 0x87625f056c7c4a8bULL, -475 }, { 0xc9bcff6034c13053ULL, -449 }, { 0x964e858c91ba2655ULL, -422 }, { 0xdff9772470297ebdULL, -396 },
+        { 0xa6dfbd9fb8e5b88fULL, -369 }, { 0xf8a95fcf88747d94ULL, -343 }, { 0xb94470938fa89bcfULL, -316 }, { 0x8a08f0f8bf0f156bULL, -289 },
+        { 0xcdb02555653131b6ULL, -263 }, { 0x993fe2c6d07b7facULL, -236 }, { 0xe45c10c42a2b3b06ULL, -210 }, { 0xaa242499697392d3ULL, -183 },
+        { 0xfd87b5f28300ca0eULL, -157 }, { 0xbce5086492111aebULL, -130 }, { 0x8cbccc096f5088ccULL, -103 }, { 0xd1b71758e219652cULL, -77 },
+        { 0x9c40000000000000ULL, -50 }, { 0xe8d4a51000000000ULL, -24 }, { 0xad78ebc5ac620000ULL, 3 }, { 0x813f3978f8940984ULL, 30 },
+        { 0xc097ce7bc90715b3ULL, 56 }, { 0x8f7e32ce7bea5c70ULL, 83 }, { 0xd5d238a4abe98068ULL, 109 }, { 0x9f4f2726179a2245ULL, 136 },
+        { 0xed63a231d4c4fb27ULL, 162 }, { 0xb0de65388cc8ada8ULL, 189 }, { 0x83c7088e1aab65dbULL, 216 }, { 0xc45d1df942711d9aULL, 242 },
+        { 0x924d692ca61be758ULL, 269 }, { 0xda01ee641a708deaULL, 295 }, { 0xa26da3999aef774aULL, 322 }, { 0xf209787bb47d6b85ULL, 348 },
+        { 0xb454e4a179dd1877ULL, 375 }, { 0x865b86925b9bc5c2ULL, 402 }, { 0xc83553c5c8965d3dULL, 428 }, { 0x952ab45cfa97a0b3ULL, 455 },
+        { 0xde469fbd99a05fe3ULL, 481 }, { 0xa59bc234db398c25ULL, 508 }, { 0xf6c69a72a3989f5cULL, 534 }, { 0xb7dcbf5354e9beceULL, 561 },
+        { 0x88fcf317f22241e2ULL, 588 }, { 0xcc20ce9bd35c78a5ULL, 614 }, { 0x98165af37b2153dfULL, 641 }, { 0xe2a0b5dc971f303aULL, 667 },
+        { 0xa8d9d1535ce3b396ULL, 694 }, { 0xfb9b7cd9a4a7443cULL, 720 }, { 0xbb764c4ca7a44410ULL, 747 }, { 0x8bab8eefb6409c1aULL, 774 },
+        { 0xd01fef10a657842cULL, 800 }, { 0x9b10a4e5e9913129ULL, 827 }, { 0xe7109bfba19c0c9dULL, 853 }, { 0xac2820d9623bf429ULL, 880 },
+        { 0x80444b5e7aa7cf85ULL, 907 }, { 0xbf21e44003acdd2dULL, 933 }, { 0x8e679c2f5e44ff8fULL, 960 }, { 0xd433179d9c8cb841ULL, 986 },
+        { 0x9e19db92b4e31ba9ULL, 1013 }, { 0xeb96bf6ebadf77d9ULL, 1039 }, { 0xaf87023b9bf0ee6bULL, 1066 }
+    };
+    constexpr int FIRST_CACHED_POWER = -348;
+    constexpr int CACHED_POWER_STEP = 8;
+
+    uint64_t const POWERS_OF_TEN[] = {
+        1ULL, 10ULL, 100ULL, 1000ULL, 10000ULL, 100000ULL, 1000000ULL, 10000000ULL, 100000000ULL, 1000000000ULL,
+        10000000000ULL, 100000000000ULL, 1000000000000ULL, 10000000000000ULL, 100000000000000ULL,
+        1000000000000000ULL, 10000000000000000ULL, 100000000000000000ULL, 1000000000000000000ULL, 10000000000000000000ULL
+    };
+
+    // The cached power that brings a value with binary exponent e into the
+    // range the digit generation works in. Sets decimalExponent to minus its k.
+    DiyFp getCachedPower(int e, int& decimalExponent) {
+        // ceil((-61 - e) * log10(2)), shifted to stay positive so the cast rounds down
+        double estimate = (-61 - e) * 0.30102999566398114 + 347;
+        int k = (int)estimate;
+        if (estimate - k > 0.0) {
+            k++;
+        }
+        int index = (k >> 3) + 1;
+        decimalExponent = -(FIRST_CACHED_POWER + index * CACHED_POWER_STEP);
+        return DiyFp(CACHED_POWERS[index].f, CACHED_POWERS[index].e);
+    }
+
+    int countDigits(uint32_t n) {
+        int digits = 1;
+        while (digits < 10 && n >= POWERS_OF_TEN[digits]) {
+            digits++;
+        }
+        return digits;
+    }
+
+    // Steps the last digit down while that brings it closer to the real value
+    // and stays inside the range
+    void roundLastDigit(char* digits, int length, uint64_t delta, uint64_t rest, uint64_t tenKappa, uint64_t distance) {
+        while (rest < distance && delta - rest >= tenKappa && (rest + tenKappa < distance || distance - rest > rest + tenKappa - distance)) {
+            digits[length - 1]--;
+            rest += tenKappa;
+        }
+    }
+
+    // Generates the digits of the scaled upper bound until what is left is
+    // smaller than the scaled range
+    void generateDigits(DiyFp const& value, DiyFp const& upper, uint64_t delta, char* digits, int& length, int& decimalExponent) {
+        DiyFp one(uint64_t(1) << -upper.e, upper.e);
+        uint64_t distance = (upper - value).f;
+        uint32_t integral = (uint32_t)(upper.f >> -one.e);
+        uint64_t fraction = upper.f & (one.f - 1);
+        int kappa = countDigits(integral);
+        length = 0;
+
+        while (kappa > 0) {
+            uint32_t divisor = (uint32_t)POWERS_OF_TEN[kappa - 1];
+            uint32_t digit = integral / divisor;
+            integral %= divisor;
+            if (digit != 0 || length != 0) {
+                digits[length++] = (char)('0' + digit);
+            }
+            kappa--;
+            uint64_t rest = ((uint64_t)integral << -one.e) + fraction;
+            if (rest <= delta) {
+                decimalExponent += kappa;
+                roundLastDigit(digits, length, delta, rest, POWERS_OF_TEN[kappa] << -one.e, distance);
+                return;
+            }
+        }
+
+        for (;;) {
+            fraction *= 10;
+            delta *= 10;
+            char digit = (char)(fraction >> -one.e);
+            if (digit != 0 || length != 0) {
+                digits[length++] = (char)('0' + digit);
+            }
+            fraction &= one.f - 1;
+            kappa--;
+            if (fraction < delta) {
+                decimalExponent += kappa;
+                int index = -kappa;
+                roundLastDigit(digits, length, delta, fraction, one.f, distance * (index < 20 ? POWERS_OF_TEN[index] : 0));
+                return;
+            }
+        }
+    }
+
+    // Digits and decimal exponent of a finite, positive value:
+    // value = digits * 10^decimalExponent
+    void grisu2(double value, char* digits, int& length, int& decimalExponent) {
+        DiyFp v(value);
+        DiyFp minus(0, 0);
+        DiyFp plus(0, 0);
+        v.boundaries(minus, plus);
+
+        DiyFp power = getCachedPower(plus.e, decimalExponent);
+        DiyFp scaled = v.normalize() * power;
+        DiyFp upper = plus * power;
+        DiyFp lower = minus * power;
+        // Stay strictly inside the range to cover the rounding of the products
+        lower.f++;
+        upper.f--;
+        generateDigits(scaled, upper, upper.f - lower.f, digits, length, decimalExponent);
+    }
+
+    int writeExponent(char* out, int exponent) {
+        char* start = out;
+        *out++ = 'e';
+        if (exponent < 0) {
+            *out++ = '-';
+            exponent = -exponent;
+        }
+        if (exponent >= 100) {
+            *out++ = (char)('0' + exponent / 100);
+            exponent %= 100;
+            *out++ = (char)('0' + exponent / 10);
+        } else if (exponent >= 10) {
+            *out++ = (char)('0' + exponent / 10);
+        }
+        *out++ = (char)('0' + exponent % 10);
+        return (int)(out - start);
+    }
+}
+
+int FormatDouble(char* out, double value) {
+    char* start = out;
+    if (std::isnan(value)) {
+        std::memcpy(out, "nan", 3);
+        return 3;
+    }
+    if (std::signbit(value)) {
+        *out++ = '-';
+        value = -value;
+    }
+    if (std::isinf(value)) {
+        std::memcpy(out, "inf", 3);
+        return (int)(out - start) + 3;
+    }
+    if (value == 0) {
+        *out++ = '0';
+        return (int)(out - start);
+    }
+
+    int length;
+    int decimalExponent;
+    grisu2(value, out, length, decimalExponent);
+
+    // The value is 0.d1d2d3... * 10^point
+    int point = length + decimalExponent;
+    if (decimalExponent >= 0 && point <= 21) {
+        // 1234e3 -> 1234000
+        for (int i = length; i < point; i++) {
+            out[i] = '0';
+        }
+        out += point;
+    } else if (point > 0 && point <= 21) {
+        // 1234e-2 -> 12.34
+        std::memmove(out + point + 1, out + point, length - point);
+        out[point] = '.';
+        out += length + 1;
+    } else if (point > -6 && point <= 0) {
+        // 1234e-6 -> 0.001234
+        int offset = 2 - point;
+        std::memmove(out + offset, out, length);
+        out[0] = '0';
+        out[1] = '.';
+        for (int i = 2; i < offset; i++) {
+            out[i] = '0';
+        }
+        out += length + offset;
+    } else if (length == 1) {
+        // 1e30
+        out += 1;
+        out += writeExponent(out, point - 1);
+    } else {
+        // 1234e30 -> 1.234e33
+        std::memmove(out + 2, out + 1, length - 1);
+        out[1] = '.';
+        out += length + 1;
+        out += writeExponent(out, point - 1);
+    }
+    return (int)(out - start);
+}
+
+int FormatInteger(char* out, int64_t value) {
+    char* start = out;
+    uint64_t magnitude = (uint64_t)value;
+    if (value < 0) {
+        *out++ = '-';
+        magnitude = 0 - magnitude;
+    }
+
+    // Digits come out backwards
+    char digits[20];
+    int count = 0;
+    do {
+        digits[count++] = (char)('0' + magnitude % 10);
+        magnitude /= 10;
+    } while (magnitude != 0);
+    while (count > 0) {
+        *out++ = digits[--count];
+    }
+    return (int)(out - start);
+}
+
+constexpr size_t ReportWriter::BUFFER_BYTES;
+
+ReportWriter::ReportWriter(): format(ReportFormat::Text), buffer(BUFFER_BYTES), used(0), flushedBytes(0) {}
+
+ReportWriter::~ReportWriter() {
+    close();
+}
+
+void ReportWriter::open(const char* filename, ReportFormat format) {
+    close();
+    file.open(filename, std::ios::binary | std::ios::trunc);
+    this->format = format;
+    used = 0;
+    flushedBytes = 0;
+}
+
+bool ReportWriter::is_open() {
+    return file.is_open();
+}
+
+void ReportWriter::close() {
+    if (file.is_open()) {
+        flush();
+        file.close();
+    }
+}
+
+ReportWriter& ReportWriter::operator<<(char const* text) {
+    append(text, std::strlen(text));
+    return *this;
+}
+
+ReportWriter& ReportWriter::operator<<(std::string const& text) {
+    append(text.data(), text.size());
+    return *this;
+}
+
+ReportWriter& ReportWriter::operator<<(char c) {
+    reserve(1);
+    buffer[used++] = c;
+    return *this;
+}
+
+ReportWriter& ReportWriter::operator<<(double value) {
+    if (format == ReportFormat::JSON && !std::isfinite(value)) {
+        append("null", 4);
+        return *this;
+    }
+    reserve(32);
+    used += FormatDouble(&buffer[used], value);
+    return *this;
+}
+
+void ReportWriter::writeJSONString(char const* text) {
+    *this << '"';
+    for (char const* c = text; *c != '\0'; c++) {
+        switch (*c) {
+            case '"': append("\\\"", 2); break;
+            case '\\': append("\\\\", 2); break;
+            case '\n': append("\\n", 2); break;
+            case '\r': append("\\r", 2); break;
+            case '\t': append("\\t", 2); break;
+            default:
+                if ((unsigned char)*c < 0x20) {
+                    // Other control characters as \u00XX
+                    char escaped[7] = { '\\', 'u', '0', '0', "0123456789abcdef"[(*c >> 4) & 0xF], "0123456789abcdef"[*c & 0xF], '\0' };
+                    append(escaped, 6);
+                } else {
+                    *this << *c;
+                }
+        }
+    }
+    *this << '"';
+}
+
+void ReportWriter::writeCSVField(char const* text) {
+    if (std::strpbrk(text, ",\"\r\n") == nullptr) {
+        append(text, std::strlen(text));
+        return;
+    }
+    *this << '"';
+    for (char const* c = text; *c != '\0'; c++) {
+        if (*c == '"') {
+            *this << '"';
+        }
+        *this << *c;
+    }
+    *this << '"';
+}
+
+void ReportWriter::writeSpaces(int count) {
+    reserve(count);
+    std::memset(&buffer[used], ' ', count);
+    used += count;
+}
+
+size_t ReportWriter::getBytesWritten() {
+    return flushedBytes + used;
+}
+
+void ReportWriter::append(char const* text, size_t length) {
+    if (length > BUFFER_BYTES) {
+        // Too big to be worth copying
+        flush();
+        file.write(text, length);
+        flushedBytes += length;
+        return;
+    }
+    reserve(length);
+    std::memcpy(&buffer[used], text, length);
+    used += length;
+}
+
+void ReportWriter::reserve(size_t bytes) {
+    if (used + bytes > BUFFER_BYTES) {
+        flush();
+    }
+}
+
+void ReportWriter::flush() {
+    file.write(buffer.data(), used);
+    flushedBytes += used;
+    used = 0;
+}
@@ -0,0 +1,73 @@
+//report_writer.hpp
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <fstream>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+// Writes the shortest decimal that reads back as exactly the same double, in
+// the style of std::to_chars (which C++14 doesn't have), using Grisu2: fixed
+// notation for magnitudes from 1e-6 to 1e21, exponent notation outside that.
+// NaN and infinities come out as nan, inf and -inf. Returns the length; out
+// needs room for 32 characters. Never depends on the locale.
+int FormatDouble(char* out, double value);
+// Returns the length; out needs room for 20 characters
+int FormatInteger(char* out, int64_t value);
+
+// JSON has no literal for NaN or infinity, so a JSON report writes them as
+// null, which the report reader takes back as NaN
+enum class ReportFormat { Text, JSON };
+
+// Buffered report output. Text and numbers are formatted straight into a 64 KB
+// buffer that goes to the file in one write when it fills up, instead of
+// through ofstream's formatting layers one field at a time.
+class ReportWriter {
+public:
+    static constexpr size_t BUFFER_BYTES = 1 << 16;
+
+    ReportWriter();
+    ~ReportWriter();
+
+    ReportWriter(ReportWriter const&) = delete;
+    ReportWriter& operator=(ReportWriter const&) = delete;
+
+    void open(const char* filename, ReportFormat format = ReportFormat::Text);
+    bool is_open();
+    // Writes out what is still buffered and closes the file
+    void close();
+
+    ReportWriter& operator<<(char const* text);
+    ReportWriter& operator<<(std::string const& text);
+    ReportWriter& operator<<(char c);
+    ReportWriter& operator<<(double value);
+    template <typename T, typename = typename std::enable_if<std::is_integral<T>::value>::type>
+    ReportWriter& operator<<(T value) {
+        reserve(20);
+        used += FormatInteger(&buffer[used], (int64_t)value);
+        return *this;
+    }
+
+    // Writes text as a quoted JSON string, escaping what JSON requires
+    void writeJSONString(char const* text);
+    // Writes text as one CSV field, quoted only if it holds a comma, quote or
+    // line break, e.g. a demangled function name
+    void writeCSVField(char const* text);
+    void writeSpaces(int count);
+
+    // Bytes handed to the file so far, plus what is still buffered
+    size_t getBytesWritten();
+
+private:
+    void append(char const* text, size_t length);
+    // Makes room for at least bytes more characters
+    void reserve(size_t bytes);
+    void flush();
+
+    std::ofstream file;
+    ReportFormat format;
+    std::vector<char> buffer;
+    size_t used;
+    size_t flushedBytes;
+};
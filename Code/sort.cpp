@@ -0,0 +1,366 @@
+#include "sort.hpp"
+#include <algorithm>
+#include <cstdint>
+#include <thread>
+#include <utility>
+#include <vector>
+
+namespace {
+    // Ranges smaller than this are insertion sorted
+    constexpr size_t INSERTION_SORT_THRESHOLD = 24;
+    // Ranges larger than this take the median of three medians as pivot
+    constexpr size_t NINTHER_THRESHOLD = 128;
+    // Moves a partial insertion sort may make before giving up
+    constexpr size_t PARTIAL_INSERTION_LIMIT = 8;
+    // Below this many keys radix sort's fixed cost isn't worth it
+    constexpr size_t RADIX_SORT_THRESHOLD = 256;
+    // Below this many keys per thread, threads cost more than they save
+    constexpr size_t PARALLEL_SORT_THRESHOLD = 1 << 15;
+
+    void insertionSort(int* begin, int* end) {
+        if (begin == end) {
+            return;
+        }
+        for (int* current = begin + 1; current != end; current++) {
+            int key = *current;
+            int* sift = current;
+            while (sift != begin && key < *(sift - 1)) {
+                *sift = *(sift - 1);
+                sift--;
+            }
+            *sift = key;
+        }
+    }
+
+    // Only for ranges with a key before them that is no larger than any key in
+    // them, which stops every sift without a bounds check
+    void unguardedInsertionSort(int* begin, int* end) {
+        for (int* current = begin + 1; current < end; current++) {
+            int key = *current;
+            int* sift = current;
+            while (key < *(sift - 1)) {
+                *sift = *(sift - 1);
+                sift--;
+            }
+            *sift = key;
+        }
+    }
+
+    // Insertion sort that gives up once it has moved more than a few keys.
+    // Returns true if it sorted the range.
+    bool partialInsertionSort(int* begin, int* end) {
+        if (begin == end) {
+            return true;
+        }
+        size_t moves = 0;
+        for (int* current = begin + 1; current != end; current++) {
+            int key = *current;
+            int* sift = current;
+            while (sift != begin && key < *(sift - 1)) {
+                *sift = *(sift - 1);
+                sift--;
+            }
+            *sift = key;
+            moves += current - sift;
+            if (moves > PARTIAL_INSERTION_LIMIT) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    void sort2(int* a, int* b) {
+        if (*b < *a) {
+            std::iter_swap(a, b);
+        }
+    }
+
+    // Leaves the median of the three in b
+    void sort3(int* a, int* b, int* c) {
+        sort2(a, b);
+        sort2(b, c);
+        sort2(a, b);
+    }
+
+    // Partitions around the pivot in *begin, keys equal to it going right.
+    // Returns the pivot's final position, and whether the range was already
+    // partitioned. Needs a key no smaller than the pivot somewhere after it,
+    // which pivot selection guarantees.
+    std::pair<int*, bool> partitionRight(int* begin, int* end) {
+        int pivot = *begin;
+        int* first = begin;
+        int* last = end;
+
+        while (*++first < pivot) {
+        }
+        // Without a swap yet, nothing guards the search from the right
+        if (first - 1 == begin) {
+            while (first < last && !(*--last < pivot)) {
+            }
+        } else {
+            while (!(*--last < pivot)) {
+            }
+        }
+
+        bool alreadyPartitioned = first >= last;
+        while (first < last) {
+            std::iter_swap(first, last);
+            while (*++first < pivot) {
+            }
+            while (!(*--last < pivot)) {
+            }
+        }
+
+        int* pivotPosition = first - 1;
+        *begin = *pivotPosition;
+        *pivotPosition = pivot;
+        return std::make_pair(pivotPosition, alreadyPartitioned);
+    }
+
+    // Partitions around the pivot in *begin, keys equal to it going left. Used
+    // when the pivot equals the key before the range, so every key equal to it
+    // ends up in place in one pass.
+    int* partitionLeft(int* begin, int* end) {
+        int pivot = *begin;
+        int* first = begin;
+        int* last = end;
+
+        while (pivot < *--last) {
+        }
+        if (last + 1 == end) {
+            while (first < last && !(pivot < *++first)) {
+            }
+        } else {
+            while (!(pivot < *++first)) {
+            }
+        }
+
+        while (first < last) {
+            std::iter_swap(first, last);
+            while (pivot < *--last) {
+            }
+            while (!(pivot < *++first)) {
+            }
+        }
+
+        *begin = *last;
+        *last = pivot;
+        return last;
+    }
+
+    // Swaps keys a quarter of the way into the range with its ends, so the
+    // next pivot choice doesn't hit the same pattern again
+    void breakPatterns(int* begin, int* end, bool atEnd) {
+        size_t size = end - begin;
+        size_t quarter = size / 4;
+        if (!atEnd) {
+            std::iter_swap(begin, begin + quarter);
+            if (size > NINTHER_THRESHOLD) {
+                std::iter_swap(begin + 1, begin + (quarter + 1));
+                std::iter_swap(begin + 2, begin + (quarter + 2));
+            }
+        } else {
+            std::iter_swap(end - 1, end - quarter);
+            if (size > NINTHER_THRESHOLD) {
+                std::iter_swap(end - 2, end - (quarter + 1));
+                std::iter_swap(end - 3, end - (quarter + 2));
+            }
+        }
+    }
+
+    void introSortLoop(int* begin, int* end, int badPartitionsAllowed, bool leftmost) {
+        while (true) {
+            size_t size = end - begin;
+            if (size < INSERTION_SORT_THRESHOLD) {
+                if (leftmost) {
+                    insertionSort(begin, end);
+                } else {
+                    unguardedInsertionSort(begin, end);
+                }
+                return;
+            }
+
+            // Move the pivot to the front
+            size_t half = size / 2;
+            if (size > NINTHER_THRESHOLD) {
+                sort3(begin, begin + half, end - 1);
+                sort3(begin + 1, begin + (half - 1), end - 2);
+                sort3(begin + 2, begin + (half + 1), end - 3);
+                sort3(begin + (half - 1), begin + half, begin + (half + 1));
+                std::iter_swap(begin, begin + half);
+            } else {
+                sort3(begin + half, begin, end - 1);
+            }
+
+            // The key before this range was a pivot once. If it equals the new
+            // pivot, no key here is smaller, so the equal keys are done.
+            if (!leftmost && !(*(begin - 1) < *begin)) {
+                begin = partitionLeft(begin, end) + 1;
+                continue;
+            }
+
+            std::pair<int*, bool> partition = partitionRight(begin, end);
+            int* pivotPosition = partition.first;
+            size_t leftSize = pivotPosition - begin;
+            size_t rightSize = end - (pivotPosition + 1);
+
+            if (leftSize < size / 8 || rightSize < size / 8) {
+                // Too many bad pivots means an adversarial pattern
+                if (--badPartitionsAllowed == 0) {
+                    std::make_heap(begin, end);
+                    std::sort_heap(begin, end);
+                    return;
+                }
+                if (leftSize >= INSERTION_SORT_THRESHOLD) {
+                    breakPatterns(begin, pivotPosition, false);
+                    breakPatterns(begin, pivotPosition, true);
+                }
+                if (rightSize >= INSERTION_SORT_THRESHOLD) {
+                    breakPatterns(pivotPosition + 1, end, false);
+                    breakPatterns(pivotPosition + 1, end, true);
+                }
+            } else if (partition.second && partialInsertionSort(begin, pivotPosition) && partialInsertionSort(pivotPosition + 1, end)) {
+                // A balanced partition that moved nothing is probably in order already
+                return;
+            }
+
+            // Recurse into the left side and loop on the right
+            introSortLoop(begin, pivotPosition, badPartitionsAllowed, leftmost);
+            begin = pivotPosition + 1;
+            leftmost = false;
+        }
+    }
+
+    // Merges two sorted runs into out, splitting the work between threads by
+    // placing the larger run's middle key in the other run
+    void parallelMerge(int const* a, int const* aEnd, int const* b, int const* bEnd, int* out, int threadCount) {
+        size_t aSize = aEnd - a;
+        size_t bSize = bEnd - b;
+        if (threadCount <= 1 || aSize + bSize < PARALLEL_SORT_THRESHOLD) {
+            std::merge(a, aEnd, b, bEnd, out);
+            return;
+        }
+        if (aSize < bSize) {
+            std::swap(a, b);
+            std::swap(aEnd, bEnd);
+        }
+
+        int const* aMiddle = a + (aEnd - a) / 2;
+        int const* bMiddle = std::lower_bound(b, bEnd, *aMiddle);
+        int* outMiddle = out + (aMiddle - a) + (bMiddle - b);
+        std::thread left(parallelMerge, a, aMiddle, b, bMiddle, out, threadCount / 2);
+        parallelMerge(aMiddle, aEnd, bMiddle, bEnd, outMiddle, threadCount - threadCount / 2);
+        left.join();
+    }
+}
+
+void IntroSort(int* data, size_t count) {
+    if (count < 2) {
+        return;
+    }
+    int log2 = 0;
+    for (size_t n = count; n > 1; n >>= 1) {
+        log2++;
+    }
+    introSortLoop(data, data + count, log2, true);
+}
+
+void RadixSort(int* data, size_t count) {
+    if (count < RADIX_SORT_THRESHOLD) {
+        IntroSort(data, count);
+        return;
+    }
+
+    // Flipping the sign bit orders signed keys as unsigned ones
+    auto digit = [](int key, int pass) -> uint32_t {
+        return (((uint32_t)key ^ 0x80000000u) >> (pass * 8)) & 0xff;
+    };
+
+    size_t counts[4][256] = {};
+    for (size_t i = 0; i < count; i++) {
+        for (int pass = 0; pass < 4; pass++) {
+            counts[pass][digit(data[i], pass)]++;
+        }
+    }
+
+    std::vector<int> scratch(count);
+    int* from = data;
+    int* to = scratch.data();
+    for (int pass = 0; pass < 4; pass++) {
+        if (counts[pass][digit(data[0], pass)] == count) {
+            continue;
+        }
+
+        size_t offsets[256];
+        size_t offset = 0;
+        for (int value = 0; value < 256; value++) {
+            offsets[value] = offset;
+            offset += counts[pass][value];
+        }
+        for (size_t i = 0; i < count; i++) {
+            int key = from[i];
+            to[offsets[digit(key, pass)]++] = key;
+        }
+        std::swap(from, to);
+    }
+
+    if (from != data) {
+        std::copy(from, from + count, data);
+    }
+}
+
+void ParallelSort(int* data, size_t count, int threadCount) {
+    if (threadCount <= 0) {
+        threadCount = std::max(1, (int)std::thread::hardware_concurrency());
+    }
+    threadCount = (int)std::min<size_t>(threadCount, count / PARALLEL_SORT_THRESHOLD);
+    if (threadCount <= 1) {
+        IntroSort(data, count);
+        return;
+    }
+
+    // Sort one slice per thread
+    std::vector<size_t> bounds;
+    for (int slice = 0; slice <= threadCount; slice++) {
+        bounds.push_back(count * slice / threadCount);
+    }
+    std::vector<std::thread> workers;
+    for (int slice = 1; slice < threadCount; slice++) {
+        workers.emplace_back(IntroSort, data + bounds[slice], bounds[slice + 1] - bounds[slice]);
+    }
+    IntroSort(data, bounds[1]);
+    for (std::thread& worker : workers) {
+        worker.join();
+    }
+
+    // Merge neighbouring runs until one is left, ping-ponging between the
+    // array and a scratch buffer. The threads are shared out between the merges.
+    std::vector<int> scratch(count);
+    int* from = data;
+    int* to = scratch.data();
+    while (bounds.size() > 2) {
+        size_t runs = bounds.size() - 1;
+        int threadsPerMerge = std::max(1, threadCount / (int)(runs / 2));
+        std::vector<size_t> merged;
+        workers.clear();
+        for (size_t run = 0; run < runs; run += 2) {
+            merged.push_back(bounds[run]);
+            if (run + 1 == runs) {
+                // Odd one out, carried over as it is
+                std::copy(from + bounds[run], from + bounds[run + 1], to + bounds[run]);
+                continue;
+            }
+            workers.emplace_back(parallelMerge, from + bounds[run], from + bounds[run + 1], from + bounds[run + 1], from + bounds[run + 2], to + bounds[run], threadsPerMerge);
+        }
+        merged.push_back(count);
+        for (std::thread& worker : workers) {
+            worker.join();
+        }
+        bounds = merged;
+        std::swap(from, to);
+    }
+
+    if (from != data) {
+        std::copy(from, from + count, data);
+    }
+}
@@ -0,0 +1,27 @@
+//sort.hpp
+#pragma once
+#include <cstddef>
+
+// Sorts for arrays of 32-bit integer keys, ascending
+
+// Pattern-defeating introsort (after Orson Peters' pdqsort). Pivots are the
+// median of three, or the median of three medians on large ranges, and ranges
+// under 24 keys are finished with insertion sort. A partition that comes out
+// badly unbalanced shuffles a few keys to break the pattern behind it, and
+// after log2(n) of those the range falls back to heapsort, so the worst case
+// stays O(n log n). Runs of keys equal to a previous pivot are skipped in one
+// pass, and ranges that are already in order are finished in linear time.
+void IntroSort(int* data, size_t count);
+
+// Least-significant-digit radix sort: four stable counting passes over 8-bit
+// digits, O(n) with n extra keys of scratch memory. One pass over the keys
+// counts every digit up front, and a digit that is the same for every key is
+// skipped. Small arrays go to IntroSort instead.
+void RadixSort(int* data, size_t count);
+
+// Splits the array into one slice per thread and sorts the slices in
+// parallel with IntroSort, then merges them pairwise. Each merge is itself
+// split between threads by binary search, so the last merge doesn't run on
+// one thread alone. threadCount 0 uses every hardware thread. Arrays too
+// small to be worth the threads go to IntroSort.
+void ParallelSort(int* data, size_t count, int threadCount = 0);
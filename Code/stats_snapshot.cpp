@@ -0,0 +1,275 @@
+#include "stats_snapshot.hpp"
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+#include <stdexcept>
+#include <thread>
+
+constexpr char const* StatsSnapshot::MAGIC;
+constexpr uint32_t StatsSnapshot::VERSION;
+
+namespace {
+    void AppendBytes(std::string& buffer, void const* data, size_t size) {
+        buffer.append(static_cast<char const*>(data), size);
+    }
+
+    // Reads from a whole file in memory, failing on anything past its end
+    class SnapshotCursor {
+    public:
+        SnapshotCursor(std::string const& bytes, const char* filename): current(bytes.data()), end(bytes.data() + bytes.size()), filename(filename) {}
+
+        void read(void* data, size_t size) {
+            if ((size_t)(end - current) < size) {
+                throw std::runtime_error(std::string(filename) + " is cut short");
+            }
+            std::memcpy(data, current, size);
+            current += size;
+        }
+
+        std::string readString(size_t size) {
+            std::string text(size, '\0');
+            read(&text[0], size);
+            return text;
+        }
+
+    private:
+        char const* current;
+        char const* end;
+        const char* filename;
+    };
+}
+
+SnapshotSection::SnapshotSection(): fileName("null"), functionName("null"), lineNumber(0), count(0), totalNanoseconds(0), minNanoseconds(INT64_MAX), maxNanoseconds(0), mean(0), m2(0), correctedTotalNanoseconds(0), correctedMinNanoseconds(INT64_MAX), correctedMaxNanoseconds(0), allocations(0), allocatedBytes(0), peakLiveBytes(0), samples(0), selfSamples(0) {
+    std::fill(counterTotals, counterTotals + PERF_COUNTER_COUNT, 0);
+}
+
+void SnapshotSection::merge(SnapshotSection const& other) {
+    // Chan et al.'s pairwise combination of mean and variance, as in
+    // SectionAccumulator::merge
+    int64_t combinedCount = count + other.count;
+    if (other.count > 0) {
+        double delta = other.mean - mean;
+        mean += delta * other.count / combinedCount;
+        m2 += other.m2 + delta * delta * (double(count) * other.count / combinedCount);
+    }
+
+    count = combinedCount;
+    totalNanoseconds += other.totalNanoseconds;
+    minNanoseconds = std::min(minNanoseconds, other.minNanoseconds);
+    maxNanoseconds = std::max(maxNanoseconds, other.maxNanoseconds);
+    correctedTotalNanoseconds += other.correctedTotalNanoseconds;
+    correctedMinNanoseconds = std::min(correctedMinNanoseconds, other.correctedMinNanoseconds);
+    correctedMaxNanoseconds = std::max(correctedMaxNanoseconds, other.correctedMaxNanoseconds);
+    for (int i = 0; i < PERF_COUNTER_COUNT; i++) {
+        counterTotals[i] += other.counterTotals[i];
+    }
+    allocations += other.allocations;
+    allocatedBytes += other.allocatedBytes;
+    peakLiveBytes = std::max(peakLiveBytes, other.peakLiveBytes);
+    samples += other.samples;
+    selfSamples += other.selfSamples;
+
+    if (!other.histogram.empty()) {
+        histogram.resize(LatencyHistogram::BUCKET_COUNT, 0);
+        for (int i = 0; i < LatencyHistogram::BUCKET_COUNT; i++) {
+            histogram[i] += other.histogram[i];
+        }
+    }
+
+    if (other.fileName != "null") {
+        fileName = other.fileName;
+        functionName = other.functionName;
+        lineNumber = other.lineNumber;
+    }
+}
+
+StatsSnapshot::StatsSnapshot(): processCount(0), sampleCount(0), measurementBiasNanoseconds(0), probeOverheadNanoseconds(0) {}
+
+void StatsSnapshot::merge(StatsSnapshot const& other) {
+    processCount += other.processCount;
+    sampleCount += other.sampleCount;
+    measurementBiasNanoseconds = std::max(measurementBiasNanoseconds, other.measurementBiasNanoseconds);
+    probeOverheadNanoseconds = std::max(probeOverheadNanoseconds, other.probeOverheadNanoseconds);
+    for (auto const& section : other.sections) {
+        sections[section.first].merge(section.second);
+    }
+}
+
+void StatsSnapshot::save(const char* filename) const {
+    // Built in memory and written with one call
+    std::string buffer;
+
+    SnapshotHeader header;
+    std::memset(&header, 0, sizeof(header));
+    std::strncpy(header.magic, MAGIC, sizeof(header.magic));
+    header.version = VERSION;
+    header.sectionCount = (uint32_t)sections.size();
+    header.processCount = processCount;
+    header.sampleCount = sampleCount;
+    header.measurementBiasNanoseconds = measurementBiasNanoseconds;
+    header.probeOverheadNanoseconds = probeOverheadNanoseconds;
+    AppendBytes(buffer, &header, sizeof(header));
+
+    std::vector<uint32_t> bucketIndexes;
+    std::vector<uint64_t> bucketCounts;
+    for (auto const& entry : sections) {
+        SnapshotSection const& section = entry.second;
+        bucketIndexes.clear();
+        bucketCounts.clear();
+        for (size_t i = 0; i < section.histogram.size(); i++) {
+            if (section.histogram[i] > 0) {
+                bucketIndexes.push_back((uint32_t)i);
+                bucketCounts.push_back(section.histogram[i]);
+            }
+        }
+
+        SnapshotRecord record;
+        std::memset(&record, 0, sizeof(record));
+        record.nameLength = (uint32_t)entry.first.size();
+        record.fileLength = (uint32_t)section.fileName.size();
+        record.functionLength = (uint32_t)section.functionName.size();
+        record.lineNumber = section.lineNumber;
+        record.bucketCount = (uint32_t)bucketIndexes.size();
+        record.count = section.count;
+        record.totalNanoseconds = section.totalNanoseconds;
+        record.minNanoseconds = section.minNanoseconds;
+        record.maxNanoseconds = section.maxNanoseconds;
+        record.mean = section.mean;
+        record.m2 = section.m2;
+        record.correctedTotalNanoseconds = section.correctedTotalNanoseconds;
+        record.correctedMinNanoseconds = section.correctedMinNanoseconds;
+        record.correctedMaxNanoseconds = section.correctedMaxNanoseconds;
+        std::copy(section.counterTotals, section.counterTotals + PERF_COUNTER_COUNT, record.counterTotals);
+        record.allocations = section.allocations;
+        record.allocatedBytes = section.allocatedBytes;
+        record.peakLiveBytes = section.peakLiveBytes;
+        record.samples = section.samples;
+        record.selfSamples = section.selfSamples;
+        AppendBytes(buffer, &record, sizeof(record));
+        AppendBytes(buffer, entry.first.data(), entry.first.size());
+        AppendBytes(buffer, section.fileName.data(), section.fileName.size());
+        AppendBytes(buffer, section.functionName.data(), section.functionName.size());
+        AppendBytes(buffer, bucketIndexes.data(), bucketIndexes.size() * sizeof(uint32_t));
+        AppendBytes(buffer, bucketCounts.data(), bucketCounts.size() * sizeof(uint64_t));
+    }
+
+    std::ofstream file(filename, std::ios::binary | std::ios::trunc);
+    if (!file.is_open()) {
+        throw std::runtime_error(std::string("Could not create snapshot file ") + filename);
+    }
+    file.write(buffer.data(), buffer.size());
+    if (!file) {
+        throw std::runtime_error(std::string("Could not write snapshot file ") + filename);
+    }
+}
+
+void StatsSnapshot::load(const char* filename) {
+    std::ifstream file(filename, std::ios::binary);
+    if (!file.is_open()) {
+        throw std::runtime_error(std::string("Could not open snapshot file ") + filename);
+    }
+    std::string bytes;
+    file.seekg(0, std::ios::end);
+    bytes.resize((size_t)file.tellg());
+    file.seekg(0, std::ios::beg);
+    file.read(&bytes[0], bytes.size());
+
+    SnapshotCursor cursor(bytes, filename);
+    SnapshotHeader header;
+    if (bytes.size() < sizeof(header)) {
+        throw std::runtime_error(std::string(filename) + " is not a snapshot file");
+    }
+    cursor.read(&header, sizeof(header));
+    if (std::strncmp(header.magic, MAGIC, sizeof(header.magic)) != 0) {
+        throw std::runtime_error(std::string(filename) + " is not a snapshot file");
+    }
+    if (header.version != VERSION) {
+        throw std::runtime_error(std::string(filename) + " has unsupported snapshot version " + std::to_string(header.version));
+    }
+
+    processCount = header.processCount;
+    sampleCount = header.sampleCount;
+    measurementBiasNanoseconds = header.measurementBiasNanoseconds;
+    probeOverheadNanoseconds = header.probeOverheadNanoseconds;
+    sections.clear();
+
+    std::vector<uint32_t> bucketIndexes;
+    std::vector<uint64_t> bucketCounts;
+    for (uint32_t i = 0; i < header.sectionCount; i++) {
+        SnapshotRecord record;
+        cursor.read(&record, sizeof(record));
+        std::string name = cursor.readString(record.nameLength);
+        SnapshotSection& section = sections[name];
+        section.fileName = cursor.readString(record.fileLength);
+        section.functionName = cursor.readString(record.functionLength);
+        section.lineNumber = record.lineNumber;
+        section.count = record.count;
+        section.totalNanoseconds = record.totalNanoseconds;
+        section.minNanoseconds = record.minNanoseconds;
+        section.maxNanoseconds = record.maxNanoseconds;
+        section.mean = record.mean;
+        section.m2 = record.m2;
+        section.correctedTotalNanoseconds = record.correctedTotalNanoseconds;
+        section.correctedMinNanoseconds = record.correctedMinNanoseconds;
+        section.correctedMaxNanoseconds = record.correctedMaxNanoseconds;
+        std::copy(record.counterTotals, record.counterTotals + PERF_COUNTER_COUNT, section.counterTotals);
+        section.allocations = record.allocations;
+        section.allocatedBytes = record.allocatedBytes;
+        section.peakLiveBytes = record.peakLiveBytes;
+        section.samples = record.samples;
+        section.selfSamples = record.selfSamples;
+
+        bucketIndexes.resize(record.bucketCount);
+        bucketCounts.resize(record.bucketCount);
+        cursor.read(bucketIndexes.data(), bucketIndexes.size() * sizeof(uint32_t));
+        cursor.read(bucketCounts.data(), bucketCounts.size() * sizeof(uint64_t));
+        if (record.bucketCount > 0) {
+            section.histogram.resize(LatencyHistogram::BUCKET_COUNT, 0);
+        }
+        for (uint32_t bucket = 0; bucket < record.bucketCount; bucket++) {
+            if (bucketIndexes[bucket] >= (uint32_t)LatencyHistogram::BUCKET_COUNT) {
+                throw std::runtime_error(std::string(filename) + " has a histogram bucket out of range in section " + name);
+            }
+            section.histogram[bucketIndexes[bucket]] = bucketCounts[bucket];
+        }
+    }
+}
+
+StatsSnapshot MergeSnapshotFiles(std::vector<std::string> const& filenames, unsigned jobs) {
+    if (jobs == 0) {
+        jobs = std::max(1u, std::thread::hardware_concurrency());
+    }
+    jobs = (unsigned)std::max<size_t>(1, std::min<size_t>(jobs, filenames.size()));
+
+    // Exceptions don't cross threads, so each worker keeps its error message
+    std::vector<StatsSnapshot> partials(jobs);
+    std::vector<std::string> errors(jobs);
+    std::vector<std::thread> workers;
+    for (unsigned job = 0; job < jobs; job++) {
+        size_t begin = filenames.size() * job / jobs;
+        size_t end = filenames.size() * (job + 1) / jobs;
+        workers.emplace_back([&filenames, &partials, &errors, job, begin, end]() {
+            try {
+                StatsSnapshot snapshot;
+                for (size_t i = begin; i < end; i++) {
+                    snapshot.load(filenames[i].c_str());
+                    partials[job].merge(snapshot);
+                }
+            } catch (std::exception const& error) {
+                errors[job] = error.what();
+            }
+        });
+    }
+    for (std::thread& worker : workers) {
+        worker.join();
+    }
+
+    StatsSnapshot merged;
+    for (unsigned job = 0; job < jobs; job++) {
+        if (!errors[job].empty()) {
+            throw std::runtime_error(errors[job]);
+        }
+        merged.merge(partials[job]);
+    }
+    return merged;
+}
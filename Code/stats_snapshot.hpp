@@ -0,0 +1,125 @@
+//stats_snapshot.hpp
+#pragma once
+#include <cstdint>
+#include <map>
+#include <string>
+#include <vector>
+#include "histogram.hpp"
+#include "perf_counters.hpp"
+
+// Totals of a whole profile in a compact binary file, for combining the
+// profiles of many processes, e.g. forked workers, into one report. Times are
+// kept in nanoseconds, so snapshots taken with different clocks merge as well.
+//
+// Merging is associative: merging a run of snapshots gives the same totals
+// however the run is grouped, so partial merges can be merged again, e.g. per
+// host and then across hosts. Counts, sums, extremes, histograms and samples
+// come out exact; the mean and variance combine pairwise and agree up to
+// rounding.
+//
+// A file is a SnapshotHeader followed by sectionCount sections, each a
+// SnapshotRecord, the name, file and function bytes, and then the histogram's
+// non-empty buckets as bucketCount uint32 bucket indexes followed by
+// bucketCount uint64 counts.
+struct SnapshotHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t sectionCount;
+    int64_t processCount;
+    int64_t sampleCount;
+    double measurementBiasNanoseconds;
+    double probeOverheadNanoseconds;
+};
+
+// One section as stored on disk
+struct SnapshotRecord {
+    uint32_t nameLength;
+    uint32_t fileLength;
+    uint32_t functionLength;
+    int32_t lineNumber;
+    uint32_t bucketCount;
+    uint32_t padding;
+    int64_t count;
+    int64_t totalNanoseconds;
+    int64_t minNanoseconds;
+    int64_t maxNanoseconds;
+    double mean;
+    double m2;
+    int64_t correctedTotalNanoseconds;
+    int64_t correctedMinNanoseconds;
+    int64_t correctedMaxNanoseconds;
+    int64_t counterTotals[PERF_COUNTER_COUNT];
+    int64_t allocations;
+    int64_t allocatedBytes;
+    int64_t peakLiveBytes;
+    int64_t samples;
+    int64_t selfSamples;
+};
+
+// One section's totals over every thread and process merged into it
+class SnapshotSection {
+public:
+    SnapshotSection();
+
+    // Adds the other section's calls to this one
+    void merge(SnapshotSection const& other);
+
+    // Call site of the last call, in merge order. The other's wins whenever it
+    // has one.
+    std::string fileName;
+    std::string functionName;
+    int lineNumber;
+    int64_t count;
+    int64_t totalNanoseconds;
+    int64_t minNanoseconds;
+    int64_t maxNanoseconds;
+    // Mean and sum of squared differences from it, in nanoseconds
+    double mean;
+    double m2;
+    int64_t correctedTotalNanoseconds;
+    int64_t correctedMinNanoseconds;
+    int64_t correctedMaxNanoseconds;
+    int64_t counterTotals[PERF_COUNTER_COUNT];
+    int64_t allocations;
+    int64_t allocatedBytes;
+    int64_t peakLiveBytes;
+    int64_t samples;
+    int64_t selfSamples;
+    // Calls in each LatencyHistogram bucket, or empty before the first call
+    std::vector<uint64_t> histogram;
+};
+
+class StatsSnapshot {
+public:
+    static constexpr char const* MAGIC = "PROFSNP";
+    static constexpr uint32_t VERSION = 1;
+
+    StatsSnapshot();
+
+    // Adds the other snapshot's totals to this one. An empty snapshot merges
+    // as if it weren't there.
+    void merge(StatsSnapshot const& other);
+    // Throws std::runtime_error if the file can't be written
+    void save(const char* filename) const;
+    // Replaces the contents with the file's. Throws std::runtime_error if the
+    // file can't be read or isn't a snapshot.
+    void load(const char* filename);
+
+    // Profiles merged into it, 1 for a snapshot of a single profiler
+    int64_t processCount;
+    // Samples taken, including the ones outside every section
+    int64_t sampleCount;
+    // Calibrated probe costs, see Profiler::calibrateOverhead. Merging keeps
+    // the largest, as the processes' costs can't be told apart in the totals.
+    double measurementBiasNanoseconds;
+    double probeOverheadNanoseconds;
+    // Keyed by section name, as ids differ from process to process
+    std::map<std::string, SnapshotSection> sections;
+};
+
+// Loads and merges the snapshot files on up to jobs threads, 0 for one per
+// core. Each thread merges a contiguous run of the files, and the runs are
+// merged in order, so only the rounding of the mean and variance depends on
+// the number of threads.
+// Throws std::runtime_error naming the first file that couldn't be loaded.
+StatsSnapshot MergeSnapshotFiles(std::vector<std::string> const& filenames, unsigned jobs = 0);
@@ -0,0 +1,195 @@
+#include "stats_windows.hpp"
+#include "histogram.hpp"
+#include "time.hpp"
+#include <algorithm>
+#include <chrono>
+
+WindowSectionStats::WindowSectionStats(): count(0), totalTime(0), avgTime(0), maxTime(0), p99Time(0) {}
+
+StatsWindow::StatsWindow(): index(0), startTime(0), endTime(0) {}
+
+namespace {
+    // LatencyHistogram::getPercentile over (bucket index, calls) pairs, lowest first
+    double SparsePercentile(std::vector<std::pair<int, uint64_t>> const& buckets, double percentile) {
+        uint64_t total = 0;
+        for (auto const& bucket : buckets) {
+            total += bucket.second;
+        }
+        if (total == 0) {
+            return 0;
+        }
+
+        double fraction = percentile < 0 ? 0 : (percentile > 100 ? 1 : percentile / 100.0);
+        uint64_t rank = std::max<uint64_t>((uint64_t)(fraction * total + 0.5), 1);
+        uint64_t seen = 0;
+        for (auto const& bucket : buckets) {
+            seen += bucket.second;
+            if (seen >= rank) {
+                return LatencyHistogram::getBucketLowerBound(bucket.first) + (LatencyHistogram::getBucketWidth(bucket.first) - 1) / 2.0;
+            }
+        }
+        return 0;
+    }
+}
+
+WindowTotals::WindowTotals(): sectionId(-1), count(0), totalTicks(0), maxTicks(0) {}
+
+WindowRoller::WindowRoller(): windowSeconds(0), windowCount(0), stopping(false), nextIndex(0), windowStart(0), generation(0) {}
+
+WindowRoller::~WindowRoller() {
+    close();
+}
+
+void WindowRoller::open(double windowSeconds, size_t windowCount, std::function<void(std::vector<WindowTotals>&)> collect) {
+    close();
+
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        this->collect = collect;
+        this->windowSeconds = windowSeconds;
+        this->windowCount = std::max<size_t>(windowCount, 1);
+        stopping = false;
+        windows.clear();
+        previous.clear();
+        generation++;
+        nextIndex = 0;
+        windowStart = GetCurrentTimeSeconds();
+    }
+
+    // The first window diffs against the totals so far, so it only has its own calls
+    std::vector<WindowTotals> totals;
+    collect(totals);
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        for (WindowTotals& total : totals) {
+            previous[total.sectionId] = std::move(total);
+        }
+    }
+    rollThread = std::thread(&WindowRoller::run, this);
+}
+
+void WindowRoller::close() {
+    if (!rollThread.joinable()) {
+        return;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+    }
+    wake.notify_one();
+    rollThread.join();
+
+    // The partial window since the last one closed
+    roll();
+    collect = nullptr;
+}
+
+bool WindowRoller::isOpen() {
+    return rollThread.joinable();
+}
+
+void WindowRoller::clear() {
+    std::lock_guard<std::mutex> lock(mutex);
+    windows.clear();
+    previous.clear();
+    generation++;
+    windowStart = GetCurrentTimeSeconds();
+}
+
+std::vector<StatsWindow> WindowRoller::getWindows() {
+    std::lock_guard<std::mutex> lock(mutex);
+    return std::vector<StatsWindow>(windows.begin(), windows.end());
+}
+
+double WindowRoller::getWindowSeconds() {
+    std::lock_guard<std::mutex> lock(mutex);
+    return windowSeconds;
+}
+
+void WindowRoller::run() {
+    // Window ends are fixed from the start, so a late wake-up doesn't shift the ones after it
+    std::unique_lock<std::mutex> lock(mutex);
+    auto start = std::chrono::steady_clock::now();
+    for (int64_t window = 1; !stopping; window++) {
+        auto end = start + std::chrono::duration_cast<std::chrono::steady_clock::duration>(std::chrono::duration<double>(windowSeconds * window));
+        if (wake.wait_until(lock, end, [this]() { return stopping; })) {
+            break;
+        }
+        lock.unlock();
+        roll();
+        lock.lock();
+    }
+}
+
+void WindowRoller::roll() {
+    uint64_t collectedGeneration;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        collectedGeneration = generation;
+    }
+    std::vector<WindowTotals> totals;
+    collect(totals);
+    double now = GetCurrentTimeSeconds();
+
+    std::lock_guard<std::mutex> lock(mutex);
+    if (generation != collectedGeneration) {
+        // Cleared while collecting, so these totals are from before
+        return;
+    }
+
+    StatsWindow window;
+    window.index = nextIndex++;
+    window.startTime = windowStart;
+    window.endTime = now;
+    windowStart = now;
+
+    // Each section's difference from the last window
+    std::vector<std::pair<int, uint64_t>> buckets;
+    for (WindowTotals& total : totals) {
+        auto found = previous.find(total.sectionId);
+        // Totals that went down were started over by a reset
+        WindowTotals const* before = found != previous.end() && found->second.count <= total.count ? &found->second : nullptr;
+        int64_t calls = total.count - (before != nullptr ? before->count : 0);
+        if (calls > 0) {
+            WindowSectionStats& section = window.sections[total.sectionId];
+            section.count = calls;
+            section.totalTime = TicksToSeconds(total.totalTicks - (before != nullptr ? before->totalTicks : 0));
+            section.avgTime = section.totalTime / calls;
+
+            // Both bucket lists are sorted, so one pass pairs them up
+            buckets.clear();
+            size_t earlier = 0;
+            for (auto const& bucket : total.buckets) {
+                uint64_t earlierCount = 0;
+                if (before != nullptr) {
+                    while (earlier < before->buckets.size() && before->buckets[earlier].first < bucket.first) {
+                        earlier++;
+                    }
+                    if (earlier < before->buckets.size() && before->buckets[earlier].first == bucket.first) {
+                        earlierCount = before->buckets[earlier].second;
+                    }
+                }
+                if (bucket.second > earlierCount) {
+                    buckets.emplace_back(bucket.first, bucket.second - earlierCount);
+                }
+            }
+
+            // A new overall maximum must have happened in this window
+            double maximum = TicksToNanoseconds(total.maxTicks);
+            if (before != nullptr && total.maxTicks <= before->maxTicks && !buckets.empty()) {
+                int highestBucket = buckets.back().first;
+                double bucketTop = double(LatencyHistogram::getBucketLowerBound(highestBucket) + LatencyHistogram::getBucketWidth(highestBucket) - 1);
+                maximum = std::min(maximum, bucketTop);
+            }
+            section.maxTime = maximum * 1e-9;
+            section.p99Time = SparsePercentile(buckets, 99) * 1e-9;
+        }
+        previous[total.sectionId] = std::move(total);
+    }
+
+    windows.push_back(std::move(window));
+    while (windows.size() > windowCount) {
+        windows.pop_front();
+    }
+}
@@ -0,0 +1,100 @@
+//stats_windows.hpp
+#pragma once
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <map>
+#include <mutex>
+#include <thread>
+#include <utility>
+#include <vector>
+
+// Calls of one section in one window, over all threads. Times are in seconds.
+class WindowSectionStats {
+public:
+    WindowSectionStats();
+
+    int64_t count;
+    double totalTime;
+    double avgTime;
+    double maxTime;
+    double p99Time;
+};
+
+// One fixed-length slice of the run
+class StatsWindow {
+public:
+    StatsWindow();
+
+    // Windows are numbered from 0 since the rollups started
+    int64_t index;
+    // Seconds since the program started
+    double startTime;
+    double endTime;
+    // Keyed by section id. Sections without calls in the window are left out.
+    std::map<int, WindowSectionStats> sections;
+};
+
+// Running totals of one section over all threads, as the profiler hands them
+// over at the end of a window
+class WindowTotals {
+public:
+    WindowTotals();
+
+    int sectionId;
+    int64_t count;
+    int64_t totalTicks;
+    int64_t maxTicks;
+    // The non-empty LatencyHistogram buckets as (bucket index, calls), lowest
+    // first, so keeping them for the next window costs only what was recorded
+    std::vector<std::pair<int, uint64_t>> buckets;
+};
+
+// Turns the profiler's running totals into a bounded ring of windows. A
+// background thread wakes at the end of every window, takes the totals and
+// keeps the difference from the previous ones, so the probes never see it.
+// Exits that land while it collects may count towards either window.
+//
+// The maximum of a window is exact when the section's overall maximum rose
+// during it; otherwise it comes from the window's histogram, within 1.6%.
+class WindowRoller {
+public:
+    WindowRoller();
+    ~WindowRoller();
+
+    // Drops the windows so far and starts rolling. collect runs on the
+    // background thread and fills in every section's totals.
+    void open(double windowSeconds, size_t windowCount, std::function<void(std::vector<WindowTotals>&)> collect);
+    // Closes the current, partial window and stops. The windows are kept.
+    void close();
+    bool isOpen();
+    // Drops the windows so far and the totals they are diffed against, for
+    // when the profiler's totals start over
+    void clear();
+
+    // Oldest first
+    std::vector<StatsWindow> getWindows();
+    double getWindowSeconds();
+
+private:
+    void run();
+    void roll();
+
+    std::function<void(std::vector<WindowTotals>&)> collect;
+    double windowSeconds;
+    size_t windowCount;
+    std::thread rollThread;
+
+    // Guards everything below
+    std::mutex mutex;
+    std::condition_variable wake;
+    bool stopping;
+    std::deque<StatsWindow> windows;
+    int64_t nextIndex;
+    double windowStart;
+    // Totals at the end of the last window, keyed by section id
+    std::map<int, WindowTotals> previous;
+    // Bumped by clear(), so totals collected before it are thrown away
+    uint64_t generation;
+};
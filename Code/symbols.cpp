@@ -0,0 +1,191 @@
+#include "symbols.hpp"
+#include <algorithm>
+#include <cstdint>
+#include <cstdlib>
+#include <fstream>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <cxxabi.h>
+#include <dlfcn.h>
+#define PROFILER_HAS_DLADDR 1
+#endif
+
+#if defined(__linux__)
+#include <elf.h>
+#include <link.h>
+#define PROFILER_HAS_ELF 1
+// The ELF flavour of this process, which is the only one it can load
+#if __SIZEOF_POINTER__ == 8
+#define PROFILER_ELF_CLASS ELFCLASS64
+#define PROFILER_ELF_ST_TYPE ELF64_ST_TYPE
+#else
+#define PROFILER_ELF_CLASS ELFCLASS32
+#define PROFILER_ELF_ST_TYPE ELF32_ST_TYPE
+#endif
+#endif
+
+namespace {
+#if defined(PROFILER_HAS_ELF)
+    // The function symbols of one ELF file, sorted by address
+    class SymbolTable {
+    public:
+        struct Symbol {
+            uintptr_t address;
+            uintptr_t size;
+            uint32_t nameOffset;
+        };
+
+        // Empty if the file can't be read or has no symbol table
+        void load(char const* path) {
+            std::ifstream file(path, std::ios::binary);
+            ElfW(Ehdr) header;
+            if (!file.read(reinterpret_cast<char*>(&header), sizeof(header)) || std::string(reinterpret_cast<char*>(header.e_ident), SELFMAG) != ELFMAG || header.e_ident[EI_CLASS] != PROFILER_ELF_CLASS || header.e_shentsize != sizeof(ElfW(Shdr))) {
+                return;
+            }
+            // Symbols of an executable hold absolute addresses, those of a
+            // shared object or position-independent executable offsets from
+            // where it was loaded
+            relative = header.e_type == ET_DYN;
+
+            std::vector<ElfW(Shdr)> sections(header.e_shnum);
+            file.seekg(header.e_shoff);
+            if (sections.empty() || !file.read(reinterpret_cast<char*>(sections.data()), sections.size() * sizeof(ElfW(Shdr)))) {
+                return;
+            }
+            // The full table if it wasn't stripped, otherwise the dynamic one
+            ElfW(Shdr) const* table = nullptr;
+            for (ElfW(Shdr) const& section : sections) {
+                if (section.sh_type == SHT_SYMTAB || (section.sh_type == SHT_DYNSYM && table == nullptr)) {
+                    table = &section;
+                }
+            }
+            if (table == nullptr || table->sh_link >= sections.size()) {
+                return;
+            }
+
+            std::vector<ElfW(Sym)> entries(table->sh_size / sizeof(ElfW(Sym)));
+            file.seekg(table->sh_offset);
+            file.read(reinterpret_cast<char*>(entries.data()), entries.size() * sizeof(ElfW(Sym)));
+            ElfW(Shdr) const& stringSection = sections[table->sh_link];
+            strings.resize(stringSection.sh_size);
+            file.seekg(stringSection.sh_offset);
+            file.read(&strings[0], strings.size());
+            if (!file) {
+                strings.clear();
+                return;
+            }
+
+            for (ElfW(Sym) const& entry : entries) {
+                if (PROFILER_ELF_ST_TYPE(entry.st_info) == STT_FUNC && entry.st_value != 0 && entry.st_name < strings.size()) {
+                    symbols.push_back({ (uintptr_t)entry.st_value, (uintptr_t)entry.st_size, entry.st_name });
+                }
+            }
+            std::sort(symbols.begin(), symbols.end(), [](Symbol const& a, Symbol const& b) { return a.address < b.address; });
+        }
+
+        // Mangled name of the function covering address, or null
+        char const* find(uintptr_t address, uintptr_t loadAddress) const {
+            if (relative) {
+                address -= loadAddress;
+            }
+            auto after = std::upper_bound(symbols.begin(), symbols.end(), address, [](uintptr_t value, Symbol const& symbol) { return value < symbol.address; });
+            if (after == symbols.begin()) {
+                return nullptr;
+            }
+            Symbol const& symbol = *(after - 1);
+            // Sizeless symbols, e.g. from assembly, cover up to the next one
+            if (symbol.size != 0 && address >= symbol.address + symbol.size) {
+                return nullptr;
+            }
+            return &strings[symbol.nameOffset];
+        }
+
+    private:
+        bool relative = false;
+        std::vector<Symbol> symbols;
+        std::string strings;
+    };
+
+    std::mutex gTablesMutex;
+    // Keyed by file path, loaded on first use
+    std::map<std::string, std::unique_ptr<SymbolTable>> gTables;
+
+    char const* FindInSymbolTable(char const* path, uintptr_t address, uintptr_t loadAddress) {
+        std::lock_guard<std::mutex> lock(gTablesMutex);
+        std::unique_ptr<SymbolTable>& table = gTables[path];
+        if (!table) {
+            table.reset(new SymbolTable());
+            table->load(path);
+        }
+        return table->find(address, loadAddress);
+    }
+#endif
+}
+
+std::string SymbolizeAddress(void const* address) {
+#if defined(PROFILER_HAS_DLADDR)
+    Dl_info info;
+    if (dladdr(address, &info) == 0) {
+        return "";
+    }
+    char const* mangled = info.dli_sname;
+    std::string fromTable;
+#if defined(PROFILER_HAS_ELF)
+    // dladdr only sees exported symbols, which leaves out most functions of an
+    // executable not linked with -rdynamic
+    if (mangled == nullptr && info.dli_fname != nullptr) {
+        uintptr_t loadAddress = (uintptr_t)info.dli_fbase;
+        char const* found = FindInSymbolTable(info.dli_fname, (uintptr_t)address, loadAddress);
+        // Libraries come with absolute paths; the main program's is how it was
+        // started, which may be relative to another directory, or empty
+        if (found == nullptr && info.dli_fname[0] != '/') {
+            found = FindInSymbolTable("/proc/self/exe", (uintptr_t)address, loadAddress);
+        }
+        if (found != nullptr) {
+            fromTable = found;
+            mangled = fromTable.c_str();
+        }
+    }
+#endif
+    if (mangled == nullptr) {
+        return "";
+    }
+
+    int status = 0;
+    char* demangled = abi::__cxa_demangle(mangled, nullptr, nullptr, &status);
+    std::string name = status == 0 && demangled != nullptr ? demangled : mangled;
+    std::free(demangled);
+    return name;
+#else
+    (void)address;
+    return "";
+#endif
+}
+
+bool MatchesPattern(char const* text, char const* pattern) {
+    // Greedy match that backtracks to the last '*' on a mismatch
+    char const* star = nullptr;
+    char const* resume = nullptr;
+    while (*text != '\0') {
+        if (*pattern == '*') {
+            star = pattern++;
+            resume = text;
+        } else if (*pattern == *text) {
+            pattern++;
+            text++;
+        } else if (star != nullptr) {
+            pattern = star + 1;
+            text = ++resume;
+        } else {
+            return false;
+        }
+    }
+    while (*pattern == '*') {
+        pattern++;
+    }
+    return *pattern == '\0';
+}
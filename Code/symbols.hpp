@@ -0,0 +1,15 @@
+//symbols.hpp
+#pragma once
+#include <string>
+
+// Demangled name of the function containing address, e.g. "Foo::bar(int)".
+// Tries the dynamic symbol table through dladdr first, then the full symbol
+// table of the executable or library the address lies in, read from the
+// file and kept for later calls. Returns an empty string when no symbol
+// covers the address or the platform has no dladdr. Safe to call from any
+// thread.
+std::string SymbolizeAddress(void const* address);
+
+// Whether text matches pattern, where '*' stands for any run of characters
+// and everything else for itself
+bool MatchesPattern(char const* text, char const* pattern);
@@ -1,11 +1,111 @@
 #include "time.hpp"
-#include <chrono>
+#include <cstdlib>
+#include <cstring>
+
+#if defined(PROFILER_HAS_TSC)
+#include <cpuid.h>
+#endif
+
+ClockSource gClockSource = ClockSource::Steady;
+
+namespace {
+    // Constant-initialized to steady_clock's rate, so conversions are correct even
+    // before the startup calibration below has run
+    constexpr double STEADY_SECONDS_PER_TICK = double(std::chrono::steady_clock::period::num) / double(std::chrono::steady_clock::period::den);
+    double gSecondsPerTick = STEADY_SECONDS_PER_TICK;
+    int64_t gStartTicks = 0;
+
+    // How long to compare the TSC against steady_clock when calibrating
+    constexpr double CALIBRATION_SECONDS = 0.02;
+
+    double CalibrateTscSecondsPerTick() {
+#if defined(PROFILER_HAS_TSC)
+        unsigned int processor;
+        auto steadyStart = std::chrono::steady_clock::now();
+        uint64_t tscStart = __rdtscp(&processor);
+
+        std::chrono::duration<double> elapsed;
+        do {
+            elapsed = std::chrono::steady_clock::now() - steadyStart;
+        } while (elapsed.count() < CALIBRATION_SECONDS);
+
+        uint64_t tscEnd = __rdtscp(&processor);
+        return elapsed.count() / double(tscEnd - tscStart);
+#else
+        return STEADY_SECONDS_PER_TICK;
+#endif
+    }
+
+    // Picks and calibrates the clock once, during static initialization
+    struct ClockStartup {
+        ClockStartup() {
+            char const* requested = std::getenv("PROFILER_CLOCK");
+            bool forceSteady = requested != nullptr && std::strcmp(requested, "steady") == 0;
+            if (forceSteady || !SetClockSource(ClockSource::Tsc)) {
+                SetClockSource(ClockSource::Steady);
+            }
+        }
+    };
+    ClockStartup gClockStartup;
+}
+
+bool HasInvariantTsc() {
+#if defined(PROFILER_HAS_TSC)
+    unsigned int eax, ebx, ecx, edx;
+    if (__get_cpuid(0x80000000, &eax, &ebx, &ecx, &edx) == 0 || eax < 0x80000007) {
+        return false;
+    }
+
+    // rdtscp support is bit 27 of EDX in leaf 0x80000001
+    __get_cpuid(0x80000001, &eax, &ebx, &ecx, &edx);
+    bool hasRdtscp = (edx & (1u << 27)) != 0;
+
+    // Invariant TSC is bit 8 of EDX in leaf 0x80000007
+    __get_cpuid(0x80000007, &eax, &ebx, &ecx, &edx);
+    bool invariant = (edx & (1u << 8)) != 0;
+
+    return hasRdtscp && invariant;
+#else
+    return false;
+#endif
+}
+
+bool SetClockSource(ClockSource source) {
+    if (source == ClockSource::Tsc) {
+        if (!HasInvariantTsc()) {
+            return false;
+        }
+        gSecondsPerTick = CalibrateTscSecondsPerTick();
+    } else {
+        gSecondsPerTick = STEADY_SECONDS_PER_TICK;
+    }
+
+    gClockSource = source;
+    gStartTicks = GetCurrentTicks();
+    return true;
+}
+
+ClockSource GetClockSource() {
+    return gClockSource;
+}
+
+double GetTicksPerSecond() {
+    return 1.0 / gSecondsPerTick;
+}
+
+double TicksToSeconds(int64_t ticks) {
+    return double(ticks) * gSecondsPerTick;
+}
+
+double TicksToNanoseconds(int64_t ticks) {
+    return double(ticks) * gSecondsPerTick * 1e9;
+}
 
 double GetCurrentTimeSeconds() {
     // Get the current time in seconds. It is the time since the program started.
-    // Since static variables are only created once.
-    static auto start = std::chrono::high_resolution_clock::now();
-    auto now = std::chrono::high_resolution_clock::now();
-    return std::chrono::duration_cast<std::chrono::duration<double>>(now - start).count();
+    return TicksToSeconds(GetCurrentTicks() - gStartTicks);
 }
 
+int64_t GetStartTicks() {
+    return gStartTicks;
+}
@@ -1,4 +1,47 @@
 //time.hpp
 #pragma once
+#include <chrono>
+#include <cstdint>
 
-double GetCurrentTimeSeconds();
\ No newline at end of file
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define PROFILER_HAS_TSC 1
+#endif
+
+// Where timestamps come from.
+// Steady reads std::chrono::steady_clock. Tsc reads the CPU's time stamp
+// counter with rdtscp, and is only offered when the CPU reports an invariant
+// TSC (constant rate across frequency changes and sleep states).
+enum class ClockSource { Steady, Tsc };
+
+// The active clock source. Chosen once at startup; set PROFILER_CLOCK=steady in
+// the environment to force the fallback.
+extern ClockSource gClockSource;
+
+// Raw timestamp of the active clock, in ticks. Probes store these and only
+// convert to seconds when reporting.
+inline int64_t GetCurrentTicks() {
+#if defined(PROFILER_HAS_TSC)
+    if (gClockSource == ClockSource::Tsc) {
+        unsigned int processor;
+        return (int64_t)__rdtscp(&processor);
+    }
+#endif
+    return (int64_t)std::chrono::steady_clock::now().time_since_epoch().count();
+}
+
+// Switches the clock and calibrates it. Returns false, and keeps the current
+// clock, if the source isn't available on this machine. Timestamps taken with
+// different sources can't be compared, so only call this before profiling.
+bool SetClockSource(ClockSource source);
+ClockSource GetClockSource();
+bool HasInvariantTsc();
+
+double GetTicksPerSecond();
+double TicksToSeconds(int64_t ticks);
+double TicksToNanoseconds(int64_t ticks);
+
+// Seconds since the program started
+double GetCurrentTimeSeconds();
+// Tick count when the program started, the origin of GetCurrentTimeSeconds
+int64_t GetStartTicks();
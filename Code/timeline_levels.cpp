@@ -0,0 +1,63 @@
+#include "timeline_levels.hpp"
+#include <cmath>
+
+std::vector<size_t> DownsampleLTTB(std::vector<double> const& x, std::vector<double> const& y, size_t points) {
+    size_t count = x.size();
+    std::vector<size_t> kept;
+    if (points >= count || points < 3) {
+        kept.reserve(count);
+        for (size_t i = 0; i < count; i++) {
+            kept.push_back(i);
+        }
+        return kept;
+    }
+
+    kept.reserve(points);
+    kept.push_back(0);
+    // The points between the first and last, split into points - 2 buckets
+    double bucketSize = double(count - 2) / (points - 2);
+    size_t previous = 0;
+    for (size_t bucket = 0; bucket < points - 2; bucket++) {
+        size_t start = (size_t)(bucket * bucketSize) + 1;
+        size_t end = (size_t)((bucket + 1) * bucketSize) + 1;
+
+        // Average of the next bucket, or the last point after the final bucket
+        size_t nextStart = end;
+        size_t nextEnd = bucket + 2 < points - 1 ? (size_t)((bucket + 2) * bucketSize) + 1 : count;
+        if (nextEnd > count) {
+            nextEnd = count;
+        }
+        double averageX = 0;
+        double averageY = 0;
+        for (size_t i = nextStart; i < nextEnd; i++) {
+            averageX += x[i];
+            averageY += y[i];
+        }
+        averageX /= nextEnd - nextStart;
+        averageY /= nextEnd - nextStart;
+
+        // Twice the triangle's area; the factor doesn't change which is largest
+        size_t best = start;
+        double bestArea = -1;
+        for (size_t i = start; i < end; i++) {
+            double area = std::fabs((x[previous] - averageX) * (y[i] - y[previous]) - (x[previous] - x[i]) * (averageY - y[previous]));
+            if (area > bestArea) {
+                bestArea = area;
+                best = i;
+            }
+        }
+        kept.push_back(best);
+        previous = best;
+    }
+    kept.push_back(count - 1);
+    return kept;
+}
+
+std::vector<size_t> GetTimelineLevelSizes(size_t points, size_t coarsest, size_t factor) {
+    std::vector<size_t> sizes;
+    for (size_t size = coarsest; size < points; size *= factor) {
+        sizes.push_back(size);
+    }
+    sizes.push_back(points);
+    return sizes;
+}
@@ -0,0 +1,23 @@
+//timeline_levels.hpp
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// Multi-resolution timelines, so a viewer can draw a long run from a few
+// thousand points and only load more detail for the range it zooms into.
+
+// Indices of the points Largest-Triangle-Three-Buckets downsampling keeps to
+// draw the curve through (x[i], y[i]) with the given number of points. The
+// first and last points are always kept; in between, each of the equal-sized
+// buckets keeps the point that spans the largest triangle with the point kept
+// before it and the average of the next bucket, which preserves the curve's
+// visible shape far better than keeping every n-th point. All indices when
+// there are no more points than that.
+std::vector<size_t> DownsampleLTTB(std::vector<double> const& x, std::vector<double> const& y, size_t points);
+
+// Point counts of the zoom levels of a timeline of the given length, coarsest
+// first: coarsest, coarsest * factor, ... while smaller than the timeline,
+// then the whole timeline. Just the whole timeline when it is no longer than
+// the coarsest level.
+std::vector<size_t> GetTimelineLevelSizes(size_t points, size_t coarsest, size_t factor);
@@ -0,0 +1,309 @@
+// Compares two profiler reports and flags the sections that got significantly
+// slower, to gate performance test runs.
+//
+//   profile_diff <baseline report> <candidate report> [--threshold percent] [--alpha level]
+//
+// Reports are the JSON or CSV files saveStatsToJSON and saveStatsToCSV write.
+// Sections are matched by name and call site; a section whose call site moved
+// is still matched by name when the name is unique. A section regresses when
+// its average time rose by more than the threshold (5% by default) and Welch's
+// t-test puts the rise below the significance level (0.01 by default). The
+// spread of the call times comes from the report's standard deviation, or from
+// its timeline for reports that don't have one. Sections called only once can't
+// be tested and never fail the gate.
+//
+// Exits with 1 if any section regressed, 2 if a report can't be read, else 0.
+#include "../report_reader.hpp"
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <map>
+#include <stdexcept>
+#include <string>
+#include <tuple>
+#include <vector>
+
+namespace {
+    enum class Verdict { Regression, Improvement, Unchanged, Untested };
+
+    char const* GetVerdictName(Verdict verdict) {
+        switch (verdict) {
+            case Verdict::Regression: return "Regression";
+            case Verdict::Improvement: return "Improvement";
+            case Verdict::Unchanged: return "Unchanged";
+            default: return "Untested";
+        }
+    }
+
+    // One section found in both reports
+    struct SectionDiff {
+        ReportSection const* baseline;
+        ReportSection const* candidate;
+        double avgChange;
+        double totalChange;
+        double maxChange;
+        // Two-sided, or negative when untested
+        double pValue;
+        Verdict verdict;
+    };
+
+    // Seconds with the unit that keeps 3-4 significant digits
+    std::string FormatTime(double seconds) {
+        char text[32];
+        if (seconds >= 1) {
+            std::snprintf(text, sizeof(text), "%.2fs", seconds);
+        } else if (seconds >= 1e-3) {
+            std::snprintf(text, sizeof(text), "%.2fms", seconds * 1e3);
+        } else if (seconds >= 1e-6) {
+            std::snprintf(text, sizeof(text), "%.2fus", seconds * 1e6);
+        } else {
+            std::snprintf(text, sizeof(text), "%.0fns", seconds * 1e9);
+        }
+        return text;
+    }
+
+    // Relative change from a to b, in percent
+    double PercentChange(double a, double b) {
+        if (a == 0) {
+            return b == 0 ? 0 : HUGE_VAL;
+        }
+        return (b - a) / a * 100;
+    }
+
+    // Variance of the time of one call. Returns false when the report doesn't
+    // say enough to estimate it.
+    bool GetCallVariance(ReportSection const& section, double& variance) {
+        if (section.count < 2) {
+            return false;
+        }
+        if (section.stdDevTime >= 0) {
+            variance = section.stdDevTime * section.stdDevTime;
+            return true;
+        }
+        if (section.timeline.size() < 2) {
+            return false;
+        }
+
+        double mean = section.totalTime / section.count;
+        double sum = 0;
+        size_t points = section.timeline.size();
+        if (section.timelineCalls.empty()) {
+            // One point per call, so the steps are the call times
+            double previous = 0;
+            for (double cumulative : section.timeline) {
+                double call = cumulative - previous;
+                sum += (call - mean) * (call - mean);
+                previous = cumulative;
+            }
+        } else {
+            // Sampled: the average of k calls varies k times less than one call
+            double previousTime = 0;
+            int64_t previousCalls = 0;
+            for (size_t i = 0; i < points && i < section.timelineCalls.size(); i++) {
+                int64_t calls = section.timelineCalls[i] - previousCalls;
+                if (calls > 0) {
+                    double average = (section.timeline[i] - previousTime) / calls;
+                    sum += calls * (average - mean) * (average - mean);
+                }
+                previousTime = section.timeline[i];
+                previousCalls = section.timelineCalls[i];
+            }
+        }
+        variance = sum / (points - 1);
+        return true;
+    }
+
+    // Continued fraction of the regularized incomplete beta function, by
+    // modified Lentz's method
+    double BetaContinuedFraction(double a, double b, double x) {
+        double const tiny = 1e-300;
+        double c = 1;
+        double d = 1 - (a + b) * x / (a + 1);
+        d = 1 / (std::fabs(d) < tiny ? tiny : d);
+        double result = d;
+        for (int m = 1; m <= 300; m++) {
+            for (int step = 0; step < 2; step++) {
+                double numerator = step == 0 ? m * (b - m) * x / ((a + 2 * m - 1) * (a + 2 * m)) : -(a + m) * (a + b + m) * x / ((a + 2 * m) * (a + 2 * m + 1));
+                d = 1 + numerator * d;
+                d = 1 / (std::fabs(d) < tiny ? tiny : d);
+                c = 1 + numerator / c;
+                c = std::fabs(c) < tiny ? tiny : c;
+                result *= c * d;
+                if (step == 1 && std::fabs(c * d - 1) < 1e-12) {
+                    return result;
+                }
+            }
+        }
+        return result;
+    }
+
+    double RegularizedIncompleteBeta(double a, double b, double x) {
+        if (x <= 0) {
+            return 0;
+        }
+        if (x >= 1) {
+            return 1;
+        }
+        double front = std::exp(std::lgamma(a + b) - std::lgamma(a) - std::lgamma(b) + a * std::log(x) + b * std::log(1 - x));
+        // The fraction converges quickly on this side of the mean only
+        if (x < (a + 1) / (a + b + 2)) {
+            return front * BetaContinuedFraction(a, b, x) / a;
+        }
+        return 1 - front * BetaContinuedFraction(b, a, 1 - x) / b;
+    }
+
+    // Two-sided p-value of Welch's t-test for a difference in means
+    double WelchTest(double mean1, double variance1, double n1, double mean2, double variance2, double n2) {
+        double error1 = variance1 / n1;
+        double error2 = variance2 / n2;
+        double standardError = std::sqrt(error1 + error2);
+        if (standardError == 0) {
+            return mean1 == mean2 ? 1 : 0;
+        }
+        double t = (mean2 - mean1) / standardError;
+        double degrees = (error1 + error2) * (error1 + error2) / (error1 * error1 / (n1 - 1) + error2 * error2 / (n2 - 1));
+        return RegularizedIncompleteBeta(degrees / 2, 0.5, degrees / (degrees + t * t));
+    }
+
+    SectionDiff Compare(ReportSection const& baseline, ReportSection const& candidate, double threshold, double alpha) {
+        SectionDiff diff;
+        diff.baseline = &baseline;
+        diff.candidate = &candidate;
+        diff.avgChange = PercentChange(baseline.avgTime, candidate.avgTime);
+        diff.totalChange = PercentChange(baseline.totalTime, candidate.totalTime);
+        diff.maxChange = PercentChange(baseline.maxTime, candidate.maxTime);
+        diff.pValue = -1;
+        diff.verdict = Verdict::Untested;
+
+        double baselineVariance;
+        double candidateVariance;
+        if (!GetCallVariance(baseline, baselineVariance) || !GetCallVariance(candidate, candidateVariance)) {
+            return diff;
+        }
+        diff.pValue = WelchTest(baseline.avgTime, baselineVariance, (double)baseline.count, candidate.avgTime, candidateVariance, (double)candidate.count);
+        if (diff.pValue < alpha && diff.avgChange > threshold) {
+            diff.verdict = Verdict::Regression;
+        } else if (diff.pValue < alpha && diff.avgChange < -threshold) {
+            diff.verdict = Verdict::Improvement;
+        } else {
+            diff.verdict = Verdict::Unchanged;
+        }
+        return diff;
+    }
+
+    std::string FormatChange(double percent) {
+        char text[32];
+        if (std::isinf(percent)) {
+            return "new";
+        }
+        std::snprintf(text, sizeof(text), "%+.1f%%", percent);
+        return text;
+    }
+}
+
+int main(int argc, char** argv) {
+    if (argc < 3 || argc % 2 != 1) {
+        std::cerr << "Usage: " << argv[0] << " <baseline report> <candidate report> [--threshold percent] [--alpha level]" << std::endl;
+        return 2;
+    }
+
+    double threshold = 5;
+    double alpha = 0.01;
+    for (int i = 3; i + 1 < argc; i += 2) {
+        if (std::strcmp(argv[i], "--threshold") == 0 && std::atof(argv[i + 1]) >= 0) {
+            threshold = std::atof(argv[i + 1]);
+        } else if (std::strcmp(argv[i], "--alpha") == 0 && std::atof(argv[i + 1]) > 0) {
+            alpha = std::atof(argv[i + 1]);
+        } else {
+            std::cerr << "Unknown option " << argv[i] << " " << argv[i + 1] << std::endl;
+            return 2;
+        }
+    }
+
+    std::vector<ReportSection> baseline;
+    std::vector<ReportSection> candidate;
+    try {
+        baseline = LoadReport(argv[1]);
+        candidate = LoadReport(argv[2]);
+    } catch (std::exception const& error) {
+        std::cerr << error.what() << std::endl;
+        return 2;
+    }
+
+    // Match on name and call site first, then by name alone where it is unique
+    // on both sides, as when a section moved to another line
+    typedef std::tuple<std::string, std::string, std::string, int> CallSite;
+    std::map<CallSite, size_t> baselineSites;
+    for (size_t i = 0; i < baseline.size(); i++) {
+        baselineSites[std::make_tuple(baseline[i].sectionName, baseline[i].fileName, baseline[i].functionName, baseline[i].lineNumber)] = i;
+    }
+    std::vector<bool> baselineMatched(baseline.size(), false);
+    std::vector<bool> candidateMatched(candidate.size(), false);
+    std::vector<SectionDiff> diffs;
+    for (size_t i = 0; i < candidate.size(); i++) {
+        auto found = baselineSites.find(std::make_tuple(candidate[i].sectionName, candidate[i].fileName, candidate[i].functionName, candidate[i].lineNumber));
+        if (found != baselineSites.end() && !baselineMatched[found->second]) {
+            baselineMatched[found->second] = true;
+            candidateMatched[i] = true;
+            diffs.push_back(Compare(baseline[found->second], candidate[i], threshold, alpha));
+        }
+    }
+    std::map<std::string, std::vector<size_t>> baselineByName;
+    std::map<std::string, std::vector<size_t>> candidateByName;
+    for (size_t i = 0; i < baseline.size(); i++) {
+        if (!baselineMatched[i]) {
+            baselineByName[baseline[i].sectionName].push_back(i);
+        }
+    }
+    for (size_t i = 0; i < candidate.size(); i++) {
+        if (!candidateMatched[i]) {
+            candidateByName[candidate[i].sectionName].push_back(i);
+        }
+    }
+    for (auto const& name : candidateByName) {
+        auto found = baselineByName.find(name.first);
+        if (name.second.size() == 1 && found != baselineByName.end() && found->second.size() == 1) {
+            baselineMatched[found->second[0]] = true;
+            candidateMatched[name.second[0]] = true;
+            diffs.push_back(Compare(baseline[found->second[0]], candidate[name.second[0]], threshold, alpha));
+        }
+    }
+
+    // Regressions first, each group with the largest rise in average time first
+    std::sort(diffs.begin(), diffs.end(), [](SectionDiff const& a, SectionDiff const& b) {
+        if (a.verdict != b.verdict) {
+            return (int)a.verdict < (int)b.verdict;
+        }
+        return a.avgChange > b.avgChange;
+    });
+
+    int regressions = 0;
+    std::printf("%-40s %10s %10s %10s %10s %9s %9s %9s %9s  %s\n", "Section", "Calls A", "Calls B", "Avg A", "Avg B", "Avg", "Total", "Max", "p", "Verdict");
+    for (SectionDiff const& diff : diffs) {
+        char pValue[16] = "-";
+        if (diff.pValue >= 0) {
+            std::snprintf(pValue, sizeof(pValue), "%.2g", diff.pValue);
+        }
+        std::printf("%-40.40s %10lld %10lld %10s %10s %9s %9s %9s %9s  %s\n", diff.candidate->sectionName.c_str(), (long long)diff.baseline->count, (long long)diff.candidate->count, FormatTime(diff.baseline->avgTime).c_str(), FormatTime(diff.candidate->avgTime).c_str(), FormatChange(diff.avgChange).c_str(), FormatChange(diff.totalChange).c_str(), FormatChange(diff.maxChange).c_str(), pValue, GetVerdictName(diff.verdict));
+        if (diff.verdict == Verdict::Regression) {
+            regressions++;
+        }
+    }
+
+    for (size_t i = 0; i < baseline.size(); i++) {
+        if (!baselineMatched[i]) {
+            std::printf("Only in baseline: %s (%s:%d)\n", baseline[i].sectionName.c_str(), baseline[i].fileName.c_str(), baseline[i].lineNumber);
+        }
+    }
+    for (size_t i = 0; i < candidate.size(); i++) {
+        if (!candidateMatched[i]) {
+            std::printf("Only in candidate: %s (%s:%d)\n", candidate[i].sectionName.c_str(), candidate[i].fileName.c_str(), candidate[i].lineNumber);
+        }
+    }
+
+    std::printf("\n%d of %zu sections regressed by more than %g%% at p < %g\n", regressions, diffs.size(), threshold, alpha);
+    return regressions > 0 ? 1 : 0;
+}
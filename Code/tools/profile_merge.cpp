@@ -0,0 +1,84 @@
+// Merges the snapshots written by Profiler::saveSnapshot, e.g. one per worker
+// process, into one profile.
+//
+//   profile_merge [-j jobs] [-o output]... <snapshot>...
+//
+// -j sets how many threads load and merge the snapshots (one per core by
+// default). Each -o writes the merged profile, as a CSV report for a .csv
+// name, a JSON report for a .json name and a snapshot otherwise, which can be
+// merged again with others. Without any -o the stats are printed instead.
+#include "../profiler.hpp"
+#include "../stats_snapshot.hpp"
+#include "../time.hpp"
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+namespace {
+    bool EndsWith(std::string const& text, char const* suffix) {
+        size_t length = std::strlen(suffix);
+        return text.size() >= length && text.compare(text.size() - length, length, suffix) == 0;
+    }
+}
+
+int main(int argc, char** argv) {
+    unsigned jobs = 0;
+    std::vector<std::string> outputs;
+    std::vector<std::string> inputs;
+    for (int i = 1; i < argc; i++) {
+        if (std::strcmp(argv[i], "-j") == 0 && i + 1 < argc && std::atoi(argv[i + 1]) > 0) {
+            jobs = (unsigned)std::atoi(argv[++i]);
+        } else if (std::strcmp(argv[i], "-o") == 0 && i + 1 < argc) {
+            outputs.push_back(argv[++i]);
+        } else if (argv[i][0] == '-') {
+            std::cerr << "Unknown option " << argv[i] << std::endl;
+            return 1;
+        } else {
+            inputs.push_back(argv[i]);
+        }
+    }
+    if (inputs.empty()) {
+        std::cerr << "Usage: " << argv[0] << " [-j jobs] [-o output.csv|output.json|output.snapshot]... <snapshot>..." << std::endl;
+        return 1;
+    }
+
+    StatsSnapshot merged;
+    try {
+        merged = MergeSnapshotFiles(inputs, jobs);
+    } catch (std::exception const& error) {
+        std::cerr << error.what() << std::endl;
+        return 1;
+    }
+    std::cerr << "Merged " << inputs.size() << " snapshots of " << merged.processCount << " processes, " << merged.sections.size() << " sections" << std::endl;
+
+    // The reports are written by a profiler holding only the merged totals. A
+    // steady clock tick is a nanosecond, so they go in unchanged rather than
+    // through this run's TSC calibration.
+    SetClockSource(ClockSource::Steady);
+    Profiler* profiler = Profiler::GetInstance();
+    profiler->loadSnapshot(merged);
+    try {
+        for (std::string const& output : outputs) {
+            if (EndsWith(output, ".csv")) {
+                profiler->saveStatsToCSV(output.c_str());
+            } else if (EndsWith(output, ".json")) {
+                profiler->saveStatsToJSON(output.c_str());
+            } else {
+                merged.save(output.c_str());
+            }
+        }
+    } catch (std::exception const& error) {
+        std::cerr << error.what() << std::endl;
+        delete profiler;
+        return 1;
+    }
+    if (outputs.empty()) {
+        profiler->printStats();
+    }
+
+    delete profiler;
+    return 0;
+}
@@ -0,0 +1,261 @@
+// Shows the live stats of a running process that called
+// Profiler::startLiveStats, refreshed like top.
+//
+//   profiler_top <pid> [-s rate|calls|avg|max|p99|total|name] [-i seconds] [-n frames]
+//
+// -s picks the column the table is sorted by (rate by default), -i how often
+// it refreshes (1 second by default) and -n stops after that many frames, for
+// logging to a file. While it runs, the keys r, c, a, m, p, t and n switch the
+// sort column and q quits.
+#include "../live_stats.hpp"
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <map>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <poll.h>
+#include <sys/ioctl.h>
+#include <termios.h>
+#include <unistd.h>
+#define PROFILER_HAS_TERMINAL 1
+#endif
+
+namespace {
+    enum class SortColumn { Rate, Calls, Avg, Max, P99, Total, Name };
+
+    // One row of the table
+    struct Row {
+        LiveSectionStats const* section;
+        double callsPerSecond;
+    };
+
+    bool ParseSortColumn(char key, SortColumn& column) {
+        switch (key) {
+            case 'r': column = SortColumn::Rate; return true;
+            case 'c': column = SortColumn::Calls; return true;
+            case 'a': column = SortColumn::Avg; return true;
+            case 'm': column = SortColumn::Max; return true;
+            case 'p': column = SortColumn::P99; return true;
+            case 't': column = SortColumn::Total; return true;
+            case 'n': column = SortColumn::Name; return true;
+            default: return false;
+        }
+    }
+
+    char const* GetSortColumnName(SortColumn column) {
+        switch (column) {
+            case SortColumn::Rate: return "Calls/s";
+            case SortColumn::Calls: return "Calls";
+            case SortColumn::Avg: return "Avg";
+            case SortColumn::Max: return "Max";
+            case SortColumn::P99: return "P99";
+            case SortColumn::Total: return "Total";
+            default: return "Section";
+        }
+    }
+
+    // Seconds with the unit that keeps 3-4 significant digits
+    std::string FormatTime(double seconds) {
+        char text[32];
+        if (seconds >= 1) {
+            std::snprintf(text, sizeof(text), "%.2fs", seconds);
+        } else if (seconds >= 1e-3) {
+            std::snprintf(text, sizeof(text), "%.2fms", seconds * 1e3);
+        } else if (seconds >= 1e-6) {
+            std::snprintf(text, sizeof(text), "%.2fus", seconds * 1e6);
+        } else {
+            std::snprintf(text, sizeof(text), "%.0fns", seconds * 1e9);
+        }
+        return text;
+    }
+
+    void SortRows(std::vector<Row>& rows, SortColumn column) {
+        std::sort(rows.begin(), rows.end(), [column](Row const& a, Row const& b) {
+            switch (column) {
+                case SortColumn::Rate: return a.callsPerSecond > b.callsPerSecond;
+                case SortColumn::Calls: return a.section->count > b.section->count;
+                case SortColumn::Avg: return a.section->avgTime > b.section->avgTime;
+                case SortColumn::Max: return a.section->maxTime > b.section->maxTime;
+                case SortColumn::P99: return a.section->p99Time > b.section->p99Time;
+                case SortColumn::Total: return a.section->totalTime > b.section->totalTime;
+                default: return std::strcmp(a.section->name, b.section->name) < 0;
+            }
+        });
+    }
+
+    // Rows the terminal has room for, or every row when not on a terminal
+    size_t GetVisibleRows(bool interactive) {
+#if defined(PROFILER_HAS_TERMINAL)
+        struct winsize size;
+        if (interactive && ioctl(STDOUT_FILENO, TIOCGWINSZ, &size) == 0 && size.ws_row > 4) {
+            return size.ws_row - 4;
+        }
+#endif
+        return SIZE_MAX;
+    }
+
+    void PrintFrame(LiveStatsSnapshot const& snapshot, std::vector<Row>& rows, SortColumn column, bool interactive) {
+        SortRows(rows, column);
+        if (interactive) {
+            // Home the cursor and clear the screen
+            std::printf("\033[H\033[2J");
+        }
+
+        std::printf("Process %lld, %u threads, up %.1fs, %zu sections", (long long)snapshot.processId, snapshot.threadCount, snapshot.publishTime, snapshot.sections.size());
+        if (snapshot.droppedSections > 0) {
+            std::printf(" (%u more not shown)", snapshot.droppedSections);
+        }
+        std::printf(", sorted by %s\n\n", GetSortColumnName(column));
+        std::printf("%-40s %12s %12s %10s %10s %10s %10s %10s %10s %10s\n", "Section", "Calls", "Calls/s", "Avg", "Max", "P50", "P90", "P99", "P99.9", "Total");
+
+        size_t visible = std::min(rows.size(), GetVisibleRows(interactive));
+        for (size_t i = 0; i < visible; i++) {
+            LiveSectionStats const& section = *rows[i].section;
+            std::printf("%-40.40s %12lld %12.1f %10s %10s %10s %10s %10s %10s %10s\n", section.name, (long long)section.count, rows[i].callsPerSecond, FormatTime(section.avgTime).c_str(), FormatTime(section.maxTime).c_str(), FormatTime(section.p50Time).c_str(), FormatTime(section.p90Time).c_str(), FormatTime(section.p99Time).c_str(), FormatTime(section.p999Time).c_str(), FormatTime(section.totalTime).c_str());
+        }
+        std::fflush(stdout);
+    }
+
+#if defined(PROFILER_HAS_TERMINAL)
+    // Puts the terminal into single-key mode and restores it on destruction
+    class RawTerminal {
+    public:
+        RawTerminal(): active(false) {
+            if (!isatty(STDIN_FILENO) || tcgetattr(STDIN_FILENO, &saved) != 0) {
+                return;
+            }
+            struct termios raw = saved;
+            raw.c_lflag &= ~(ICANON | ECHO);
+            raw.c_cc[VMIN] = 0;
+            raw.c_cc[VTIME] = 0;
+            active = tcsetattr(STDIN_FILENO, TCSANOW, &raw) == 0;
+        }
+        ~RawTerminal() {
+            if (active) {
+                tcsetattr(STDIN_FILENO, TCSANOW, &saved);
+            }
+        }
+
+        bool active;
+        struct termios saved;
+    };
+#endif
+
+    // Waits out the refresh interval, returning early with a key press. Returns
+    // 0 when no key was pressed.
+    char WaitForKey(double seconds, bool interactive) {
+#if defined(PROFILER_HAS_TERMINAL)
+        if (interactive) {
+            struct pollfd input = { STDIN_FILENO, POLLIN, 0 };
+            char key = 0;
+            if (poll(&input, 1, (int)(seconds * 1000)) > 0 && read(STDIN_FILENO, &key, 1) == 1) {
+                return key;
+            }
+            return 0;
+        }
+#endif
+        std::this_thread::sleep_for(std::chrono::duration<double>(seconds));
+        return 0;
+    }
+}
+
+int main(int argc, char** argv) {
+    if (argc < 2 || argc % 2 != 0) {
+        std::cerr << "Usage: " << argv[0] << " <pid> [-s rate|calls|avg|max|p99|total|name] [-i seconds] [-n frames]" << std::endl;
+        return 1;
+    }
+
+    int64_t processId = std::atoll(argv[1]);
+    SortColumn column = SortColumn::Rate;
+    double interval = 1.0;
+    long frames = -1;
+    for (int i = 2; i + 1 < argc; i += 2) {
+        if (std::strcmp(argv[i], "-s") == 0 && ParseSortColumn(argv[i + 1][0], column)) {
+            continue;
+        }
+        if (std::strcmp(argv[i], "-i") == 0 && std::atof(argv[i + 1]) > 0) {
+            interval = std::atof(argv[i + 1]);
+            continue;
+        }
+        if (std::strcmp(argv[i], "-n") == 0 && std::atol(argv[i + 1]) > 0) {
+            frames = std::atol(argv[i + 1]);
+            continue;
+        }
+        std::cerr << "Unknown option " << argv[i] << " " << argv[i + 1] << std::endl;
+        return 1;
+    }
+
+    LiveStatsReader reader;
+    try {
+        reader.open(processId);
+    } catch (std::exception const& error) {
+        std::cerr << error.what() << std::endl;
+        return 1;
+    }
+
+#if defined(PROFILER_HAS_TERMINAL)
+    RawTerminal terminal;
+    bool interactive = terminal.active && isatty(STDOUT_FILENO);
+#else
+    bool interactive = false;
+#endif
+
+    // Counts and time of the last publish seen, and the rates it gave
+    std::map<std::string, int64_t> previousCounts;
+    std::map<std::string, double> rates;
+    double previousTime = 0;
+    LiveStatsSnapshot snapshot;
+    for (long frame = 0; frames < 0 || frame < frames; frame++) {
+        if (!reader.isProcessAlive()) {
+            std::cerr << "Process " << processId << " has exited" << std::endl;
+            return 0;
+        }
+        if (!reader.read(snapshot)) {
+            std::cerr << "Process " << processId << " stopped publishing halfway" << std::endl;
+            return 1;
+        }
+
+        // Rates over the last publish interval, or over the whole run at first.
+        // A refresh faster than the publisher keeps the rates it had.
+        if (snapshot.publishTime > previousTime) {
+            double elapsed = snapshot.publishTime - previousTime;
+            std::map<std::string, int64_t> counts;
+            for (LiveSectionStats const& section : snapshot.sections) {
+                auto previous = previousCounts.find(section.name);
+                int64_t calls = section.count - (previous != previousCounts.end() ? previous->second : 0);
+                // A reset starts the counts over
+                if (calls < 0) {
+                    calls = section.count;
+                }
+                rates[section.name] = calls / elapsed;
+                counts[section.name] = section.count;
+            }
+            previousCounts.swap(counts);
+            previousTime = snapshot.publishTime;
+        }
+
+        std::vector<Row> rows;
+        for (LiveSectionStats const& section : snapshot.sections) {
+            rows.push_back({ &section, rates[section.name] });
+        }
+        PrintFrame(snapshot, rows, column, interactive);
+
+        if (frames >= 0 && frame + 1 >= frames) {
+            break;
+        }
+        char key = WaitForKey(interval, interactive);
+        if (key == 'q') {
+            break;
+        }
+        ParseSortColumn(key, column);
+    }
+    return 0;
+}
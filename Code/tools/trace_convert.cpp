@@ -0,0 +1,41 @@
+// Converts a binary trace written by Profiler::startTrace into the profiler's
+// usual reports.
+//
+//   trace_convert <trace file> [csv file] [json file] [chrome trace file]
+//
+// With only the trace given, the stats are printed instead.
+#include "../profiler.hpp"
+#include <iostream>
+#include <stdexcept>
+
+int main(int argc, char** argv) {
+    if (argc < 2 || argc > 5) {
+        std::cerr << "Usage: " << argv[0] << " <trace file> [csv file] [json file] [chrome trace file]" << std::endl;
+        return 1;
+    }
+
+    Profiler* profiler = Profiler::GetInstance();
+    try {
+        profiler->loadTrace(argv[1]);
+    } catch (std::exception const& error) {
+        std::cerr << error.what() << std::endl;
+        delete profiler;
+        return 1;
+    }
+
+    if (argc == 2) {
+        profiler->printStats();
+    }
+    if (argc >= 3) {
+        profiler->saveStatsToCSV(argv[2]);
+    }
+    if (argc >= 4) {
+        profiler->saveStatsToJSON(argv[3]);
+    }
+    if (argc >= 5) {
+        profiler->saveChromeTrace(argv[4]);
+    }
+
+    delete profiler;
+    return 0;
+}
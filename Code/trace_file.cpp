@@ -0,0 +1,266 @@
+#include "trace_file.hpp"
+#include "profiler.hpp"
+#include "time.hpp"
+#include <chrono>
+#include <cstring>
+#include <stdexcept>
+
+constexpr char const* TraceWriter::MAGIC;
+constexpr uint32_t TraceWriter::VERSION;
+constexpr int TraceWriter::FLUSH_INTERVAL_MS;
+constexpr size_t TraceWriter::CHUNK_BYTES;
+
+TraceEvent::TraceEvent(): sectionId(-1), lineNumber(0), ticksAtStart(0), elapsedTicks(0), correctedTicks(0), fileName("null"), functionName("null") {}
+TraceEvent::TraceEvent(int sectionId, int64_t ticksAtStart, int64_t elapsedTicks, int64_t correctedTicks, int lineNumber, const char* fileName, const char* functionName): sectionId(sectionId), lineNumber(lineNumber), ticksAtStart(ticksAtStart), elapsedTicks(elapsedTicks), correctedTicks(correctedTicks), fileName(fileName), functionName(functionName) {}
+
+TraceWriter::TraceWriter(): stopping(false), lastLocation(nullptr, nullptr, -1), lastLocationId(0) {}
+
+TraceWriter::~TraceWriter() {
+    close();
+}
+
+void TraceWriter::open(const char* filename, int64_t measurementBiasTicks, int64_t probeOverheadTicks) {
+    close();
+
+    file.open(filename, std::ios::binary | std::ios::trunc);
+    if (!file.is_open()) {
+        throw std::runtime_error(std::string("Could not create trace file ") + filename);
+    }
+
+    TraceHeader header;
+    std::memset(&header, 0, sizeof(header));
+    std::strncpy(header.magic, MAGIC, sizeof(header.magic));
+    header.version = VERSION;
+    header.clockSource = (uint32_t)GetClockSource();
+    header.ticksPerSecond = GetTicksPerSecond();
+    header.startTicks = GetStartTicks();
+    header.measurementBiasTicks = measurementBiasTicks;
+    header.probeOverheadTicks = probeOverheadTicks;
+    file.write(reinterpret_cast<char const*>(&header), sizeof(header));
+    file.flush();
+
+    buffer.reserve(CHUNK_BYTES * 2);
+    sectionsWritten.clear();
+    locationIds.clear();
+    lastLocation = std::make_tuple(nullptr, nullptr, -1);
+    stopping = false;
+    flushThread = std::thread(&TraceWriter::run, this);
+}
+
+void TraceWriter::addQueue(int threadIndex, EventQueue<TraceEvent>* queue) {
+    std::lock_guard<std::mutex> lock(mutex);
+    queues.push_back(std::make_pair(threadIndex, queue));
+}
+
+void TraceWriter::close() {
+    if (!flushThread.joinable()) {
+        return;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+    }
+    wake.notify_one();
+    flushThread.join();
+
+    // Whatever was pushed before the thread stopped
+    drainQueues();
+
+    uint64_t dropped = 0;
+    for (auto const& queue : queues) {
+        dropped += queue.second->getDropped();
+    }
+    uint32_t end[2] = { (uint32_t)TraceEntry::End, 0 };
+    appendBytes(end, sizeof(end));
+    appendBytes(&dropped, sizeof(dropped));
+    writeBuffer();
+
+    file.close();
+    queues.clear();
+}
+
+bool TraceWriter::isOpen() {
+    return flushThread.joinable();
+}
+
+void TraceWriter::run() {
+    std::unique_lock<std::mutex> lock(mutex);
+    bool behind = false;
+    while (!stopping) {
+        if (!behind) {
+            wake.wait_for(lock, std::chrono::milliseconds(FLUSH_INTERVAL_MS));
+        }
+        lock.unlock();
+        behind = drainQueues();
+        writeBuffer();
+        lock.lock();
+    }
+}
+
+bool TraceWriter::drainQueues() {
+    std::vector<std::pair<int, EventQueue<TraceEvent>*>> current;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        current = queues;
+    }
+
+    bool behind = false;
+    for (auto const& queue : current) {
+        int threadIndex = queue.first;
+        size_t drained = queue.second->drain([&](TraceEvent const& event) {
+            appendEvent(threadIndex, event);
+        });
+        behind = behind || drained >= queue.second->getCapacity() / 2;
+    }
+    return behind;
+}
+
+void TraceWriter::appendEvent(int threadIndex, TraceEvent const& event) {
+    // Define the section the first time it shows up
+    if (event.sectionId >= (int)sectionsWritten.size()) {
+        sectionsWritten.resize(event.sectionId + 1, false);
+    }
+    if (!sectionsWritten[event.sectionId]) {
+        sectionsWritten[event.sectionId] = true;
+        std::string name = SectionRegistry::GetName(event.sectionId);
+        uint32_t definition[3] = { (uint32_t)TraceEntry::Section, (uint32_t)event.sectionId, (uint32_t)name.size() };
+        appendBytes(definition, sizeof(definition));
+        appendBytes(name.data(), name.size());
+    }
+
+    // Same for the call site
+    auto location = std::make_tuple(event.fileName, event.functionName, event.lineNumber);
+    if (location != lastLocation) {
+        auto found = locationIds.find(location);
+        if (found != locationIds.end()) {
+            lastLocationId = found->second;
+        } else {
+            lastLocationId = (uint32_t)locationIds.size();
+            locationIds[location] = lastLocationId;
+            size_t fileLength = std::strlen(event.fileName);
+            size_t functionLength = std::strlen(event.functionName);
+            uint32_t definition[5] = { (uint32_t)TraceEntry::Location, lastLocationId, (uint32_t)event.lineNumber, (uint32_t)fileLength, (uint32_t)functionLength };
+            appendBytes(definition, sizeof(definition));
+            appendBytes(event.fileName, fileLength);
+            appendBytes(event.functionName, functionLength);
+        }
+        lastLocation = location;
+    }
+
+    TraceRecord record;
+    record.kind = (uint32_t)TraceEntry::Event;
+    record.sectionId = (uint32_t)event.sectionId;
+    record.threadIndex = (uint32_t)threadIndex;
+    record.locationId = lastLocationId;
+    record.ticksAtStart = event.ticksAtStart;
+    record.elapsedTicks = event.elapsedTicks;
+    record.correctedTicks = event.correctedTicks;
+    appendBytes(&record, sizeof(record));
+
+    if (buffer.size() >= CHUNK_BYTES) {
+        writeBuffer();
+    }
+}
+
+void TraceWriter::appendBytes(void const* data, size_t size) {
+    char const* bytes = static_cast<char const*>(data);
+    buffer.insert(buffer.end(), bytes, bytes + size);
+}
+
+void TraceWriter::writeBuffer() {
+    if (buffer.empty()) {
+        return;
+    }
+
+    // Hand the chunk to the OS right away so it survives a crash of the program
+    file.write(buffer.data(), buffer.size());
+    file.flush();
+    buffer.clear();
+}
+
+TraceReader::TraceReader(): complete(false), droppedEvents(0) {
+    std::memset(&header, 0, sizeof(header));
+}
+
+void TraceReader::open(const char* filename) {
+    file.open(filename, std::ios::binary);
+    if (!file.is_open()) {
+        throw std::runtime_error(std::string("Could not open trace file ") + filename);
+    }
+
+    file.read(reinterpret_cast<char*>(&header), sizeof(header));
+    if (!file || std::strncmp(header.magic, TraceWriter::MAGIC, sizeof(header.magic)) != 0) {
+        throw std::runtime_error(std::string(filename) + " is not a trace file");
+    }
+    if (header.version != TraceWriter::VERSION) {
+        throw std::runtime_error(std::string(filename) + " has unsupported trace version " + std::to_string(header.version));
+    }
+}
+
+bool TraceReader::next(TraceRecord& record) {
+    uint32_t kind;
+    while (file.read(reinterpret_cast<char*>(&kind), sizeof(kind))) {
+        if (kind == (uint32_t)TraceEntry::Event) {
+            record.kind = kind;
+            if (!file.read(reinterpret_cast<char*>(&record) + sizeof(kind), sizeof(record) - sizeof(kind))) {
+                return false;
+            }
+            return true;
+        }
+
+        if (kind == (uint32_t)TraceEntry::Section) {
+            uint32_t fields[2];
+            if (!file.read(reinterpret_cast<char*>(fields), sizeof(fields))) {
+                return false;
+            }
+            std::string name(fields[1], '\0');
+            if (!file.read(&name[0], fields[1])) {
+                return false;
+            }
+            if (fields[0] >= sectionNames.size()) {
+                sectionNames.resize(fields[0] + 1);
+            }
+            sectionNames[fields[0]] = name;
+        } else if (kind == (uint32_t)TraceEntry::Location) {
+            uint32_t fields[4];
+            if (!file.read(reinterpret_cast<char*>(fields), sizeof(fields))) {
+                return false;
+            }
+            std::string fileName(fields[2], '\0');
+            std::string functionName(fields[3], '\0');
+            if (!file.read(&fileName[0], fields[2]) || !file.read(&functionName[0], fields[3])) {
+                return false;
+            }
+            // Locations are numbered in the order they are defined
+            fileNames.push_back(fileName);
+            functionNames.push_back(functionName);
+            lineNumbers.push_back((int)fields[1]);
+        } else if (kind == (uint32_t)TraceEntry::End) {
+            uint32_t padding;
+            if (file.read(reinterpret_cast<char*>(&padding), sizeof(padding)) && file.read(reinterpret_cast<char*>(&droppedEvents), sizeof(droppedEvents))) {
+                complete = true;
+            }
+            return false;
+        } else {
+            throw std::runtime_error("Corrupt trace entry of kind " + std::to_string(kind));
+        }
+    }
+    return false;
+}
+
+std::string const& TraceReader::getSectionName(uint32_t sectionId) {
+    return sectionNames.at(sectionId);
+}
+
+std::string const& TraceReader::getFileName(uint32_t locationId) {
+    return fileNames.at(locationId);
+}
+
+std::string const& TraceReader::getFunctionName(uint32_t locationId) {
+    return functionNames.at(locationId);
+}
+
+int TraceReader::getLineNumber(uint32_t locationId) {
+    return lineNumbers.at(locationId);
+}
@@ -0,0 +1,149 @@
+//trace_file.hpp
+#pragma once
+#include <condition_variable>
+#include <cstdint>
+#include <fstream>
+#include <map>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <tuple>
+#include <utility>
+#include <vector>
+#include "event_buffer.hpp"
+
+// Binary trace files written while the program runs, so a crash loses at most
+// the last flush interval and the event history never has to fit in memory.
+//
+// A file is a TraceHeader followed by a stream of entries, each starting with
+// a uint32 TraceEntry kind. Exits are fixed-size TraceRecords. The section
+// names and call sites they refer to are defined once, before their first use:
+//   Section:  kind, section id, name length, name bytes
+//   Location: kind, location id, line number, file length, function length,
+//             file bytes, function bytes
+//   End:      kind, 0, uint64 events the threads had to drop
+// A file without the End entry was cut short, and ends at its last complete entry.
+enum class TraceEntry : uint32_t { Event = 1, Section = 2, Location = 3, End = 4 };
+
+struct TraceHeader {
+    char magic[8];
+    uint32_t version;
+    // ClockSource the ticks were read from
+    uint32_t clockSource;
+    double ticksPerSecond;
+    // GetStartTicks of the traced program, the origin of its timestamps
+    int64_t startTicks;
+    // Calibrated probe costs, see Profiler::calibrateOverhead
+    int64_t measurementBiasTicks;
+    int64_t probeOverheadTicks;
+};
+
+// One exit as stored on disk
+struct TraceRecord {
+    uint32_t kind;
+    uint32_t sectionId;
+    uint32_t threadIndex;
+    uint32_t locationId;
+    int64_t ticksAtStart;
+    int64_t elapsedTicks;
+    int64_t correctedTicks;
+};
+
+// One exit as queued by the recording thread. Copying it is all the hot path
+// does; names are resolved on the flush thread.
+class TraceEvent {
+public:
+    TraceEvent();
+    TraceEvent(int sectionId, int64_t ticksAtStart, int64_t elapsedTicks, int64_t correctedTicks, int lineNumber, const char* fileName, const char* functionName);
+
+    int sectionId;
+    int lineNumber;
+    int64_t ticksAtStart;
+    int64_t elapsedTicks;
+    int64_t correctedTicks;
+    const char* fileName;
+    const char* functionName;
+};
+
+// Owns a trace file and the background thread that fills it. Recording threads
+// push TraceEvents into their own queue; every flush interval the flush thread
+// drains the queues into one large buffer and writes it out with a single call.
+// The interval is short enough that a 64K-event queue doesn't fill up even
+// under a tight loop of sections; while a drain keeps finding full queues, the
+// thread goes again without sleeping.
+class TraceWriter {
+public:
+    static constexpr char const* MAGIC = "PROFTRC";
+    static constexpr uint32_t VERSION = 2;
+    static constexpr int FLUSH_INTERVAL_MS = 5;
+    // The buffer is written early if it grows past this between flushes
+    static constexpr size_t CHUNK_BYTES = 1 << 20;
+
+    TraceWriter();
+    ~TraceWriter();
+
+    // Creates the file and starts the flush thread. Throws std::runtime_error if
+    // the file can't be created.
+    void open(const char* filename, int64_t measurementBiasTicks, int64_t probeOverheadTicks);
+    // The flush thread drains this queue from now on. The queue must outlive close().
+    void addQueue(int threadIndex, EventQueue<TraceEvent>* queue);
+    // Drains every queue one last time, writes the End entry and closes the file
+    void close();
+    bool isOpen();
+
+private:
+    void run();
+    // Flush thread only, like everything below it. Returns true if any queue
+    // was at least half full.
+    bool drainQueues();
+    void appendEvent(int threadIndex, TraceEvent const& event);
+    void appendBytes(void const* data, size_t size);
+    void writeBuffer();
+
+    std::ofstream file;
+    std::thread flushThread;
+
+    // Guards the queue list and the stop flag
+    std::mutex mutex;
+    std::condition_variable wake;
+    bool stopping;
+    std::vector<std::pair<int, EventQueue<TraceEvent>*>> queues;
+
+    std::vector<char> buffer;
+    // Section ids already defined in the file
+    std::vector<bool> sectionsWritten;
+    // Location id of each (file, function, line) already defined in the file
+    std::map<std::tuple<const char*, const char*, int>, uint32_t> locationIds;
+    // Consecutive exits usually share a call site, so the last one is kept aside
+    std::tuple<const char*, const char*, int> lastLocation;
+    uint32_t lastLocationId;
+};
+
+// Reads a trace back, one exit at a time
+class TraceReader {
+public:
+    TraceReader();
+
+    // Throws std::runtime_error if the file can't be read or isn't a trace
+    void open(const char* filename);
+    // Reads up to the next exit, taking in any definitions on the way. Returns
+    // false at the end of the file.
+    bool next(TraceRecord& record);
+
+    std::string const& getSectionName(uint32_t sectionId);
+    std::string const& getFileName(uint32_t locationId);
+    std::string const& getFunctionName(uint32_t locationId);
+    int getLineNumber(uint32_t locationId);
+
+    TraceHeader header;
+    // Set once the End entry has been read
+    bool complete;
+    uint64_t droppedEvents;
+
+private:
+    std::ifstream file;
+    std::vector<std::string> sectionNames;
+    std::vector<std::string> fileNames;
+    std::vector<std::string> functionNames;
+    std::vector<int> lineNumbers;
+};
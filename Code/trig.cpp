@@ -0,0 +1,246 @@
+#include "trig.hpp"
+#include <cmath>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <limits>
+
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__)
+#include <immintrin.h>
+#define PROFILER_HAS_SIMD 1
+#endif
+
+namespace {
+    constexpr float DEGREES_PER_QUADRANT = 90.0f;
+    constexpr float QUADRANTS_PER_DEGREE = 1.0f / 90.0f;
+    constexpr float RADIANS_PER_DEGREE = 0.017453292519943295f;
+
+    // Cephes minimax coefficients on [-pi/4, pi/4]
+    constexpr float SIN_C1 = -1.6666654611e-1f;
+    constexpr float SIN_C2 = 8.3321608736e-3f;
+    constexpr float SIN_C3 = -1.9515295891e-4f;
+    constexpr float COS_C1 = 4.166664568298827e-2f;
+    constexpr float COS_C2 = -1.388731625493765e-3f;
+    constexpr float COS_C3 = 2.443315711809948e-5f;
+
+    SimdLevel gSimdLevel = SimdLevel::Scalar;
+
+    // The reference version every kernel follows lane by lane
+    void sinCosScalar(float degrees, float& sine, float& cosine) {
+        float quadrant = std::nearbyint(degrees * QUADRANTS_PER_DEGREE);
+        // Within a factor of two of each other, so the difference is exact
+        float x = (degrees - quadrant * DEGREES_PER_QUADRANT) * RADIANS_PER_DEGREE;
+        float x2 = x * x;
+        float s = x + x * x2 * (SIN_C1 + x2 * (SIN_C2 + x2 * SIN_C3));
+        float c = 1.0f - 0.5f * x2 + x2 * x2 * (COS_C1 + x2 * (COS_C2 + x2 * COS_C3));
+
+        // Rotate by the quadrant
+        int q = (int)quadrant;
+        if (q & 1) {
+            float swap = s;
+            s = c;
+            c = -swap;
+        }
+        if (q & 2) {
+            s = -s;
+            c = -c;
+        }
+        sine = s;
+        cosine = c;
+    }
+
+#if defined(PROFILER_HAS_SIMD)
+    __attribute__((target("sse2")))
+    void sinCosSse2(__m128 degrees, __m128& sine, __m128& cosine) {
+        __m128i q = _mm_cvtps_epi32(_mm_mul_ps(degrees, _mm_set1_ps(QUADRANTS_PER_DEGREE)));
+        __m128 quadrant = _mm_cvtepi32_ps(q);
+        __m128 x = _mm_mul_ps(_mm_sub_ps(degrees, _mm_mul_ps(quadrant, _mm_set1_ps(DEGREES_PER_QUADRANT))), _mm_set1_ps(RADIANS_PER_DEGREE));
+        __m128 x2 = _mm_mul_ps(x, x);
+
+        __m128 s = _mm_add_ps(_mm_set1_ps(SIN_C2), _mm_mul_ps(x2, _mm_set1_ps(SIN_C3)));
+        s = _mm_add_ps(_mm_set1_ps(SIN_C1), _mm_mul_ps(x2, s));
+        s = _mm_add_ps(x, _mm_mul_ps(_mm_mul_ps(x, x2), s));
+        __m128 c = _mm_add_ps(_mm_set1_ps(COS_C2), _mm_mul_ps(x2, _mm_set1_ps(COS_C3)));
+        c = _mm_add_ps(_mm_set1_ps(COS_C1), _mm_mul_ps(x2, c));
+        c = _mm_add_ps(_mm_sub_ps(_mm_set1_ps(1.0f), _mm_mul_ps(_mm_set1_ps(0.5f), x2)), _mm_mul_ps(_mm_mul_ps(x2, x2), c));
+
+        // Odd quadrants swap sine and cosine; the sign bits come straight from q
+        __m128 swap = _mm_castsi128_ps(_mm_cmpeq_epi32(_mm_and_si128(q, _mm_set1_epi32(1)), _mm_set1_epi32(1)));
+        __m128 sineBase = _mm_or_ps(_mm_and_ps(swap, c), _mm_andnot_ps(swap, s));
+        __m128 cosineBase = _mm_or_ps(_mm_and_ps(swap, s), _mm_andnot_ps(swap, c));
+        __m128 sineSign = _mm_castsi128_ps(_mm_slli_epi32(_mm_and_si128(q, _mm_set1_epi32(2)), 30));
+        __m128 cosineSign = _mm_castsi128_ps(_mm_slli_epi32(_mm_and_si128(_mm_add_epi32(q, _mm_set1_epi32(1)), _mm_set1_epi32(2)), 30));
+        sine = _mm_xor_ps(sineBase, sineSign);
+        cosine = _mm_xor_ps(cosineBase, cosineSign);
+    }
+
+    __attribute__((target("avx2,fma")))
+    void sinCosAvx2(__m256 degrees, __m256& sine, __m256& cosine) {
+        __m256i q = _mm256_cvtps_epi32(_mm256_mul_ps(degrees, _mm256_set1_ps(QUADRANTS_PER_DEGREE)));
+        __m256 quadrant = _mm256_cvtepi32_ps(q);
+        __m256 x = _mm256_mul_ps(_mm256_fnmadd_ps(quadrant, _mm256_set1_ps(DEGREES_PER_QUADRANT), degrees), _mm256_set1_ps(RADIANS_PER_DEGREE));
+        __m256 x2 = _mm256_mul_ps(x, x);
+
+        __m256 s = _mm256_fmadd_ps(x2, _mm256_set1_ps(SIN_C3), _mm256_set1_ps(SIN_C2));
+        s = _mm256_fmadd_ps(x2, s, _mm256_set1_ps(SIN_C1));
+        s = _mm256_fmadd_ps(_mm256_mul_ps(x, x2), s, x);
+        __m256 c = _mm256_fmadd_ps(x2, _mm256_set1_ps(COS_C3), _mm256_set1_ps(COS_C2));
+        c = _mm256_fmadd_ps(x2, c, _mm256_set1_ps(COS_C1));
+        c = _mm256_fmadd_ps(_mm256_mul_ps(x2, x2), c, _mm256_fnmadd_ps(_mm256_set1_ps(0.5f), x2, _mm256_set1_ps(1.0f)));
+
+        __m256 swap = _mm256_castsi256_ps(_mm256_cmpeq_epi32(_mm256_and_si256(q, _mm256_set1_epi32(1)), _mm256_set1_epi32(1)));
+        __m256 sineBase = _mm256_blendv_ps(s, c, swap);
+        __m256 cosineBase = _mm256_blendv_ps(c, s, swap);
+        __m256 sineSign = _mm256_castsi256_ps(_mm256_slli_epi32(_mm256_and_si256(q, _mm256_set1_epi32(2)), 30));
+        __m256 cosineSign = _mm256_castsi256_ps(_mm256_slli_epi32(_mm256_and_si256(_mm256_add_epi32(q, _mm256_set1_epi32(1)), _mm256_set1_epi32(2)), 30));
+        sine = _mm256_xor_ps(sineBase, sineSign);
+        cosine = _mm256_xor_ps(cosineBase, cosineSign);
+    }
+
+    __attribute__((target("sse2")))
+    size_t sinCosBatchSse2(float const* degrees, float* sines, float* cosines, size_t count) {
+        size_t i = 0;
+        for (; i + 4 <= count; i += 4) {
+            __m128 s;
+            __m128 c;
+            sinCosSse2(_mm_loadu_ps(degrees + i), s, c);
+            _mm_storeu_ps(sines + i, s);
+            _mm_storeu_ps(cosines + i, c);
+        }
+        return i;
+    }
+
+    __attribute__((target("avx2,fma")))
+    size_t sinCosBatchAvx2(float const* degrees, float* sines, float* cosines, size_t count) {
+        size_t i = 0;
+        for (; i + 8 <= count; i += 8) {
+            __m256 s;
+            __m256 c;
+            sinCosAvx2(_mm256_loadu_ps(degrees + i), s, c);
+            _mm256_storeu_ps(sines + i, s);
+            _mm256_storeu_ps(cosines + i, c);
+        }
+        return i;
+    }
+
+    __attribute__((target("sse2")))
+    size_t maxCosPlusSinSse2(float const* degrees, size_t count, float& best) {
+        __m128 maximum = _mm_set1_ps(best);
+        size_t i = 0;
+        for (; i + 4 <= count; i += 4) {
+            __m128 s;
+            __m128 c;
+            sinCosSse2(_mm_loadu_ps(degrees + i), s, c);
+            maximum = _mm_max_ps(maximum, _mm_add_ps(c, s));
+        }
+        float lanes[4];
+        _mm_storeu_ps(lanes, maximum);
+        for (float lane : lanes) {
+            best = lane > best ? lane : best;
+        }
+        return i;
+    }
+
+    __attribute__((target("avx2,fma")))
+    size_t maxCosPlusSinAvx2(float const* degrees, size_t count, float& best) {
+        __m256 maximum = _mm256_set1_ps(best);
+        size_t i = 0;
+        for (; i + 8 <= count; i += 8) {
+            __m256 s;
+            __m256 c;
+            sinCosAvx2(_mm256_loadu_ps(degrees + i), s, c);
+            maximum = _mm256_max_ps(maximum, _mm256_add_ps(c, s));
+        }
+        float lanes[8];
+        _mm256_storeu_ps(lanes, maximum);
+        for (float lane : lanes) {
+            best = lane > best ? lane : best;
+        }
+        return i;
+    }
+#endif
+
+    // Picks the best level once, during static initialization
+    struct SimdStartup {
+        SimdStartup() {
+            char const* requested = std::getenv("PROFILER_SIMD");
+            if (requested != nullptr && std::strcmp(requested, "scalar") == 0) {
+                return;
+            }
+            if ((requested == nullptr || std::strcmp(requested, "sse2") != 0) && SetSimdLevel(SimdLevel::Avx2)) {
+                return;
+            }
+            SetSimdLevel(SimdLevel::Sse2);
+        }
+    };
+    SimdStartup gSimdStartup;
+}
+
+bool HasSimdLevel(SimdLevel level) {
+#if defined(PROFILER_HAS_SIMD)
+    if (level == SimdLevel::Avx2) {
+        return __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma");
+    }
+    if (level == SimdLevel::Sse2) {
+        return __builtin_cpu_supports("sse2");
+    }
+#endif
+    return level == SimdLevel::Scalar;
+}
+
+bool SetSimdLevel(SimdLevel level) {
+    if (!HasSimdLevel(level)) {
+        return false;
+    }
+    gSimdLevel = level;
+    return true;
+}
+
+SimdLevel GetSimdLevel() {
+    return gSimdLevel;
+}
+
+char const* GetSimdLevelName(SimdLevel level) {
+    switch (level) {
+        case SimdLevel::Avx2:
+            return "AVX2";
+        case SimdLevel::Sse2:
+            return "SSE2";
+        default:
+            return "Scalar";
+    }
+}
+
+void SinCosDegrees(float const* degrees, float* sines, float* cosines, size_t count) {
+    size_t done = 0;
+#if defined(PROFILER_HAS_SIMD)
+    if (gSimdLevel == SimdLevel::Avx2) {
+        done = sinCosBatchAvx2(degrees, sines, cosines, count);
+    } else if (gSimdLevel == SimdLevel::Sse2) {
+        done = sinCosBatchSse2(degrees, sines, cosines, count);
+    }
+#endif
+    // The tail, or everything without SIMD
+    for (size_t i = done; i < count; i++) {
+        sinCosScalar(degrees[i], sines[i], cosines[i]);
+    }
+}
+
+float MaxCosPlusSinDegrees(float const* degrees, size_t count) {
+    float best = -std::numeric_limits<float>::infinity();
+    size_t done = 0;
+#if defined(PROFILER_HAS_SIMD)
+    if (gSimdLevel == SimdLevel::Avx2) {
+        done = maxCosPlusSinAvx2(degrees, count, best);
+    } else if (gSimdLevel == SimdLevel::Sse2) {
+        done = maxCosPlusSinSse2(degrees, count, best);
+    }
+#endif
+    for (size_t i = done; i < count; i++) {
+        float s;
+        float c;
+        sinCosScalar(degrees[i], s, c);
+        best = c + s > best ? c + s : best;
+    }
+    return best;
+}
@@ -0,0 +1,34 @@
+//trig.hpp
+#pragma once
+#include <cstddef>
+
+// Batched sine and cosine of angles in degrees.
+//
+// Angles are reduced to [-45, 45] degrees around the nearest multiple of 90,
+// which is exact in float arithmetic for |degrees| below about 1e7. Only then
+// are they converted to radians, so results at multiples of 90 degrees are
+// exact and results near them keep their full relative precision. Minimax
+// polynomials (Cephes sinf/cosf) on [-pi/4, pi/4] then keep the error under
+// 1.66 ULP for sine and cosine, measured against a double reference over every
+// float in [-720, 720]. The scalar and SSE2 kernels round the same way; the
+// AVX2 kernel's fused multiply-adds can differ from them in the last bit
+// (1.64 ULP at most).
+
+// Instruction set the kernels run on. Chosen once at startup as the best the
+// CPU supports; set PROFILER_SIMD=scalar or sse2 in the environment to cap it.
+enum class SimdLevel { Scalar, Sse2, Avx2 };
+
+// Switches the kernels. Returns false, and keeps the current level, if the CPU
+// doesn't support the requested one.
+bool SetSimdLevel(SimdLevel level);
+SimdLevel GetSimdLevel();
+bool HasSimdLevel(SimdLevel level);
+// Report name of a level, e.g. "AVX2"
+char const* GetSimdLevelName(SimdLevel level);
+
+// sines[i] and cosines[i] for degrees[i]. The outputs may alias each other
+// but not the input.
+void SinCosDegrees(float const* degrees, float* sines, float* cosines, size_t count);
+// Largest cos + sin over the angles, without storing either; -infinity for
+// an empty array
+float MaxCosPlusSinDegrees(float const* degrees, size_t count);